@@ -0,0 +1,307 @@
+// HTTP benchmarks against a running server. Each scenario logs in as the
+// default admin, drives the server over loopback sockets and prints one line
+// per measurement. Built by build.sh as compiled/http_bench.
+//
+//   http_bench load <idle> <clients> [seconds] [port]
+//   http_bench keepalive [clients] [seconds] [port]
+#include "json_reader.hpp"
+#include "latency_histogram.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+static const char* BENCH_FILE = "/http_bench.txt";
+
+static const double IDLE_CONNECT_LIMIT = 60;
+
+static int g_port = 8080;
+
+static double now_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int connect_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static std::string make_request(const std::string& path, const std::string& body, bool keep_alive) {
+    std::string request = "POST " + path + " HTTP/1.1\r\nHost: localhost\r\n";
+    if (!keep_alive) request += "Connection: close\r\n";
+    request += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    return request + body;
+}
+
+// Reads one response into body. Handles Content-Length and chunked bodies
+// (whose payload is kept with its framing, which is enough to check it);
+// without either the body runs to the end of the connection. reusable is
+// cleared when the server will not take another request on fd.
+static bool read_response(int fd, std::string* body, bool* reusable) {
+    std::string data;
+    char buffer[16384];
+    size_t header_end = std::string::npos;
+    
+    while (true) {
+        if (header_end == std::string::npos) {
+            header_end = data.find("\r\n\r\n");
+        }
+        if (header_end != std::string::npos) {
+            std::string head = data.substr(0, header_end);
+            *reusable = head.find("Connection: close") == std::string::npos;
+            size_t length = head.find("Content-Length: ");
+            if (length != std::string::npos) {
+                size_t size = strtoull(head.c_str() + length + 16, nullptr, 10);
+                if (data.size() >= header_end + 4 + size) {
+                    *body = data.substr(header_end + 4, size);
+                    return true;
+                }
+            } else if (head.find("Transfer-Encoding: chunked") != std::string::npos) {
+                if (data.size() >= header_end + 9 && data.compare(data.size() - 5, 5, "0\r\n\r\n") == 0) {
+                    *body = data.substr(header_end + 4);
+                    return true;
+                }
+            }
+        }
+        
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            if (header_end == std::string::npos) return false;
+            *body = data.substr(header_end + 4);
+            *reusable = false;
+            return true;
+        }
+        data.append(buffer, n);
+    }
+}
+
+// One request on a connection of its own.
+static bool call(const std::string& path, const std::string& body, std::string* response) {
+    int fd = connect_server();
+    if (fd < 0) return false;
+    bool reusable;
+    bool ok = send_all(fd, make_request(path, body, false)) && read_response(fd, response, &reusable);
+    close(fd);
+    return ok;
+}
+
+// Logs in as the default admin, who must not be logged in already, and
+// makes sure the file the clients read exists. Returns the session id, or
+// an empty string.
+static std::string prepare() {
+    std::string response;
+    if (!call("/user/login", "{\"username\":\"admin\",\"password\":\"admin123\"}", &response)) {
+        std::cerr << "Error: cannot reach the server on port " << g_port << "\n";
+        return "";
+    }
+    std::string session_id = JsonObject(response).get_string("session_id");
+    if (session_id.empty()) {
+        std::cerr << "Error: login failed: " << response << "\n";
+        return "";
+    }
+    
+    std::string content(1024, 'x');
+    call("/file/create", "{\"session_id\":\"" + session_id + "\",\"path\":\"" + BENCH_FILE +
+         "\",\"content\":\"" + content + "\"}", &response);
+    return session_id;
+}
+
+static void finish(const std::string& session_id) {
+    std::string response;
+    call("/user/logout", "{\"session_id\":\"" + session_id + "\"}", &response);
+}
+
+static uint64_t elapsed_us(double since) {
+    return (uint64_t)((now_seconds() - since) * 1e6);
+}
+
+// Whether the server still has fd open: nothing to read and no EOF.
+static bool still_open(int fd) {
+    pollfd entry = {fd, POLLIN, 0};
+    if (poll(&entry, 1, 0) <= 0) return true;
+    char byte;
+    return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+struct ClientResult {
+    uint64_t requests;
+    uint64_t errors;
+    LatencySummary latency;
+};
+
+// Runs clients that each read a 1 KB file as fast as the server answers,
+// for seconds. With keep_alive a client holds one connection for as long
+// as the server keeps it open; without, it connects for every request.
+static ClientResult run_clients(const std::string& session_id, uint32_t clients, double seconds,
+                                bool keep_alive) {
+    std::string request = make_request("/file/read", "{\"session_id\":\"" + session_id + "\",\"path\":\"" +
+                                       BENCH_FILE + "\"}", keep_alive);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> requests(0), errors(0);
+    LatencyHistogram latency;
+    std::vector<std::thread> threads;
+    
+    for (uint32_t i = 0; i < clients; i++) {
+        threads.emplace_back([&] {
+            int fd = -1;
+            std::string body;
+            bool reusable = false;
+            while (!stop) {
+                double start = now_seconds();
+                if (fd < 0) fd = connect_server();
+                bool ok = fd >= 0 && send_all(fd, request) && read_response(fd, &body, &reusable) &&
+                          body.find("\"success\":true") != std::string::npos;
+                if (ok) {
+                    latency.record(elapsed_us(start));
+                    requests++;
+                } else {
+                    errors++;
+                    usleep(1000);
+                }
+                if (fd >= 0 && (!ok || !reusable || !keep_alive)) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            if (fd >= 0) close(fd);
+        });
+    }
+    
+    usleep((useconds_t)(seconds * 1e6));
+    stop = true;
+    for (auto& thread : threads) thread.join();
+    
+    return {requests.load(), errors.load(), latency.summary()};
+}
+
+static void print_result(const ClientResult& result, double seconds) {
+    printf("%.0f req/s  p50 %lluus p99 %lluus max %lluus  errors %llu\n",
+           result.requests / seconds, (unsigned long long)result.latency.p50_us,
+           (unsigned long long)result.latency.p99_us, (unsigned long long)result.latency.max_us,
+           (unsigned long long)result.errors);
+}
+
+// Opens idle connections that never send a byte, then runs keep-alive
+// clients. Idle connections cost the server memory and, with a thread per
+// connection, a thread each; this shows what they do to the active
+// clients.
+static int bench_load(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: http_bench load <idle> <clients> [seconds] [port]\n";
+        return 1;
+    }
+    uint32_t idle = atoi(argv[2]);
+    uint32_t clients = std::max(1, atoi(argv[3]));
+    double seconds = argc > 4 ? std::max(1, atoi(argv[4])) : 5;
+    if (argc > 5) g_port = atoi(argv[5]);
+    
+    std::string session_id = prepare();
+    if (session_id.empty()) return 1;
+    
+    // A server that accepts slowly gets IDLE_CONNECT_LIMIT seconds; the
+    // clients then run against however many connections it took.
+    std::vector<int> idle_fds;
+    double connect_start = now_seconds();
+    for (uint32_t i = 0; i < idle && now_seconds() - connect_start < IDLE_CONNECT_LIMIT; i++) {
+        int fd = connect_server();
+        if (fd < 0) break;
+        idle_fds.push_back(fd);
+    }
+    double connect_time = now_seconds() - connect_start;
+    
+    ClientResult result = run_clients(session_id, clients, seconds, true);
+    
+    uint32_t open = 0;
+    for (int fd : idle_fds) {
+        if (still_open(fd)) open++;
+        close(fd);
+    }
+    
+    finish(session_id);
+    
+    printf("load idle=%u (connected %zu in %.2fs, %u open at end) clients=%u  ",
+           idle, idle_fds.size(), connect_time, open, clients);
+    print_result(result, seconds);
+    return 0;
+}
+
+// The same clients with and without keep-alive, so the difference is the
+// cost of a connection per request.
+static int bench_keepalive(int argc, char* argv[]) {
+    uint32_t clients = argc > 2 ? std::max(1, atoi(argv[2])) : 8;
+    double seconds = argc > 3 ? std::max(1, atoi(argv[3])) : 5;
+    if (argc > 4) g_port = atoi(argv[4]);
+    
+    std::string session_id = prepare();
+    if (session_id.empty()) return 1;
+    
+    for (bool keep_alive : {true, false}) {
+        ClientResult result = run_clients(session_id, clients, seconds, keep_alive);
+        printf("keepalive %-3s clients=%u  ", keep_alive ? "on" : "off", clients);
+        print_result(result, seconds);
+    }
+    
+    finish(session_id);
+    return 0;
+}
+
+static void print_usage() {
+    std::cout << "Usage: http_bench <scenario> [args]\n\n";
+    std::cout << "Scenarios:\n";
+    std::cout << "  load <idle> <clients> [seconds] [port]\n";
+    std::cout << "                   Requests per second and latency of keep-alive clients\n";
+    std::cout << "                   while <idle> other connections sit open\n";
+    std::cout << "  keepalive [clients] [seconds] [port]\n";
+    std::cout << "                   The same clients with keep-alive, then with a connection per request\n";
+    std::cout << "\nThe server must be running, with the default admin account logged out.\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+    
+    std::string scenario = argv[1];
+    if (scenario == "load") return bench_load(argc, argv);
+    if (scenario == "keepalive") return bench_keepalive(argc, argv);
+    
+    std::cerr << "Error: Unknown scenario '" << scenario << "'\n";
+    print_usage();
+    return 1;
+}
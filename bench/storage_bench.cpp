@@ -0,0 +1,409 @@
+// Storage engine benchmarks. Each scenario builds a scratch container in a
+// work directory, drives OmniStorage and file_ops in-process and prints one
+// line per measurement. Built by build.sh as compiled/storage_bench.
+//
+//   storage_bench stripes <count> [file_mb] [readers] [stripe_dir...]
+//   storage_bench format [--preallocate] <size>...
+//   storage_bench contention <readers> <writers> [seconds] [file_kb]
+//   storage_bench paths [depth] [siblings]
+#include "omni_storage.hpp"
+#include "file_ops.hpp"
+#include "path_resolver.hpp"
+#include "fs_format.hpp"
+#include "user_manager.hpp"
+#include "latency_histogram.hpp"
+#include "logger.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
+
+OmniStorage* g_storage = nullptr;
+
+static const char* WORK_DIR = "/tmp/ofs_bench";
+
+static double now_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A fresh work directory, holding nothing from an earlier run.
+static std::string reset_work_dir() {
+    std::string command = std::string("rm -rf ") + WORK_DIR + " && mkdir -p " + WORK_DIR;
+    if (system(command.c_str()) != 0) {
+        std::cerr << "Error: cannot create " << WORK_DIR << "\n";
+        exit(1);
+    }
+    return std::string(WORK_DIR) + "/bench.omni";
+}
+
+static void remove_work_dir(const std::vector<std::string>& extra_dirs) {
+    std::string command = std::string("rm -rf ") + WORK_DIR;
+    for (const auto& dir : extra_dirs) command += " " + dir + "/bench.omni.*";
+    int ret = system(command.c_str());
+    (void)ret;
+}
+
+// Aggregate sequential read throughput of a striped container. `readers`
+// threads each read their own file of file_mb start to end, repeatedly, so
+// every stripe file is streamed at once.
+static int bench_stripes(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: storage_bench stripes <count> [file_mb] [readers] [stripe_dir...]\n";
+        return 1;
+    }
+    uint32_t stripes = std::max(1, atoi(argv[2]));
+    size_t file_mb = argc > 3 ? std::max(1, atoi(argv[3])) : 64;
+    uint32_t readers = argc > 4 ? std::max(1, atoi(argv[4])) : 1;
+    std::vector<std::string> dirs(argv + std::min(argc, 5), argv + argc);
+    
+    std::string path = reset_work_dir();
+    OmniStorage storage;
+    storage.set_stripe_dirs(dirs);
+    storage.set_readahead(0, 0);
+    uint64_t total_size = (uint64_t)(file_mb * readers + 64) << 20;
+    total_size += total_size / 4;
+    if (!storage.create(path, total_size, stripes)) {
+        std::cerr << "Error: cannot create container in " << WORK_DIR << "\n";
+        return 1;
+    }
+    
+    size_t file_size = file_mb << 20;
+    std::vector<uint8_t> data(file_size);
+    for (size_t i = 0; i < file_size; i++) data[i] = (uint8_t)(i * 2654435761u >> 24);
+    
+    std::vector<uint32_t> chains;
+    for (uint32_t i = 0; i < readers; i++) {
+        uint32_t chain = storage.write_chain(data.data(), file_size);
+        if (chain == 0 || chain == 0xFFFFFFFF) {
+            std::cerr << "Error: write failed\n";
+            return 1;
+        }
+        chains.push_back(chain);
+    }
+    storage.sync();
+    
+    // Enough rounds that every run moves at least 1 GB.
+    uint32_t rounds = std::max<size_t>(1, (1024 + file_mb * readers - 1) / (file_mb * readers));
+    std::atomic<bool> failed(false);
+    
+    double start = now_seconds();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < readers; i++) {
+        threads.emplace_back([&, i] {
+            std::vector<uint8_t> buffer(file_size);
+            for (uint32_t round = 0; round < rounds; round++) {
+                if (storage.read_chain(0, chains[i], buffer.data(), file_size) != file_size) failed = true;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    double elapsed = now_seconds() - start;
+    
+    storage.close();
+    remove_work_dir(dirs);
+    if (failed) {
+        std::cerr << "Error: read failed\n";
+        return 1;
+    }
+    
+    double mb = (double)file_mb * readers * rounds;
+    printf("stripes=%u readers=%u file_mb=%zu  read %.0f MB in %.3f s  %.1f MB/s\n",
+           stripes, readers, file_mb, mb, elapsed, mb / elapsed);
+    return 0;
+}
+
+// Bytes with an optional K, M or G suffix; 0 if malformed.
+static uint64_t parse_size(const std::string& text) {
+    char* end = nullptr;
+    uint64_t value = strtoull(text.c_str(), &end, 10);
+    std::string suffix = end;
+    if (suffix.empty()) return value;
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    return 0;
+}
+
+// Bytes the host filesystem has allocated for path.
+static uint64_t allocated_bytes(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return (uint64_t)st.st_blocks * 512;
+}
+
+// Time to format a container of each size with OmniStorage::create() and
+// with fs_format(), and what each leaves allocated on disk.
+static int bench_format(int argc, char* argv[]) {
+    bool preallocate = false;
+    int first = 2;
+    if (argc > first && std::string(argv[first]) == "--preallocate") {
+        preallocate = true;
+        first++;
+    }
+    if (argc <= first) {
+        std::cerr << "Usage: storage_bench format [--preallocate] <size>...\n";
+        return 1;
+    }
+    
+    for (int i = first; i < argc; i++) {
+        uint64_t size = parse_size(argv[i]);
+        if (size == 0) {
+            std::cerr << "Error: Invalid size '" << argv[i] << "'\n";
+            return 1;
+        }
+        
+        std::string path = reset_work_dir();
+        double start = now_seconds();
+        OmniStorage storage;
+        storage.set_space_policy(preallocate, false);
+        bool created = storage.create(path, size);
+        storage.close();
+        double create_time = now_seconds() - start;
+        uint64_t create_disk = allocated_bytes(path);
+        
+        path = reset_work_dir();
+        std::string config_path = std::string(WORK_DIR) + "/bench.uconf";
+        std::ofstream config(config_path);
+        config << "[filesystem]\ntotal_size = " << size << "\npreallocate = "
+               << (preallocate ? "true" : "false") << "\n";
+        config.close();
+        
+        start = now_seconds();
+        bool formatted = fs_format(path, config_path) == 0;
+        double format_time = now_seconds() - start;
+        uint64_t format_disk = allocated_bytes(path);
+        remove_work_dir({});
+        
+        if (!created || !formatted) {
+            std::cerr << "Error: formatting " << argv[i] << " failed\n";
+            return 1;
+        }
+        printf("format size=%s%s  create %.3f s, %.1f MB on disk  fs_format %.3f s, %.1f MB on disk\n",
+               argv[i], preallocate ? " preallocated" : "", create_time, create_disk / 1048576.0,
+               format_time, format_disk / 1048576.0);
+    }
+    return 0;
+}
+
+static uint64_t elapsed_us(double since) {
+    return (uint64_t)((now_seconds() - since) * 1e6);
+}
+
+// Readers and writers on disjoint files through file_ops, as the server
+// drives it. Each reader alternates reading its own file and listing the
+// shared directory; each writer alternates rewriting its own file and
+// creating and deleting a scratch file beside it. Run once with no writers
+// for the baseline reader latency.
+static int bench_contention(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: storage_bench contention <readers> <writers> [seconds] [file_kb]\n";
+        return 1;
+    }
+    uint32_t readers = atoi(argv[2]);
+    uint32_t writers = atoi(argv[3]);
+    double seconds = argc > 4 ? std::max(1, atoi(argv[4])) : 3;
+    size_t file_size = (size_t)(argc > 5 ? std::max(1, atoi(argv[5])) : 64) << 10;
+    
+    std::string path = reset_work_dir();
+    OmniStorage storage;
+    uint64_t total_size = ((uint64_t)(readers + 2 * writers) * file_size * 16) + (256 << 20);
+    if (!storage.create(path, total_size)) {
+        std::cerr << "Error: cannot create container in " << WORK_DIR << "\n";
+        return 1;
+    }
+    g_storage = &storage;
+    set_storage_instance(&storage);
+    load_users();
+    
+    OFS_Session session = nullptr;
+    if (user_login(&session, "admin", "admin123") != 0) {
+        std::cerr << "Error: login failed\n";
+        return 1;
+    }
+    
+    std::vector<uint8_t> data(file_size, 'x');
+    dir_create(session, "/bench");
+    for (uint32_t i = 0; i < readers; i++) {
+        file_create(session, "/bench/r" + std::to_string(i), data.data(), data.size());
+    }
+    for (uint32_t i = 0; i < writers; i++) {
+        file_create(session, "/bench/w" + std::to_string(i), data.data(), data.size());
+    }
+    
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> reads(0), writes(0), errors(0);
+    LatencyHistogram read_latency, write_latency;
+    std::vector<std::thread> threads;
+    
+    for (uint32_t i = 0; i < readers; i++) {
+        threads.emplace_back([&, i] {
+            std::string file = "/bench/r" + std::to_string(i);
+            for (uint64_t n = 0; !stop; n++) {
+                double start = now_seconds();
+                int result;
+                if (n % 2 == 0) {
+                    SharedBuffer content;
+                    result = file_read(session, file, &content);
+                } else {
+                    std::vector<FileEntry> entries;
+                    result = dir_list(session, "/bench", &entries);
+                }
+                read_latency.record(elapsed_us(start));
+                if (result != 0) errors++;
+                reads++;
+            }
+        });
+    }
+    for (uint32_t i = 0; i < writers; i++) {
+        threads.emplace_back([&, i] {
+            std::string file = "/bench/w" + std::to_string(i);
+            std::string scratch = "/bench/t" + std::to_string(i);
+            for (uint64_t n = 0; !stop; n++) {
+                double start = now_seconds();
+                int result;
+                if (n % 2 == 0) {
+                    result = file_edit(session, file, data.data(), data.size(), 0);
+                } else {
+                    result = file_create(session, scratch, data.data(), data.size());
+                    if (result == 0) result = file_delete(session, scratch);
+                }
+                write_latency.record(elapsed_us(start));
+                if (result != 0) errors++;
+                writes++;
+            }
+        });
+    }
+    
+    usleep((useconds_t)(seconds * 1e6));
+    stop = true;
+    for (auto& thread : threads) thread.join();
+    
+    user_logout(session);
+    storage.close();
+    g_storage = nullptr;
+    remove_work_dir({});
+    
+    LatencySummary r = read_latency.summary();
+    LatencySummary w = write_latency.summary();
+    printf("contention readers=%u writers=%u file_kb=%zu  reads %.0f/s p50 %lluus p99 %lluus"
+           "  writes %.0f/s p50 %lluus p99 %lluus  errors %llu\n",
+           readers, writers, file_size >> 10,
+           reads / seconds, (unsigned long long)r.p50_us, (unsigned long long)r.p99_us,
+           writes / seconds, (unsigned long long)w.p50_us, (unsigned long long)w.p99_us,
+           (unsigned long long)errors.load());
+    return errors > 0 ? 1 : 0;
+}
+
+// Nanoseconds per call of op, repeated for at least half a second.
+template <typename Op>
+static double ns_per_op(Op op) {
+    uint64_t calls = 0;
+    double start = now_seconds();
+    double elapsed;
+    do {
+        for (int i = 0; i < 1000; i++) op();
+        calls += 1000;
+        elapsed = now_seconds() - start;
+    } while (elapsed < 0.5);
+    return elapsed * 1e9 / calls;
+}
+
+// PathResolver calls and full lookups on a path depth directories deep,
+// each directory holding siblings other entries, so every level of the
+// lookup searches a populated directory.
+static int bench_paths(int argc, char* argv[]) {
+    uint32_t depth = argc > 2 ? std::max(1, atoi(argv[2])) : 8;
+    uint32_t siblings = argc > 3 ? atoi(argv[3]) : 32;
+    
+    std::string path = reset_work_dir();
+    OmniStorage storage;
+    if (!storage.create(path, 64 << 20)) {
+        std::cerr << "Error: cannot create container in " << WORK_DIR << "\n";
+        return 1;
+    }
+    g_storage = &storage;
+    set_storage_instance(&storage);
+    load_users();
+    
+    OFS_Session session = nullptr;
+    if (user_login(&session, "admin", "admin123") != 0) {
+        std::cerr << "Error: login failed\n";
+        return 1;
+    }
+    
+    std::string dir;
+    for (uint32_t level = 0; level < depth; level++) {
+        for (uint32_t i = 0; i < siblings; i++) {
+            file_create(session, dir + "/sibling_" + std::to_string(i), "x", 1);
+        }
+        dir += "/level_" + std::to_string(level);
+        if (dir_create(session, dir) != 0) {
+            std::cerr << "Error: cannot create " << dir << "\n";
+            return 1;
+        }
+    }
+    std::string file = dir + "/target.txt";
+    file_create(session, file, "x", 1);
+    std::string messy = "/" + file + "/./";
+    
+    volatile size_t sink = 0;
+    printf("paths depth=%u siblings=%u\n", depth, siblings);
+    printf("  validate_path     %7.1f ns/op\n", ns_per_op([&] { sink += PathResolver::validate_path(file); }));
+    printf("  get_parent        %7.1f ns/op\n", ns_per_op([&] { sink += PathResolver::get_parent(file).size(); }));
+    printf("  get_filename      %7.1f ns/op\n", ns_per_op([&] { sink += PathResolver::get_filename(file).size(); }));
+    printf("  split             %7.1f ns/op\n", ns_per_op([&] { sink += PathResolver::split(file).size(); }));
+    printf("  tokenize          %7.1f ns/op\n", ns_per_op([&] {
+        PathComponents parts;
+        PathResolver::tokenize(file, &parts);
+        sink += parts.size();
+    }));
+    printf("  normalize (messy) %7.1f ns/op\n", ns_per_op([&] { sink += PathResolver::normalize(messy).size(); }));
+    printf("  file_exists       %7.1f ns/op\n", ns_per_op([&] { sink += file_exists(session, file); }));
+    
+    int missing = file_exists(session, file);
+    user_logout(session);
+    storage.close();
+    g_storage = nullptr;
+    remove_work_dir({});
+    return missing != 0 ? 1 : 0;
+}
+
+static void print_usage() {
+    std::cout << "Usage: storage_bench <scenario> [args]\n\n";
+    std::cout << "Scenarios:\n";
+    std::cout << "  stripes <count> [file_mb] [readers] [stripe_dir...]\n";
+    std::cout << "                   Sequential chain read throughput over <count> stripe files\n";
+    std::cout << "  format [--preallocate] <size>...\n";
+    std::cout << "                   Time to format containers of each size (K, M, G suffixes)\n";
+    std::cout << "  contention <readers> <writers> [seconds] [file_kb]\n";
+    std::cout << "                   Reads and writes per second, and their latency, on disjoint files\n";
+    std::cout << "  paths [depth] [siblings]\n";
+    std::cout << "                   Nanoseconds per path parse and per lookup of a nested file\n";
+    std::cout << "\nScratch containers go in " << WORK_DIR << ".\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+    Logger::init(std::string(WORK_DIR) + ".log");
+    
+    std::string scenario = argv[1];
+    if (scenario == "stripes") return bench_stripes(argc, argv);
+    if (scenario == "format") return bench_format(argc, argv);
+    if (scenario == "contention") return bench_contention(argc, argv);
+    if (scenario == "paths") return bench_paths(argc, argv);
+    
+    std::cerr << "Error: Unknown scenario '" << scenario << "'\n";
+    print_usage();
+    return 1;
+}
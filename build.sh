@@ -34,6 +34,10 @@ echo ""
 # Compile core modules
 echo "[1/5] Compiling storage engine..."
 g++ -c -std=c++17 -O2 -Wall -I./include src/core/omni_storage.cpp -o compiled/omni_storage.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/core/block_cache.cpp -o compiled/block_cache.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/core/name_index.cpp -o compiled/name_index.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/core/content_index.cpp -o compiled/content_index.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/core/change_bus.cpp -o compiled/change_bus.o
 
 echo "[2/5] Compiling file operations..."
 g++ -c -std=c++17 -O2 -Wall -I./include src/core/file_ops.cpp -o compiled/file_ops.o
@@ -42,8 +46,11 @@ g++ -c -std=c++17 -O2 -Wall -I./include src/core/path_resolver.cpp -o compiled/p
 
 echo "[3/5] Compiling utilities..."
 g++ -c -std=c++17 -O2 -Wall -I./include src/utils/crypto.cpp -o compiled/crypto.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/utils/crc32c.cpp -o compiled/crc32c.o
 g++ -c -std=c++17 -O2 -Wall -I./include src/utils/logger.cpp -o compiled/logger.o
 g++ -c -std=c++17 -O2 -Wall -I./include src/utils/config_parser.cpp -o compiled/config_parser.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/utils/latency_histogram.cpp -o compiled/latency_histogram.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/utils/json_reader.cpp -o compiled/json_reader.o
 
 echo "[4/5] Compiling initialization..."
 if [ -f "src/core/fs_init.cpp" ]; then
@@ -60,44 +67,93 @@ else
     echo "    - fs_format.cpp not found (skipping)"
 fi
 
-if [ -f "src/network/fifo_queue.cpp" ]; then
-    g++ -c -std=c++17 -O2 -Wall -I./include src/network/fifo_queue.cpp -o compiled/fifo_queue.o
-    echo "    - fifo_queue.cpp compiled"
-else
-    echo "    - fifo_queue.cpp not found (skipping)"
-fi
+g++ -c -std=c++17 -O2 -Wall -I./include src/network/http_parser.cpp -o compiled/http_parser.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/network/executor.cpp -o compiled/executor.o
+g++ -c -std=c++17 -O2 -Wall -I./include src/network/reactor.cpp -o compiled/reactor.o
 
 echo "[5/5] Linking server..."
 g++ -std=c++17 -O2 -Wall -I./include \
     src/network/server_main.cpp \
     compiled/omni_storage.o \
+    compiled/block_cache.o \
+    compiled/name_index.o \
+    compiled/content_index.o \
+    compiled/change_bus.o \
     compiled/file_ops.o \
     compiled/user_manager.o \
     compiled/path_resolver.o \
     compiled/crypto.o \
+    compiled/crc32c.o \
     compiled/logger.o \
     compiled/config_parser.o \
+    compiled/latency_histogram.o \
+    compiled/json_reader.o \
+    compiled/http_parser.o \
+    compiled/executor.o \
+    compiled/reactor.o \
     $([ -f "compiled/fs_init.o" ] && echo "compiled/fs_init.o") \
     $([ -f "compiled/fs_format.o" ] && echo "compiled/fs_format.o") \
-    $([ -f "compiled/fifo_queue.o" ] && echo "compiled/fifo_queue.o") \
     -o compiled/server \
     -pthread \
     -lcrypto 2>/dev/null || \
 g++ -std=c++17 -O2 -Wall -I./include \
     src/network/server_main.cpp \
     compiled/omni_storage.o \
+    compiled/block_cache.o \
+    compiled/name_index.o \
+    compiled/content_index.o \
+    compiled/change_bus.o \
     compiled/file_ops.o \
     compiled/user_manager.o \
     compiled/path_resolver.o \
     compiled/crypto.o \
+    compiled/crc32c.o \
     compiled/logger.o \
     compiled/config_parser.o \
+    compiled/latency_histogram.o \
+    compiled/json_reader.o \
+    compiled/http_parser.o \
+    compiled/executor.o \
+    compiled/reactor.o \
     $([ -f "compiled/fs_init.o" ] && echo "compiled/fs_init.o") \
     $([ -f "compiled/fs_format.o" ] && echo "compiled/fs_format.o") \
-    $([ -f "compiled/fifo_queue.o" ] && echo "compiled/fifo_queue.o") \
     -o compiled/server \
     -pthread
 
+# Everything but server_main, for the tools that link the engine in-process
+LIB_OBJS="compiled/omni_storage.o compiled/block_cache.o compiled/name_index.o \
+    compiled/content_index.o compiled/change_bus.o compiled/file_ops.o \
+    compiled/user_manager.o compiled/path_resolver.o compiled/crypto.o \
+    compiled/crc32c.o compiled/logger.o compiled/config_parser.o \
+    compiled/latency_histogram.o compiled/json_reader.o compiled/http_parser.o \
+    compiled/executor.o compiled/reactor.o \
+    $([ -f "compiled/fs_init.o" ] && echo "compiled/fs_init.o") \
+    $([ -f "compiled/fs_format.o" ] && echo "compiled/fs_format.o")"
+
+echo "[*] Building benchmarks..."
+g++ -std=c++17 -O2 -Wall -I./include bench/storage_bench.cpp $LIB_OBJS \
+    -o compiled/storage_bench -pthread -lcrypto 2>/dev/null || \
+g++ -std=c++17 -O2 -Wall -I./include bench/storage_bench.cpp $LIB_OBJS \
+    -o compiled/storage_bench -pthread
+echo "    - compiled/storage_bench (see bench/README.md)"
+g++ -std=c++17 -O2 -Wall -I./include bench/http_bench.cpp \
+    compiled/json_reader.o compiled/latency_histogram.o \
+    -o compiled/http_bench -pthread
+echo "    - compiled/http_bench (see bench/README.md)"
+
+echo "[*] Running unit tests..."
+for test_src in tests/test_*.cpp; do
+    test_bin=compiled/$(basename "$test_src" .cpp)
+    g++ -std=c++17 -O2 -Wall -I./include -I./tests "$test_src" $LIB_OBJS \
+        -o "$test_bin" -pthread -lcrypto 2>/dev/null || \
+    g++ -std=c++17 -O2 -Wall -I./include -I./tests "$test_src" $LIB_OBJS \
+        -o "$test_bin" -pthread
+    if ! "$test_bin"; then
+        echo -e "${RED}[ERROR]${NC} $test_bin failed"
+        exit 1
+    fi
+done
+
 echo ""
 echo "====================================="
 echo "  Build Complete!                   "
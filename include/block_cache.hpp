@@ -0,0 +1,57 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include <cstdint>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Decoded, verified payload of one content block.
+struct CachedBlock {
+    uint32_t next_block;
+    std::vector<uint8_t> data;
+};
+
+// Thread-safe LRU cache of content blocks, shared by foreground reads and
+// the readahead thread.
+class BlockCache {
+public:
+    BlockCache();
+    
+    void set_capacity(size_t capacity_blocks);
+    size_t get_capacity();
+    
+    std::shared_ptr<const CachedBlock> get(uint32_t block_idx);
+    // Like get() but leaves the LRU order and hit counters alone.
+    std::shared_ptr<const CachedBlock> peek(uint32_t block_idx);
+    
+    // Inserts only if nothing was invalidated since `epoch` was sampled, so
+    // a read that raced with a write cannot publish stale data.
+    void put(uint32_t block_idx, std::shared_ptr<const CachedBlock> block, uint64_t epoch);
+    void invalidate(uint32_t block_idx);
+    void clear();
+    uint64_t get_epoch();
+    
+    uint64_t get_hits();
+    uint64_t get_misses();
+
+private:
+    struct Slot {
+        std::shared_ptr<const CachedBlock> block;
+        std::list<uint32_t>::iterator lru_pos;
+    };
+    
+    std::mutex cache_mutex;
+    size_t capacity;
+    uint64_t epoch;
+    uint64_t hits;
+    uint64_t misses;
+    std::list<uint32_t> lru;
+    std::unordered_map<uint32_t, Slot> slots;
+    
+    void evict_to(size_t limit);
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef CHANGE_BUS_HPP
+#define CHANGE_BUS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+enum class ChangeType : uint8_t {
+    CREATE = 0,
+    WRITE = 1,
+    DELETE = 2,
+    RENAME = 3,
+    ATTRIB = 4
+};
+
+struct ChangeEvent {
+    uint64_t seq;
+    ChangeType type;
+    uint8_t entry_type;
+    uint32_t entry;
+    std::string path;
+    std::string old_path;       // RENAME only
+    uint64_t size;
+    uint64_t modified_time;
+};
+
+// In-memory fan-out of namespace changes to watchers. A watch covers one
+// directory's children, or its whole subtree when recursive. Each watch
+// queues the events it has not yet collected, coalescing repeats for the
+// same path; a queue that outgrows its limit is dropped and reports an
+// overflow, after which the watcher should re-list. Thread-safe.
+class ChangeBus {
+public:
+    ChangeBus();
+    
+    uint64_t subscribe(const std::string& path, bool recursive);
+    bool unsubscribe(uint64_t watch_id);
+    
+    // Queues the event on every watch it concerns, first giving it the next
+    // sequence number unless it carries one from the change log. Returns the
+    // sequence number.
+    uint64_t publish(ChangeEvent event);
+    
+    // Waits up to timeout_ms for the watch to have events, gives a burst
+    // coalesce_ms more to settle, then takes everything queued. False if
+    // the watch does not exist.
+    bool wait(uint64_t watch_id, uint32_t timeout_ms, uint32_t coalesce_ms,
+              std::vector<ChangeEvent>* out_events, bool* out_overflow);
+    
+    // Drops watches nobody has waited on for idle_seconds.
+    void reap_idle(uint32_t idle_seconds);
+    
+    size_t watch_count();
+    uint64_t last_seq();
+    
+    static const size_t QUEUE_LIMIT = 1024;
+
+private:
+    struct Watch {
+        std::string path;
+        bool recursive;
+        std::vector<ChangeEvent> events;
+        std::unordered_map<std::string, size_t> latest;     // path -> events index
+        bool overflow;
+        bool closed;
+        uint64_t last_activity;
+        std::condition_variable cv;
+    };
+    
+    std::mutex bus_mutex;
+    std::map<uint64_t, std::shared_ptr<Watch>> watches;
+    uint64_t next_watch_id;
+    uint64_t next_seq;
+    
+    static bool concerns(const Watch& watch, const std::string& path);
+    static void enqueue(Watch& watch, const ChangeEvent& event);
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <cstdint>
 
 class ConfigParser {
@@ -21,6 +22,8 @@ public:
     static bool get_bool(const std::string& section, const std::string& key,
                         bool default_val = false);
     
+    static std::vector<std::string> get_list(const std::string& section, const std::string& key);
+    
     static void print_config();
     
     static bool validate();
@@ -0,0 +1,82 @@
+#ifndef CONTENT_INDEX_HPP
+#define CONTENT_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Identifies the indexed version of a file. Chains are never rewritten in
+// place, so a changed chain, size or mtime means changed content.
+struct ContentVersion {
+    uint32_t chain;
+    uint64_t size;
+    uint64_t modified_time;
+    
+    bool operator==(const ContentVersion& other) const {
+        return chain == other.chain && size == other.size && modified_time == other.modified_time;
+    }
+};
+
+struct ContentHit {
+    uint32_t entry_idx;
+    double score;
+};
+
+// Inverted index over file contents. Each term has one posting list of
+// records sorted by entry index:
+//   varint(entry delta) varint(tf) varint(n) n bytes of varint(position delta)
+// The byte length lets lookups and updates skip a record's positions, so
+// replacing one document only splices the lists of its own terms.
+// Thread-safe.
+class ContentIndex {
+public:
+    ContentIndex();
+    
+    void update(uint32_t entry_idx, const ContentVersion& version, const std::string& text);
+    void remove(uint32_t entry_idx);
+    bool indexed_version(uint32_t entry_idx, ContentVersion* out_version);
+    std::vector<uint32_t> documents();
+    void clear();
+    
+    // Words are ANDed and "quoted words" must appear as a phrase. Results are
+    // ranked by BM25, best first.
+    std::vector<ContentHit> search(const std::string& query, size_t limit);
+    
+    // Sidecar persistence. save() writes a temporary file and renames it over
+    // path; load() replaces the index and fails on a missing or corrupt file.
+    bool save(const std::string& path);
+    bool load(const std::string& path);
+    bool has_unsaved_changes();
+    
+    size_t document_count();
+    size_t term_count();
+    
+    // Lowercased runs of letters and digits; bytes >= 0x80 count as letters
+    // so UTF-8 words stay whole. Tokens over MAX_TERM_LENGTH are dropped.
+    static void tokenize(const std::string& text, std::vector<std::string>* tokens);
+    static const size_t MAX_TERM_LENGTH = 64;
+
+private:
+    struct Document {
+        ContentVersion version;
+        uint32_t length;
+        std::vector<uint32_t> terms;
+    };
+    
+    std::shared_mutex index_mutex;
+    std::unordered_map<std::string, uint32_t> term_ids;
+    std::vector<std::string> term_names;
+    std::vector<std::string> postings;
+    std::vector<uint32_t> doc_freq;
+    std::unordered_map<uint32_t, Document> docs;
+    uint64_t total_length;
+    bool dirty;
+    
+    uint32_t term_id(const std::string& term);
+    void remove_locked(uint32_t entry_idx);
+    static void splice(std::string* list, uint32_t entry_idx, const std::string* record);
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+class CRC32C {
+public:
+    // Castagnoli CRC. Pass a previous result as `crc` to continue it over
+    // another buffer.
+    static uint32_t compute(const void* data, size_t size, uint32_t crc = 0);
+    
+    static bool hardware_accelerated();
+
+private:
+    static uint32_t compute_sw(const uint8_t* data, size_t size, uint32_t crc);
+    static uint32_t compute_hw(const uint8_t* data, size_t size, uint32_t crc);
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include "latency_histogram.hpp"
+
+enum class TaskPriority {
+    HIGH,                           // cheap, interactive: sessions, stats
+    NORMAL,
+    LOW                             // bulk transfers and whole-tree scans
+};
+
+struct ExecutorConfig {
+    uint32_t threads;               // 0: two per core
+    uint32_t cores;                 // CPUs to run on; 0: all this process may use
+    bool pin;                       // bind each worker to one of those CPUs
+};
+
+struct ExecutorStats {
+    uint32_t threads;
+    uint64_t submitted;
+    uint64_t executed;
+    uint64_t steals;                // tasks run by a worker other than the one queued on
+    uint64_t queued;                // waiting now, all workers
+    uint64_t queued_by_priority[3];
+    std::vector<uint64_t> queued_by_worker;
+    LatencySummary wait;            // submission to start
+    LatencySummary run;             // start to finish
+};
+
+// Fixed-size work-stealing thread pool. Each worker owns a deque per
+// priority. Tasks submitted from outside the pool are spread over the
+// workers in turn; a task submitted by a worker goes on its own deque. A
+// worker takes the oldest task of the highest priority it has, and when it
+// has none steals one from another worker, trying them from a random
+// starting point so thieves do not pile onto the same victim.
+//
+// Priorities are strict per deque set: a worker runs its own lower
+// priority tasks before it steals higher priority ones.
+class Executor {
+public:
+    Executor();
+    
+    // Runs every task already queued, then stops the workers.
+    ~Executor();
+    
+    // Starts the workers. Calling it again has no effect.
+    void start(const ExecutorConfig& config);
+    
+    // Queues a task. Tasks must not throw.
+    void submit(std::function<void()> task, TaskPriority priority = TaskPriority::NORMAL);
+    
+    ExecutorStats get_stats();
+    
+    static const size_t PRIORITIES = 3;
+
+private:
+    struct Task {
+        std::function<void()> run;
+        std::chrono::steady_clock::time_point queued;
+    };
+    
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[PRIORITIES];
+        std::atomic<uint64_t> depth;
+        std::thread thread;
+        uint32_t rng;               // xorshift state for picking victims
+        int cpu;                    // pinned to, or -1
+    };
+    
+    ExecutorConfig config;
+    std::vector<Worker*> workers;
+    bool started;
+    std::atomic<bool> stopping;
+    
+    // Sleeping workers wait here until something is queued anywhere.
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<uint32_t> sleepers;
+    std::atomic<uint64_t> pending;
+    
+    std::atomic<uint64_t> next_worker;
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> steals;
+    std::atomic<uint64_t> queued_by_priority[PRIORITIES];
+    LatencyHistogram wait_latency;
+    LatencyHistogram run_latency;
+    
+    void worker_main(size_t index);
+    bool steal(size_t thief, Task* task);
+    bool take(Worker* worker, Task* task);
+    void execute(Task& task);
+    static std::vector<int> pick_cpus(uint32_t cores);
+};
+
+#endif
@@ -2,32 +2,177 @@
 #define FILE_OPS_HPP
 
 #include "ofs_types.hpp"
+#include "change_bus.hpp"
+#include "shared_buffer.hpp"
 #include <string>
+#include <vector>
+#include <functional>
 
 class OmniStorage;
+struct ChangeRecord;
+struct VersionRecord;
 typedef void* OFS_Instance;
 typedef void* OFS_Session;
 
+// Receives one chunk of file data (at most one block) per call, as a view
+// that may be kept past the call; return false to stop the transfer.
+typedef std::function<bool(const SharedBuffer& chunk)> ChunkCallback;
+
+enum class BatchOpType : uint8_t {
+    CREATE = 0,     // new file; fails if path exists
+    WRITE = 1,      // replaces a file's contents, creating it if needed
+    DELETE = 2,     // file or empty directory
+    MKDIR = 3,
+    RENAME = 4      // path -> new_path
+};
+
+struct BatchOp {
+    BatchOpType type;
+    std::string path;
+    std::string new_path;
+    std::string data;
+};
+
+enum class DirSortKey : uint8_t {
+    NAME = 0,
+    SIZE = 1,
+    MODIFIED = 2
+};
+
+struct DirListOptions {
+    uint32_t limit;             // entries per page
+    std::string cursor;         // next_cursor of the previous page, or ""
+    DirSortKey sort;
+    bool descending;
+    std::string name_filter;    // keeps names containing this, if set
+    int type_filter;            // -1 for any, else an EntryType value
+    
+    DirListOptions() : limit(100), sort(DirSortKey::NAME), descending(false), type_filter(-1) {}
+};
+
+struct DirPage {
+    std::vector<FileEntry> entries;
+    std::string next_cursor;    // empty on the last page
+};
+
+struct SearchHit {
+    std::string path;
+    FileEntry entry;
+    double score;               // content search relevance; 0 for name search
+};
+
 void set_storage_instance(OmniStorage* storage);
 
 int file_create(OFS_Session session, const std::string& path, const void* data, size_t size);
-int file_read(OFS_Session session, const std::string& path, void** out_buffer, size_t* out_size);
+
+// The whole file in one buffer. A file that fits in one block is a view of
+// the cached block; a longer one is gathered into a new buffer.
+int file_read(OFS_Session session, const std::string& path, SharedBuffer* out_buffer);
+
+// Streams a file block by block without buffering it. on_open is called once
+// with the file size before the first chunk, and only if the file can be read.
+// Both callbacks run with no lock held; a file rewritten or deleted during
+// the stream is sent as it was when the stream began.
+int file_read_stream(OFS_Session session, const std::string& path,
+                     const std::function<bool(uint64_t size)>& on_open, const ChunkCallback& on_chunk);
+
+// Multi-part upload for files too large to pass in one call. Data written
+// to an upload goes straight into newly allocated blocks; commit publishes
+// it at path in one step, replacing an existing file, and abort frees it.
+// Uploads left idle for UPLOAD_IDLE_TIMEOUT seconds are aborted. Only the
+// user who began an upload may write to, commit or abort it; anyone else
+// gets ERROR_PERMISSION_DENIED.
+int upload_begin(OFS_Session session, const std::string& path, uint64_t* out_upload_id);
+int upload_write(OFS_Session session, uint64_t upload_id, const void* data, size_t size);
+int upload_commit(OFS_Session session, uint64_t upload_id, uint64_t* out_size);
+int upload_abort(OFS_Session session, uint64_t upload_id);
+
+// Change notification. A watch on a directory reports changes to it and its
+// children, or its whole subtree when recursive. watch_poll blocks up to
+// timeout_ms for events; bursts are coalesced per path. out_overflow means
+// events were dropped and the caller should re-list. Watches not polled for
+// WATCH_IDLE_TIMEOUT seconds are closed.
+int watch_open(OFS_Session session, const std::string& path, bool recursive, uint64_t* out_watch_id);
+int watch_poll(uint64_t watch_id, uint32_t timeout_ms, std::vector<ChangeEvent>* out_events, bool* out_overflow);
+int watch_close(uint64_t watch_id);
+
+// Incremental sync from the container's change log: up to limit records
+// with seq > since, oldest first, each stating an entry's state after one
+// change. out_last_seq is the newest sequence number logged; a caller that
+// got fewer than limit records has caught up to it. ERROR_NOT_IMPLEMENTED
+// for containers created before the change log.
+int changes_since(OFS_Session session, uint64_t since, size_t limit,
+                  std::vector<ChangeRecord>* out_records, uint64_t* out_last_seq);
+
+// Replaces a file's content in one step, creating the file if it is missing.
 int file_edit(OFS_Session session, const std::string& path, const void* data, size_t size, uint64_t index);
 int file_delete(OFS_Session session, const std::string& path);
 int file_truncate(OFS_Session session, const std::string& path);
 int file_exists(OFS_Session session, const std::string& path);
+
+// Version history. Each edit, upload, truncate or batch write that replaces
+// a file's content keeps the old content as a version, oldest first, up to
+// the configured retention. Restoring writes the version back as the file's
+// current content, which is itself kept as a version. Both return
+// ERROR_NOT_IMPLEMENTED for containers created before version history.
+int file_versions(OFS_Session session, const std::string& path, std::vector<VersionRecord>* out_versions);
+int file_version_restore(OFS_Session session, const std::string& path, uint32_t version);
 int file_rename(OFS_Session session, const std::string& old_path, const std::string& new_path);
 
+// Runs ops in order under one namespace lock, with a single commit at the
+// end. results gets one error code per op and the first failure is
+// returned. With atomic set, a failure undoes every earlier op and the
+// ops after it are not run (they report ERROR_INVALID_OPERATION).
+int file_batch(OFS_Session session, const std::vector<BatchOp>& ops, bool atomic, std::vector<int>* results);
+
 int dir_create(OFS_Session session, const std::string& path);
-int dir_list(OFS_Session session, const std::string& path, FileEntry** out_entries, int* out_count);
+int dir_list(OFS_Session session, const std::string& path, std::vector<FileEntry>* out_entries);
+
+// One page of a directory in a stable (sort key, name) order. The cursor
+// names the last entry returned rather than a position, so entries added or
+// removed between pages shift nothing. Memory is bounded by the page size.
+int dir_list_page(OFS_Session session, const std::string& path, const DirListOptions& options, DirPage* out_page);
+
 int dir_delete(OFS_Session session, const std::string& path);
 int dir_exists(OFS_Session session, const std::string& path);
 
+// Subtree operations, each a single walk of the child index under one
+// namespace lock. dir_copy_tree also copies single files; copies share the
+// source's block chains rather than duplicating the data.
+int dir_delete_tree(OFS_Session session, const std::string& path, uint32_t* out_removed);
+int dir_copy_tree(OFS_Session session, const std::string& src_path, const std::string& dst_path, uint32_t* out_copied);
+int dir_usage(OFS_Session session, const std::string& path, TreeUsage* out_usage);
+
+// Finds entries under scope_path whose name contains pattern, or matches it
+// as a glob (* ? [...]), ignoring case. Paths are rebuilt from parent links.
+int file_search(OFS_Session session, const std::string& pattern, const std::string& scope_path,
+                uint32_t limit, std::vector<SearchHit>* out_hits);
+
+// Full-text search over file contents, best match first. Words are ANDed;
+// "quoted words" must appear together. The index trails writes slightly and
+// returns ERROR_NOT_IMPLEMENTED unless the content indexer is running.
+int content_search(OFS_Session session, const std::string& query, const std::string& scope_path,
+                   uint32_t limit, std::vector<SearchHit>* out_hits);
+
 int get_metadata(OFS_Session session, const std::string& path, FileMetadata* metadata);
 int set_permissions(OFS_Session session, const std::string& path, uint32_t permissions);
 int get_stats(OFS_Session session, FSStats* stats);
+int grow_storage(OFS_Session session, uint64_t new_total_size);
+
+// Durability barrier: returns once every completed write is on stable storage.
+int sync_storage(OFS_Session session);
+
+// Background verification of allocated blocks, batch_size blocks per pass
+// with interval_ms between passes.
+void start_scrubber(uint32_t interval_ms, uint32_t batch_size);
+void stop_scrubber();
+
+// Background content indexing of text files up to max_file_bytes, persisted
+// to a sidecar at index_path. On start the sidecar is loaded and reconciled
+// with the container; files changed since it was saved are re-indexed.
+void start_content_index(const std::string& index_path, uint64_t max_file_bytes);
+void stop_content_index();
 
-void free_buffer(void* buffer);
 const char* get_error_message(int error_code);
 
 #endif
\ No newline at end of file
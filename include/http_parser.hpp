@@ -0,0 +1,89 @@
+#ifndef HTTP_PARSER_HPP
+#define HTTP_PARSER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+
+struct HttpRequest {
+    std::string method;
+    std::string target;             // path and query, as sent
+    int version_minor;              // HTTP/1.x
+    std::vector<std::pair<std::string, std::string>> headers;   // names in lower case
+    
+    std::string body;               // decoded if it was sent chunked
+    // Content-Length bytes not yet read from the socket, for a request
+    // dispatched before its body was in. Its handler reads them itself.
+    uint64_t body_remaining;
+    
+    // Whether the connection serves another request after this one. Set
+    // from the request; a handler clears it when its response cannot be
+    // followed by another, e.g. an unterminated stream.
+    bool keep_alive;
+    
+    // Value of the named header (lower case), or "" if absent.
+    const std::string& header(const std::string& name) const;
+};
+
+// Incremental HTTP/1.x request parser. Bytes are fed as they arrive, in
+// pieces of any size; each is looked at once. Request line and headers are
+// parsed line by line, then the body is collected by Content-Length or
+// decoded from chunked transfer coding. Parsing stops at the end of the
+// request, so bytes of a pipelined request that follows are left unread.
+class HttpParser {
+public:
+    // max_body bounds a chunked body, which has to be decoded here.
+    explicit HttpParser(uint64_t max_body = 64 * 1024 * 1024);
+    
+    // Consumes from data up to the end of the current request. Returns the
+    // number of bytes consumed.
+    size_t feed(const char* data, size_t size);
+    
+    bool headers_done() const { return state > HEADERS && state != FAILED; }
+    bool done() const { return state == DONE; }
+    bool failed() const { return state == FAILED; }
+    
+    // The status to answer a failed request with: 400, 413, 431 or 501.
+    int error_status() const { return status; }
+    
+    // Content-Length body bytes still to come; 0 for chunked bodies.
+    uint64_t body_pending() const { return state == BODY ? length_left : 0; }
+    
+    HttpRequest& request() { return current; }
+    
+    // Starts on the next request, forgetting the current one.
+    void reset();
+    
+    static const size_t MAX_HEADER_BYTES = 65536;
+
+private:
+    enum State {
+        REQUEST_LINE,
+        HEADERS,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_END,
+        TRAILERS,
+        DONE,
+        FAILED
+    };
+    
+    State state;
+    int status;
+    uint64_t max_body;
+    uint64_t length_left;           // of the body or the current chunk
+    size_t header_bytes;
+    std::string line;
+    HttpRequest current;
+    
+    bool take_line(const char* data, size_t size, size_t* pos);
+    bool parse_request_line();
+    bool parse_header_line();
+    bool start_body();
+    bool parse_chunk_size();
+    void fail(int error);
+};
+
+#endif
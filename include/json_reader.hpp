@@ -0,0 +1,87 @@
+#ifndef JSON_READER_HPP
+#define JSON_READER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class JsonType {
+    MISSING,
+    NULL_VALUE,
+    BOOLEAN,
+    NUMBER,
+    STRING,
+    ARRAY,
+    OBJECT
+};
+
+// A value as a view of the text it was parsed from. A string's text is
+// what lies between its quotes, with escapes left in until decode().
+struct JsonValue {
+    JsonType type;
+    std::string_view text;
+    bool escaped;                   // a string containing backslash escapes
+    
+    JsonValue() : type(JsonType::MISSING), escaped(false) {}
+    
+    // The string with its escapes decoded; other values as written.
+    std::string decode() const;
+};
+
+// The members of a JSON object, found in one pass over its text. Values
+// are views into that text, which must outlive the object; strings are
+// decoded only when asked for. Nested objects and arrays are delimited
+// but not parsed until get_objects() is called on them.
+//
+// Objects with up to INLINE_FIELDS members are held inline, so parsing a
+// request body does not allocate.
+class JsonObject {
+public:
+    // Parses text, which should be one object. An empty text is an empty
+    // object. On malformed text the members before the error are kept and
+    // valid() is false.
+    explicit JsonObject(std::string_view text = std::string_view());
+    
+    bool valid() const { return ok; }
+    size_t size() const { return count; }
+    
+    // The first member named key, or a MISSING value.
+    JsonValue get(std::string_view key) const;
+    
+    // A string, or a number or literal as written; default_val if absent
+    // or null.
+    std::string get_string(std::string_view key, const std::string& default_val = "") const;
+    
+    // A non-negative integer given bare or as a string; default_val if
+    // absent or not one.
+    uint64_t get_uint(std::string_view key, uint64_t default_val = 0) const;
+    
+    bool get_bool(std::string_view key, bool default_val = false) const;
+    
+    // The objects in the array stored under key. Other elements are skipped.
+    std::vector<JsonObject> get_objects(std::string_view key) const;
+    
+    static const size_t INLINE_FIELDS = 16;
+    static const int MAX_DEPTH = 64;
+
+private:
+    struct Field {
+        std::string_view key;
+        bool key_escaped;
+        JsonValue value;
+    };
+    
+    Field inline_fields[INLINE_FIELDS];
+    std::vector<Field> overflow;
+    size_t count;
+    bool ok;
+    
+    const Field& field(size_t i) const {
+        return i < INLINE_FIELDS ? inline_fields[i] : overflow[i - INLINE_FIELDS];
+    }
+    void add(const Field& member);
+    bool parse(std::string_view text);
+};
+
+#endif
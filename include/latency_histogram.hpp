@@ -0,0 +1,35 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct LatencySummary {
+    uint64_t count;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+};
+
+// Lock-free latency histogram for microsecond samples. Log-linear buckets:
+// exact below 16us, then 16 per power of two, so a reported percentile is
+// within about 6% of the true one.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    
+    void record(uint64_t latency_us);
+    LatencySummary summary() const;
+    
+    static const size_t BUCKETS = 640;
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> max_us;
+    
+    static size_t bucket_of(uint64_t latency_us);
+    static uint64_t bucket_limit(size_t bucket);
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef NAME_INDEX_HPP
+#define NAME_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Case-insensitive trigram index over entry names. Each trigram maps to the
+// sorted list of entries whose name contains it; a query intersects the
+// lists for its own trigrams and checks the few survivors against the
+// real pattern. Thread-safe.
+class NameIndex {
+public:
+    void insert(uint32_t entry_idx, const std::string& name);
+    void erase(uint32_t entry_idx);
+    void clear();
+    
+    // Entries whose name contains `pattern`, or matches it as a glob if it
+    // has any of * ? [. At most `limit` results, in entry order.
+    std::vector<uint32_t> search(const std::string& pattern, size_t limit);
+    
+    size_t size();
+
+private:
+    std::shared_mutex index_mutex;
+    std::unordered_map<uint32_t, std::string> names;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+    
+    static std::vector<uint32_t> trigrams(const std::string& lowered);
+    static std::vector<std::string> literal_runs(const std::string& glob);
+    void erase_locked(uint32_t entry_idx);
+    std::vector<uint32_t> candidates(const std::vector<uint32_t>& grams);
+};
+
+#endif
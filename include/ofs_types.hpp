@@ -22,7 +22,8 @@ enum class OFSErrorCodes : int32_t {
     ERROR_NOT_IMPLEMENTED = -8,
     ERROR_INVALID_SESSION = -9,
     ERROR_DIRECTORY_NOT_EMPTY = -10,
-    ERROR_INVALID_OPERATION = -11
+    ERROR_INVALID_OPERATION = -11,
+    ERROR_QUOTA_EXCEEDED = -12
 };
 
 enum class EntryType : uint8_t {
@@ -60,13 +61,25 @@ struct OMNIHeader {
     
     uint32_t file_state_storage_offset;
     uint32_t change_log_offset;
-    
-    uint8_t reserved[328];
+
+    // Block area geometry. A zero bitmap_offset marks a container written
+    // before online growth existed; its geometry is derived on open.
+    // With stripe_count > 1 the blocks live in separate backing files and
+    // block_area_offset is unused.
+    uint64_t bitmap_offset;
+    uint64_t block_area_offset;
+    uint32_t total_blocks;
+    uint32_t stripe_count;
+    uint32_t feature_flags;
+
+    uint8_t reserved[300];
 
     OMNIHeader() = default;
     
     OMNIHeader(uint32_t version, uint64_t size, uint64_t header_sz, uint64_t block_sz)
-        : format_version(version), total_size(size), header_size(header_sz), block_size(block_sz) {
+        : format_version(version), total_size(size), header_size(header_sz), block_size(block_sz),
+          user_table_offset(0), max_users(0), file_state_storage_offset(0), change_log_offset(0),
+          bitmap_offset(0), block_area_offset(0), total_blocks(0), stripe_count(0), feature_flags(0) {
         std::memset(magic, 0, sizeof(magic));
         std::memset(student_id, 0, sizeof(student_id));
         std::memset(submission_date, 0, sizeof(submission_date));
@@ -82,12 +95,24 @@ struct UserInfo {
     uint64_t created_time;
     uint64_t last_login;
     uint8_t is_active;
-    uint8_t reserved[23];
+    uint8_t reserved[1];
+    
+    // Accounting, kept by OmniStorage in what used to be reserved bytes.
+    // user_id is what MetadataEntry::owner_id refers to. Usage is the number
+    // of entries owned and the logical size of the files among them; a zero
+    // quota means unlimited. Entry counts fit 16 bits since
+    // MAX_METADATA_ENTRIES does.
+    uint16_t user_id;
+    uint16_t file_count;
+    uint16_t file_quota;
+    uint64_t bytes_used;
+    uint64_t byte_quota;
 
     UserInfo() = default;
     
     UserInfo(const std::string& user, const std::string& hash, UserRole r, uint64_t created)
-        : role(r), created_time(created), last_login(0), is_active(1) {
+        : role(r), created_time(created), last_login(0), is_active(1), user_id(0),
+          file_count(0), file_quota(0), bytes_used(0), byte_quota(0) {
         std::strncpy(username, user.c_str(), sizeof(username) - 1);
         username[sizeof(username) - 1] = '\0';
         std::strncpy(password_hash, hash.c_str(), sizeof(password_hash) - 1);
@@ -160,6 +185,16 @@ struct SessionInfo {
     }
 };
 
+// Disk usage of a subtree. Files sharing a chain count its blocks once.
+struct TreeUsage {
+    uint64_t files;
+    uint64_t directories;
+    uint64_t bytes;
+    uint64_t blocks;
+
+    TreeUsage() : files(0), directories(0), bytes(0), blocks(0) {}
+};
+
 struct FSStats {
     uint64_t total_size;
     uint64_t used_space;
@@ -169,16 +204,22 @@ struct FSStats {
     uint32_t total_users;
     uint32_t active_sessions;
     double fragmentation;
-    uint8_t reserved[64];
+    uint64_t checksum_errors;
+    uint64_t blocks_verified;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t dirty_bytes;
+    uint64_t flushes;
+    uint64_t bytes_copied;      // read payload copied out of the block cache
+    uint64_t bytes_shared;      // read payload handed out as views
 
     FSStats() = default;
     
     FSStats(uint64_t total, uint64_t used, uint64_t free)
         : total_size(total), used_space(used), free_space(free),
           total_files(0), total_directories(0), total_users(0),
-          active_sessions(0), fragmentation(0.0) {
-        std::memset(reserved, 0, sizeof(reserved));
-    }
+          active_sessions(0), fragmentation(0.0), checksum_errors(0), blocks_verified(0),
+          cache_hits(0), cache_misses(0), dirty_bytes(0), flushes(0), bytes_copied(0), bytes_shared(0) {}
 };
 
 #endif
\ No newline at end of file
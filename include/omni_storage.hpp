@@ -2,15 +2,65 @@
 #define OMNI_STORAGE_HPP
 
 #include "ofs_types.hpp"
+#include "block_cache.hpp"
+#include "name_index.hpp"
+#include "shared_buffer.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
-#include <fstream>
 #include <map>
+#include <set>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
 
 #define BLOCK_SIZE 65536
 #define METADATA_ENTRY_SIZE 128
 #define MAX_METADATA_ENTRIES 8192
 
+// Block numbers are 32-bit; grow() stops here however large it is asked to go.
+#define MAX_BLOCKS 0xFFFFFFFEu
+
+// OMNIHeader::feature_flags
+#define FEATURE_CHECKSUMS 0x1
+#define FEATURE_USER_ACCOUNTING 0x2
+
+// block_bitmap states. BLOCK_RESERVED marks a block handed out by
+// allocate_block() whose first write is still pending; on disk it simply
+// reads as used. BLOCK_VERSIONED marks a block no chain holds any more that
+// file versions still list; it is persisted so open() can tell the two apart.
+#define BLOCK_FREE 0
+#define BLOCK_USED 1
+#define BLOCK_RESERVED 2
+#define BLOCK_VERSIONED 3
+
+// Granularity at which metadata and bitmap updates are staged for write-back.
+#define METADATA_PAGE_ENTRIES 32
+#define BITMAP_PAGE_SIZE 4096
+
+// The change log is kept twice, back to back after the metadata table;
+// OMNIHeader::change_log_offset names the live copy. Each copy holds
+// CHANGE_LOG_SIZE / sizeof(ChangeRecord) records.
+#define CHANGE_LOG_SIZE (2 * 1024 * 1024)
+#define CHANGE_LOG_PAGE_RECORDS 32
+
+// Retained file versions, one VersionRecord per slot, follow the change log;
+// OMNIHeader::file_state_storage_offset names the table.
+#define VERSION_TABLE_RECORDS 16384
+#define VERSION_PAGE_RECORDS 64
+
+// When staged writes reach stable storage.
+enum class DurabilityMode : uint8_t {
+    SYNC = 0,       // flushed and fsynced before each mutating call returns
+    PERIODIC = 1,   // flushed by the background flusher, then fsynced
+    RELAXED = 2     // flushed by the background flusher, fsync left to the kernel
+};
+
 struct MetadataEntry {
     uint8_t valid;
     uint8_t type;
@@ -22,28 +72,131 @@ struct MetadataEntry {
     uint32_t permissions;
     uint64_t created_time;
     uint64_t modified_time;
-    uint8_t reserved[32];
+    uint32_t checksum;
+    uint32_t generation;        // bumped each time the slot is reused
+    uint8_t reserved[24];
+};
+
+// One change to one entry, stating what the entry looked like afterwards
+// (for a delete, just before). op is a ChangeType. Replaying records in seq
+// order keyed by entry reproduces the namespace; checksum is a CRC32C over
+// the record with the field zeroed.
+struct ChangeRecord {
+    uint64_t seq;
+    uint64_t size;
+    uint64_t modified_time;
+    uint32_t entry;
+    uint32_t parent;
+    char name[32];
+    uint8_t op;
+    uint8_t type;
+    uint8_t reserved[10];
+    uint32_t checksum;
+};
+
+// One retained version of a file: the content it had until retired_time.
+// Its blocks are listed as VersionExtents in the chain at list_block rather
+// than linked, so a version can share any block with the file's later
+// content. (entry, generation) names the file; version counts up from 1 per
+// file. checksum is a CRC32C over the record with the field zeroed.
+struct VersionRecord {
+    uint64_t size;
+    uint64_t modified_time;
+    uint64_t retired_time;
+    uint32_t entry;
+    uint32_t generation;
+    uint32_t list_block;
+    uint32_t block_count;
+    uint32_t version;
+    uint32_t owner_id;
+    uint8_t valid;
+    uint8_t reserved[11];
+    uint32_t checksum;
 };
 
+// The first size payload bytes of block belong to the version.
+struct VersionExtent {
+    uint32_t block;
+    uint32_t size;
+};
+
+// checksum is a CRC32C over next_block, data_size and the stored (encoded)
+// payload, so the scrubber can verify a block without decoding it.
 struct BlockHeader {
     uint32_t next_block;
     uint32_t data_size;
-    uint8_t reserved[8];
+    uint32_t checksum;
+    uint8_t reserved[4];
 };
 
+// A chain being built by append_chain() from data that arrives in pieces.
+// The tail block is held back in `tail` until its successor is known, so as
+// in write_chain() every block is written once, with its final link.
+struct ChainBuilder {
+    uint32_t first_block = 0;
+    uint32_t tail_block = 0;
+    std::vector<uint8_t> tail;
+    std::vector<uint32_t> blocks;
+    uint64_t size = 0;
+};
+
+// Thread safety: the allocator, block cache, write-back pool, read streams
+// and user table are internally locked. Every write to metadata_cache goes
+// through meta_mutex, but namespace fields (valid, type, parent_index, name)
+// are read through get_entry()/list_children() unlocked, so callers must
+// exclude namespace changes while walking them. Data fields are read
+// consistently through snapshot_entry(). A chain that has been detached from
+// its entry may still be walked by readers; callers free it only once those
+// readers are gone.
 class OmniStorage {
 public:
     OmniStorage();
     ~OmniStorage();
     
-    bool create(const std::string& path, uint64_t total_size);
+    // Directories holding the stripe files of a striped container, one per
+    // stripe (reused round-robin if shorter). Empty means next to `path`.
+    void set_stripe_dirs(const std::vector<std::string>& dirs);
+    
+    bool create(const std::string& path, uint64_t total_size, uint32_t stripe_count = 1);
     bool open(const std::string& path);
     void close();
     
+    // After a failed create() or open(): another process has the container
+    // open.
+    bool in_use() const { return locked_out; }
+    
+    // Barrier: writes out everything staged so far and fsyncs the backing
+    // files, whatever the durability mode.
+    bool sync();
+    
+    // Extends the container in place. New blocks are usable as soon as this
+    // returns; the header write is the commit point.
+    bool grow(uint64_t new_total_size);
+    
     uint32_t allocate_entry(uint8_t type, uint32_t parent, const std::string& name, uint32_t owner_id);
     bool free_entry(uint32_t entry_idx);
+    
+    // Invalidates the entry and returns its chain without freeing it.
+    uint32_t detach_entry(uint32_t entry_idx);
+    
+    // Overwrites an entry with an earlier snapshot_entry() copy.
+    bool restore_entry(uint32_t entry_idx, const MetadataEntry& saved);
     MetadataEntry* get_entry(uint32_t entry_idx);
+    bool snapshot_entry(uint32_t entry_idx, MetadataEntry* out);
     std::vector<uint32_t> list_children(uint32_t parent_idx);
+    // The child of parent_idx called name, or 0xFFFFFFFF. Unlocked like
+    // list_children(), but copies nothing.
+    uint32_t find_child(uint32_t parent_idx, std::string_view name);
+    
+    // Entries whose name contains pattern (or matches it as a glob), case
+    // insensitively, through a trigram index kept in step with metadata.
+    std::vector<uint32_t> search_names(const std::string& pattern, size_t limit);
+    
+    // Lets another entry reference the chain starting at start_block.
+    // Chains are never modified in place, so entries can share one until
+    // the last of them frees it; free_block_chain() only drops a reference
+    // while others remain. Returns start_block.
+    uint32_t share_chain(uint32_t start_block);
     
     uint32_t allocate_block();
     void free_block(uint32_t block_idx);
@@ -51,45 +204,354 @@ public:
     bool write_block(uint32_t block_idx, const void* data, size_t size, uint32_t next_block);
     size_t read_block(uint32_t block_idx, void* buffer, size_t buffer_size, uint32_t* next_block);
     
+    // Checksums are always written on containers with FEATURE_CHECKSUMS;
+    // verify_reads only controls whether read_block checks them.
+    void set_verify_reads(bool enabled);
+    bool verify_block(uint32_t block_idx);
+    bool is_block_used(uint32_t block_idx);
+    uint64_t get_checksum_errors();
+    uint64_t get_blocks_verified();
+    
+    // Sequential chain walks prefetch window_blocks ahead into a block cache
+    // of cache_blocks entries on a background thread. Applies from the next
+    // open(); zero disables either.
+    void set_readahead(uint32_t window_blocks, uint32_t cache_blocks);
+    uint64_t get_cache_hits();
+    uint64_t get_cache_misses();
+    
+    // Payload bytes read_block() copied out of the cache into caller
+    // buffers, and bytes handed out as views by read_block_view().
+    uint64_t get_bytes_copied();
+    uint64_t get_bytes_shared();
+    
+    // Block, metadata and bitmap writes are staged in a write-back pool and
+    // written out by a flusher thread once the oldest staged write is
+    // interval_ms old or limit bytes are pending. Applies from the next open().
+    void set_write_back(DurabilityMode mode, uint32_t interval_ms, uint64_t limit);
+    uint64_t get_dirty_bytes();
+    uint64_t get_flush_count();
+    
+    // Between begin_group() and end_group() the calling thread's mutating
+    // calls skip their own commit; end_group() commits once for all of them.
+    // Groups nest.
+    void begin_group();
+    bool end_group();
+    
+    // Containers are sparse unless preallocate is set, in which case create()
+    // and grow() reserve the block area with fallocate. punch_holes returns
+    // freed blocks to the host filesystem once the free has been flushed.
+    void set_space_policy(bool preallocate, bool punch_holes);
+    
+    // Persistent change feed. log_change() assigns the record the next
+    // sequence number, stages it with the metadata and returns the number,
+    // or 0 if the container predates the change log. When the live copy is
+    // full it is compacted into the other copy, keeping only the latest
+    // record per entry, and the header switched over. read_changes() returns
+    // up to limit records with seq > since, oldest first.
+    bool has_change_log();
+    uint64_t log_change(ChangeRecord record);
+    std::vector<ChangeRecord> read_changes(uint64_t since, size_t limit, uint64_t* out_last_seq);
+    
+    // Version history. retire_chain() takes what entry_idx held before a
+    // write or delete. If the file still exists, the old content is kept as
+    // a version that lists, block by block, either the old block or the new
+    // content's block where that starts with the same bytes, so versions
+    // share unchanged blocks and cost about what changed; earlier versions
+    // are moved onto the new blocks the same way. The old chain is
+    // then freed, less any block a version lists. A deleted file's versions
+    // go with it. The entry's current chain must stay allocated meanwhile.
+    // Past keep versions per file, or past max_age seconds (0 for no limit),
+    // the oldest are dropped; so is the oldest overall when the table is full.
+    bool has_versions();
+    void set_version_retention(uint32_t keep, uint64_t max_age);
+    void retire_chain(uint32_t entry_idx, const MetadataEntry& before);
+    std::vector<VersionRecord> list_versions(uint32_t entry_idx);
+    bool get_version(uint32_t entry_idx, uint32_t version, VersionRecord* out);
+    
+    // Streams a version's content block by block as views. Its blocks are
+    // referenced for the duration, so it may outlive the version.
+    uint64_t stream_version(const VersionRecord& record,
+                            const std::function<bool(const SharedBuffer&)>& sink);
+    
+    // Applies fn to the entry under the metadata lock and stages it.
+    bool update_entry(uint32_t entry_idx, const std::function<void(MetadataEntry&)>& fn);
+    
     bool write_file_data(uint32_t entry_idx, const void* data, size_t size);
+    
+    // write_file_data() in two steps, so the chain can be written without
+    // holding any namespace lock: write_chain() returns the first block (0
+    // for no data, 0xFFFFFFFF on failure) and attach_chain() publishes it,
+    // returning the chain it replaced for the caller to free.
+    uint32_t write_chain(const void* data, size_t size);
+    uint32_t attach_chain(uint32_t entry_idx, uint32_t first_block, uint64_t size);
+    
+    // Called with an entry index after attach_chain(), detach_entry() or
+    // restore_entry() changes what that entry's data is. Runs on the
+    // writer's thread, so it must only record the index and return.
+    void set_content_listener(const std::function<void(uint32_t)>& listener);
+    
+    // write_chain() for data of unknown length. finish_chain() writes the
+    // tail and returns the first block like write_chain(); abandon_chain()
+    // frees everything allocated so far. After a failed append the builder
+    // must be abandoned.
+    bool append_chain(ChainBuilder& chain, const void* data, size_t size);
+    uint32_t finish_chain(ChainBuilder& chain);
+    void abandon_chain(ChainBuilder& chain);
+    
     size_t read_file_data(uint32_t entry_idx, void* buffer, size_t buffer_size);
+    size_t read_chain(uint32_t entry_idx, uint32_t start_block, void* buffer, size_t buffer_size);
+    
+    // A block's payload as a view of its cached copy, loaded and cached on a
+    // miss, rather than copied into a caller buffer. The view stays valid
+    // after the block is evicted, freed or rewritten.
+    bool read_block_view(uint32_t block_idx, SharedBuffer* out, uint32_t* next_block);
+    
+    // Appends views of up to max_blocks of a chain's blocks to out, starting
+    // at *block, and leaves *block at the next block to read. size is what
+    // remains of the content; a block past it is cut short and ends the
+    // read. A chain can be read in batches this way without holding a lock
+    // between them. Returns the number of bytes appended, which is short
+    // only at the end of the content or on a read error.
+    uint64_t read_chain_views(uint32_t entry_idx, uint32_t start_block, uint32_t* block, uint64_t size,
+                              uint32_t max_blocks, std::vector<SharedBuffer>* out);
     
     void init_encryption_table();
     void encode_data(void* data, size_t size);
     void decode_data(void* data, size_t size);
     
+    // add_user() gives a new user the next user id. Neither it nor
+    // update_user() touches the accounting fields of an existing user; those
+    // change only through set_user_quota() and entry updates.
     bool add_user(const UserInfo& user);
     bool get_user(const std::string& username, UserInfo* user);
     bool update_user(const UserInfo& user);
     std::vector<UserInfo> list_users();
+    bool get_user_by_id(uint32_t user_id, UserInfo* user);
+    bool set_user_quota(const std::string& username, uint64_t byte_quota, uint32_t file_quota);
     
+    // Usage is charged to an entry's owner by every call that creates,
+    // resizes, frees or restores an entry, so checking a quota is a lookup.
+    // True if owner_id may take files more entries and bytes more bytes.
+    bool within_quota(uint32_t owner_id, uint32_t files, uint64_t bytes);
+    
+    uint64_t get_total_size();
     uint64_t get_free_space();
     uint32_t get_total_blocks();
     uint32_t get_used_blocks();
+    uint32_t get_stripe_count();
     
 private:
     std::string file_path;
-    std::fstream file;
+    int fd;
+    bool locked_out;
+    std::vector<std::string> stripe_dirs;
+    std::vector<int> stripe_fds;
     
     OMNIHeader header;
     std::vector<MetadataEntry> metadata_cache;
     std::vector<uint8_t> block_bitmap;
+    // block_bitmap.size(), for range checks made without alloc_mutex. grow()
+    // replaces the bitmap under that lock, so only the count may be read
+    // outside it; it rises after the new bitmap is in place.
+    std::atomic<uint32_t> block_count;
     std::map<std::string, UserInfo> user_cache;
+    std::map<uint32_t, std::string> user_names;     // user_id -> username
+    uint32_t next_user_id;
     uint8_t encryption_table[256];
     uint8_t decryption_table[256];
     
+    bool verify_reads;
+    std::atomic<uint64_t> checksum_errors;
+    std::atomic<uint64_t> blocks_verified;
+    std::atomic<uint64_t> bytes_copied;
+    std::atomic<uint64_t> bytes_shared;
+    
+    struct ReadStream {
+        uint32_t expected_block;
+        uint32_t prefetched_ahead;
+    };
+    
+    struct PrefetchRequest {
+        uint32_t start_block;
+        uint32_t count;
+        uint32_t block_limit;
+    };
+    
+    BlockCache block_cache;
+    uint32_t readahead_window;
+    uint32_t cache_capacity;
+    std::map<uint32_t, ReadStream> read_streams;
+    std::thread prefetch_thread;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cv;
+    std::deque<PrefetchRequest> prefetch_queue;
+    bool prefetch_running;
+    
+    // Payload reads of a striped chain that fall in one backing file.
+    struct StripeExtent {
+        uint32_t block;
+        BlockHeader hdr;
+        size_t dest;                // offset in the caller's buffer
+        size_t size;
+    };
+    
+    // A striped chain read in progress. The caller waits on done_cv until
+    // every stripe reader it queued extents for has finished with them.
+    struct StripeRead {
+        uint8_t* buffer;
+        size_t outstanding;
+        bool failed;
+        std::mutex mutex;
+        std::condition_variable done_cv;
+    };
+    
+    struct StripeJob {
+        StripeRead* read;
+        const std::vector<StripeExtent>* extents;
+    };
+    
+    // One thread per stripe after the first, started by open() and shared
+    // by all chain reads; the calling thread reads stripe 0 itself.
+    // stripe_readers[i - 1] serves stripe i.
+    struct StripeReader {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<StripeJob> jobs;
+        bool running;
+    };
+    std::vector<std::unique_ptr<StripeReader>> stripe_readers;
+    
+    // Staged writes keyed by (fd, offset). flushing_pages holds the batch the
+    // flusher is writing out, so reads still see it until it is on disk.
+    typedef std::map<std::pair<int, uint64_t>, std::vector<uint8_t>> PageMap;
+    
+    DurabilityMode durability;
+    uint32_t flush_interval_ms;
+    uint64_t dirty_limit;
+    PageMap dirty_pages;
+    PageMap flushing_pages;
+    uint64_t dirty_bytes;
+    std::chrono::steady_clock::time_point oldest_dirty;
+    std::atomic<uint64_t> flush_count;
+    std::mutex wb_mutex;
+    std::mutex flush_mutex;
+    std::condition_variable wb_cv;
+    std::thread flusher_thread;
+    bool flusher_running;
+    bool flush_requested;
+    
+    bool preallocate;
+    std::atomic<bool> punch_holes;
+    std::set<uint32_t> punch_pending;
+    
+    // Children of each entry, in index order, kept in step with
+    // metadata_cache under meta_mutex and read like the namespace fields.
+    std::vector<std::set<uint32_t>> child_index;
+    NameIndex name_index;
+    
+    // First block -> references beyond the first, under alloc_mutex. Derived
+    // from the metadata on open, so it needs no on-disk form.
+    std::map<uint32_t, uint32_t> shared_chains;
+    
+    // Version table slots, and each file's slots oldest first, under
+    // version_mutex. version_refs counts the extents listing each block,
+    // under alloc_mutex; both are rebuilt on open.
+    std::vector<VersionRecord> version_table;
+    std::map<uint32_t, std::vector<uint32_t>> entry_versions;
+    std::unordered_map<uint32_t, uint32_t> version_refs;
+    uint32_t version_keep;
+    uint64_t version_max_age;
+    uint64_t last_version_sweep;
+    std::mutex version_mutex;
+    
+    // Records of the live change log copy in slot order, under log_mutex.
+    std::vector<ChangeRecord> change_log;
+    uint64_t next_change_seq;
+    std::mutex log_mutex;
+    
+    std::mutex meta_mutex;
+    std::mutex alloc_mutex;
+    std::mutex stream_mutex;
+    std::mutex user_mutex;
+    std::mutex listener_mutex;
+    std::function<void(uint32_t)> content_listener;
+    
+    static bool read_at(int target, uint64_t offset, void* buffer, size_t size);
+    static bool write_at(int target, uint64_t offset, const void* buffer, size_t size);
+    
+    bool lock_container();
+    std::string get_stripe_path(uint32_t stripe);
+    bool open_stripes(bool truncate);
+    void close_stripes();
+    size_t read_striped_chain(uint32_t start_block, uint8_t* buffer, size_t buffer_size);
+    bool read_stripe_extents(const std::vector<StripeExtent>& extents, uint8_t* buffer);
+    void start_stripe_readers();
+    void stop_stripe_readers();
+    void stripe_reader_loop(StripeReader* reader);
+    
+    std::shared_ptr<const CachedBlock> load_block(uint32_t block_idx, bool report_errors);
+    void note_sequential_read(uint32_t entry_idx, uint32_t start_block, uint32_t block_idx, uint32_t next_block);
+    void start_prefetcher();
+    void stop_prefetcher();
+    void prefetch_loop();
+    
+    bool stage_write(int target, uint64_t offset, const void* data, size_t size);
+    void discard_staged(int target, uint64_t offset);
+    bool read_block_bytes(uint32_t block_idx, uint64_t offset, void* buffer, size_t size);
+    void stage_entry(uint32_t entry_idx);
+    void stage_bitmap(uint32_t block_idx);
+    bool commit();
+    bool flush_pending(bool durable);
+    bool write_pending(bool durable);
+    bool sync_files();
+    void throttle();
+    bool size_files();
+    void punch_blocks(std::vector<uint32_t>& blocks);
+    void start_flusher();
+    void stop_flusher();
+    void flusher_loop();
+    
     bool load_header();
     bool save_header();
     bool load_metadata();
     bool save_metadata();
     bool load_users();
     bool save_users();
+    void rebuild_usage();
+    void account_change(const MetadataEntry& before, const MetadataEntry& after);
     bool load_bitmap();
     bool save_bitmap();
+    bool load_change_log();
+    bool load_versions();
+    bool read_extents(const VersionRecord& record, std::vector<VersionExtent>* out);
+    void reference_extents(const std::vector<VersionExtent>& extents);
+    void release_extents(const std::vector<VersionExtent>& extents);
+    void move_extents(uint32_t entry_idx, const std::unordered_map<uint32_t, uint32_t>& moved);
+    void drop_version(uint32_t slot);
+    void drop_expired_versions(uint32_t entry_idx);
+    void stage_version_page(uint32_t slot);
+    bool compact_change_log();
+    void stage_change_page(size_t slot);
+    
+    void derive_legacy_geometry();
+    void rebuild_namespace_index();
+    void index_entry(uint32_t entry_idx);
+    void unindex_entry(uint32_t entry_idx);
+    void notify_content(uint32_t entry_idx);
+    
+    bool has_checksums();
+    uint32_t block_checksum(const BlockHeader& hdr, const void* payload);
+    uint32_t entry_checksum(const MetadataEntry& entry);
+    uint32_t record_checksum(const ChangeRecord& record);
+    uint32_t version_checksum(const VersionRecord& record);
+    void report_checksum_error(const std::string& what);
     
     uint64_t get_metadata_offset();
     uint64_t get_bitmap_offset();
     uint64_t get_user_table_offset();
+    uint64_t get_change_log_base();
+    int get_block_fd(uint32_t block_idx);
     uint64_t get_block_offset(uint32_t block_idx);
 };
 
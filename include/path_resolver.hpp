@@ -2,35 +2,77 @@
 #define PATH_RESOLVER_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include "ofs_types.hpp"
 
+// The components of a path as views into it. Paths up to INLINE_COMPONENTS
+// deep are held inline, so tokenizing them does not allocate.
+class PathComponents {
+public:
+    PathComponents() : count(0) {}
+    
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    
+    std::string_view operator[](size_t i) const {
+        return i < INLINE_COMPONENTS ? inline_parts[i] : overflow[i - INLINE_COMPONENTS];
+    }
+    
+    void push_back(std::string_view part) {
+        if (count < INLINE_COMPONENTS) inline_parts[count] = part;
+        else overflow.push_back(part);
+        count++;
+    }
+    
+    void clear() {
+        overflow.clear();
+        count = 0;
+    }
+    
+    static const size_t INLINE_COMPONENTS = 16;
+
+private:
+    std::string_view inline_parts[INLINE_COMPONENTS];
+    std::vector<std::string_view> overflow;
+    size_t count;
+};
+
+// Path parsing works on views of the caller's string. Paths in canonical
+// form ("/" or "/a/b": no empty, "." or trailing components) are split in
+// place; anything else is normalized first.
 class PathResolver {
 public:
-    static int validate_path(const std::string& path);
+    static int validate_path(std::string_view path);
+    
+    static std::string normalize(std::string_view path);
+    
+    // Components of path, skipping empty and "." ones. The views point into
+    // path, which must outlive them.
+    static void tokenize(std::string_view path, PathComponents* out);
     
-    static std::string normalize(const std::string& path);
+    static std::vector<std::string> split(std::string_view path);
     
-    static std::vector<std::string> split(const std::string& path);
+    static std::string get_parent(std::string_view path);
     
-    static std::string get_parent(const std::string& path);
+    static std::string get_filename(std::string_view path);
     
-    static std::string get_filename(const std::string& path);
+    static std::string get_directory(std::string_view path);
     
-    static std::string get_directory(const std::string& path);
+    static bool is_root(std::string_view path);
     
-    static bool is_root(const std::string& path);
+    static bool is_canonical(std::string_view path);
     
-    static bool is_valid_filename(const std::string& filename);
+    static bool is_valid_filename(std::string_view filename);
     
-    static std::string combine(const std::string& dir, const std::string& file);
+    static std::string combine(std::string_view dir, std::string_view file);
 
 private:
     static const int MAX_PATH_LENGTH = 512;
     static const int MAX_FILENAME_LENGTH = 256;
     
-    static bool contains_null_bytes(const std::string& path);
-    static bool contains_path_traversal(const std::string& path);
+    static bool contains_null_bytes(std::string_view path);
+    static bool contains_path_traversal(std::string_view path);
 };
 
 #endif
@@ -0,0 +1,151 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include "http_parser.hpp"
+#include "executor.hpp"
+#include "latency_histogram.hpp"
+
+struct ReactorConfig {
+    uint16_t port;
+    uint32_t loop_threads;          // 0: one per core
+    uint32_t backlog;
+    uint32_t max_connections;
+    uint32_t idle_timeout_ms;       // 0: 60 s
+    uint64_t max_body;              // largest body collected for a handler
+    uint32_t max_long_lived;        // LONG_LIVED requests at once; 0: 256
+};
+
+struct ReactorStats {
+    uint64_t requests;
+    uint64_t requests_per_sec;      // over the last RATE_WINDOW seconds
+    uint64_t latency_p50_us;
+    uint64_t latency_p99_us;
+    uint64_t latency_max_us;
+    uint64_t connections;
+    uint64_t accepted;
+    uint64_t rejected;              // accepted past max_connections and closed
+    uint64_t timeouts;              // closed for idling
+    uint64_t long_lived;            // LONG_LIVED requests being handled
+    uint64_t long_lived_rejected;   // turned away past max_long_lived
+};
+
+enum class RequestKind {
+    NORMAL,
+    // Handed to its handler as soon as the headers are in, with the body
+    // left on the socket for it to read (HttpRequest::body_remaining).
+    STREAMED,
+    // May block for a long time waiting on events rather than I/O (long
+    // polls, event streams). Gets a thread of its own instead of holding an
+    // executor worker; past max_long_lived at once, a 503 instead.
+    LONG_LIVED
+};
+
+struct RequestClass {
+    RequestKind kind;
+    TaskPriority priority;          // on the executor; unused for LONG_LIVED
+};
+
+// Edge-triggered epoll HTTP/1.1 server. Loop threads share one listening
+// socket and own the connections they accept: they parse requests
+// incrementally from per-connection buffers without blocking and write
+// responses back out as the socket drains. Complete requests are handed to
+// an Executor, so storage work never stalls a loop.
+//
+// Connections persist unless the client or the handler asks otherwise.
+// Pipelined requests are served one after another, in order; one that has
+// sat idle for idle_timeout_ms is closed.
+//
+// While a handler has a request it may also use the socket directly, for
+// responses it streams or bodies it reads itself. Sockets are
+// non-blocking, so such handlers wait with wait_ready() on EAGAIN.
+class Reactor {
+public:
+    // Handles one request on an executor worker. Returns the response to
+    // send, or an empty string if the handler has written it to fd itself.
+    using Handler = std::function<std::string(HttpRequest& request, int fd)>;
+    
+    // Called once a request's headers are in; its body may not be.
+    using Classifier = std::function<RequestClass(const HttpRequest& request)>;
+    
+    explicit Reactor(Executor* executor);
+    
+    // Binds and listens. False if the port cannot be bound.
+    bool listen_on(const ReactorConfig& config);
+    
+    // Serves connections until stop() is called. Requests already handed
+    // to the executor may still be running when it returns.
+    void run(Handler handler, Classifier classify);
+    
+    // Makes run() return once every loop has seen it. Safe to call from a
+    // signal handler.
+    void stop();
+    
+    ReactorStats get_stats();
+    
+    // Waits up to IO_TIMEOUT_MS for fd to be ready for events (POLLIN or
+    // POLLOUT). False on timeout or error.
+    static bool wait_ready(int fd, short events);
+    
+    static const int IO_TIMEOUT_MS = 30000;
+    static const uint32_t RATE_WINDOW = 4;
+
+private:
+    struct Connection;
+    struct Completion;
+    struct Loop;
+    
+    ReactorConfig config;
+    int listen_fd;
+    Handler handler;
+    Classifier classify;
+    Executor* executor;
+    std::vector<Loop*> loops;
+    std::atomic<bool> loops_started;    // loops is complete and may be read
+    std::atomic<bool> stopping;
+    
+    static const uint32_t RATE_SLOTS = 8;
+    
+    struct RateSlot {
+        std::atomic<uint64_t> second;
+        std::atomic<uint64_t> count;
+    };
+    
+    std::atomic<uint64_t> connections;
+    std::atomic<uint64_t> accepted;
+    std::atomic<uint64_t> rejected;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> long_lived;
+    std::atomic<uint64_t> long_lived_rejected;
+    std::atomic<uint64_t> requests;
+    LatencyHistogram latency;
+    RateSlot rate_slots[RATE_SLOTS];
+    
+    void loop_main(Loop* loop);
+    void accept_ready(Loop* loop);
+    void read_ready(Connection* conn);
+    void parse_input(Connection* conn);
+    void reply_error(Connection* conn, int status);
+    void write_ready(Connection* conn);
+    void flush(Connection* conn);
+    void response_done(Connection* conn);
+    void dispatch(Connection* conn);
+    void complete(Connection* conn, std::string response, bool keep_alive);
+    void finish_completed(Loop* loop);
+    void close_connection(Connection* conn);
+    
+    void touch(Connection* conn);
+    void untrack(Connection* conn);
+    void expire_idle(Loop* loop);
+    
+    void record_request(uint64_t latency_us);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SHARED_BUFFER_HPP
+#define SHARED_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// An immutable view of bytes that keeps their storage alive. Copies and
+// slices share the storage rather than the bytes, so a cached block can be
+// handed from the block cache through file_ops to the socket writer without
+// being copied; the storage is released with the last view of it.
+class SharedBuffer {
+public:
+    SharedBuffer() : bytes(nullptr), length(0) {}
+    
+    // owner is whatever holds the bytes, e.g. a shared_ptr<const CachedBlock>.
+    SharedBuffer(std::shared_ptr<const void> owner, const uint8_t* data, size_t size)
+        : owner(std::move(owner)), bytes(data), length(size) {}
+    
+    static SharedBuffer wrap(std::vector<uint8_t>&& data) {
+        auto owned = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+        return SharedBuffer(owned, owned->data(), owned->size());
+    }
+    
+    static SharedBuffer wrap(std::string&& data) {
+        auto owned = std::make_shared<const std::string>(std::move(data));
+        return SharedBuffer(owned, (const uint8_t*)owned->data(), owned->size());
+    }
+    
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    
+    // Clamped to the view, so an out of range slice is empty.
+    SharedBuffer slice(size_t offset, size_t size) const {
+        if (offset > length) offset = length;
+        if (size > length - offset) size = length - offset;
+        return SharedBuffer(owner, bytes + offset, size);
+    }
+
+private:
+    std::shared_ptr<const void> owner;
+    const uint8_t* bytes;
+    size_t length;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <vector>
 #include <cstdint>
 
 typedef void* OFS_Session;
@@ -23,6 +24,14 @@ int user_delete(OFS_Session admin_session, const std::string& username);
 
 int user_list(OFS_Session admin_session, UserInfo** out_users, int* out_count);
 
+// Usage and quotas of username, or of every user when it is empty. Users
+// may see their own; anything else needs an admin session.
+int user_usage(OFS_Session session, const std::string& username, std::vector<UserInfo>* out_users);
+
+// Sets username's quotas; 0 means unlimited. Admin only.
+int user_set_quota(OFS_Session admin_session, const std::string& username,
+                   uint64_t byte_quota, uint32_t file_quota);
+
 int get_session_info(OFS_Session session, SessionInfo* info);
 
 int verify_session(OFS_Session session, std::string& out_username, UserRole& out_role);
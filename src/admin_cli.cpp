@@ -7,6 +7,7 @@
 #include "user_manager.hpp"
 #include "crypto.hpp"
 #include "logger.hpp"
+#include "config_parser.hpp"
 
 OmniStorage* g_storage = nullptr;
 
@@ -24,12 +25,18 @@ void print_usage() {
     std::cout << "  disable <username>               Disable user account\n";
     std::cout << "  change-pwd <username> <password> Change user password\n";
     std::cout << "  info <username>                  Show user information\n";
+    std::cout << "  usage [username]                 Show storage used by one or all users\n";
+    std::cout << "  quota <username> <bytes> [files] Set user quotas (K/M/G suffix, 0 = unlimited)\n";
     std::cout << "  reset-admin                      Reset admin password to admin123\n";
+    std::cout << "  grow <size>                      Grow container to <size> bytes (K/M/G suffix)\n";
+    std::cout << "  scrub                            Verify checksums of all allocated blocks\n";
     std::cout << "\nExamples:\n";
     std::cout << "  ./compiled/admin_cli create alice password123\n";
     std::cout << "  ./compiled/admin_cli create bob securepass --admin\n";
     std::cout << "  ./compiled/admin_cli list\n";
     std::cout << "  ./compiled/admin_cli delete alice\n";
+    std::cout << "  ./compiled/admin_cli grow 1G\n";
+    std::cout << "  ./compiled/admin_cli quota alice 500M 10000\n";
     std::cout << "\n";
 }
 
@@ -42,6 +49,10 @@ void print_user_info(const UserInfo& user) {
     std::cout << "  Status:      " << status << "\n";
     std::cout << "  Created:     " << user.created_time << "\n";
     std::cout << "  Last Login:  " << (user.last_login > 0 ? std::to_string(user.last_login) : "Never") << "\n";
+    std::cout << "  Files:       " << user.file_count << " / "
+              << (user.file_quota > 0 ? std::to_string(user.file_quota) : "unlimited") << "\n";
+    std::cout << "  Bytes:       " << user.bytes_used << " / "
+              << (user.byte_quota > 0 ? std::to_string(user.byte_quota) : "unlimited") << "\n";
 }
 
 int cmd_create(int argc, char* argv[]) {
@@ -283,6 +294,138 @@ int cmd_reset_admin(int argc, char* argv[]) {
     return 0;
 }
 
+uint64_t parse_size(const std::string& text) {
+    size_t pos = 0;
+    uint64_t value = 0;
+    try {
+        value = std::stoull(text, &pos);
+    } catch (...) {
+        return 0;
+    }
+    
+    std::string suffix = text.substr(pos);
+    if (suffix.empty()) return value;
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    return 0;
+}
+
+int cmd_grow(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Error: Missing size\n";
+        std::cerr << "Usage: admin_cli grow <size>\n";
+        return 1;
+    }
+    
+    uint64_t new_size = parse_size(argv[2]);
+    if (new_size == 0) {
+        std::cerr << "Error: Invalid size '" << argv[2] << "'\n";
+        return 1;
+    }
+    
+    uint64_t old_size = g_storage->get_total_size();
+    uint32_t old_blocks = g_storage->get_total_blocks();
+    
+    if (new_size <= old_size) {
+        std::cerr << "Error: New size must exceed current size (" << old_size << " bytes)\n";
+        return 1;
+    }
+    
+    if (!g_storage->grow(new_size)) {
+        std::cerr << "Error: Failed to grow container\n";
+        return 1;
+    }
+    
+    std::cout << "✓ Container grown from " << old_size << " to " << new_size << " bytes\n";
+    std::cout << "  Blocks:      " << old_blocks << " -> " << g_storage->get_total_blocks() << "\n";
+    std::cout << "  Free space:  " << g_storage->get_free_space() << " bytes\n";
+    return 0;
+}
+
+int cmd_usage(int argc, char* argv[]) {
+    std::vector<UserInfo> users;
+    if (argc > 2) {
+        UserInfo user;
+        if (!g_storage->get_user(argv[2], &user)) {
+            std::cerr << "Error: User '" << argv[2] << "' not found\n";
+            return 1;
+        }
+        users.push_back(user);
+    } else {
+        users = g_storage->list_users();
+    }
+    
+    for (const auto& user : users) {
+        std::cout << user.username << " (id " << user.user_id << "): "
+                  << user.file_count << " files";
+        if (user.file_quota > 0) std::cout << " of " << user.file_quota;
+        std::cout << ", " << user.bytes_used << " bytes";
+        if (user.byte_quota > 0) std::cout << " of " << user.byte_quota;
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+int cmd_quota(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Error: Missing arguments\n";
+        std::cerr << "Usage: admin_cli quota <username> <bytes> [files]\n";
+        return 1;
+    }
+    
+    std::string username = argv[2];
+    uint64_t byte_quota = parse_size(argv[3]);
+    if (byte_quota == 0 && std::string(argv[3]) != "0") {
+        std::cerr << "Error: Invalid size '" << argv[3] << "'\n";
+        return 1;
+    }
+    
+    uint64_t file_quota = 0;
+    if (argc > 4) {
+        try {
+            file_quota = std::stoull(argv[4]);
+        } catch (...) {
+            std::cerr << "Error: Invalid file count '" << argv[4] << "'\n";
+            return 1;
+        }
+        if (file_quota > 0xFFFF) {
+            std::cerr << "Error: File quota cannot exceed 65535\n";
+            return 1;
+        }
+    }
+    
+    if (!g_storage->set_user_quota(username, byte_quota, file_quota)) {
+        std::cerr << "Error: User '" << username << "' not found\n";
+        return 1;
+    }
+    
+    std::cout << "✓ Quota set for user '" << username << "'\n";
+    UserInfo user;
+    g_storage->get_user(username, &user);
+    print_user_info(user);
+    return 0;
+}
+
+int cmd_scrub(int argc, char* argv[]) {
+    uint32_t total = g_storage->get_total_blocks();
+    uint32_t checked = 0;
+    uint32_t bad = 0;
+    
+    for (uint32_t i = 1; i < total; i++) {
+        if (!g_storage->is_block_used(i)) continue;
+        checked++;
+        if (!g_storage->verify_block(i)) {
+            std::cerr << "  Block " << i << ": checksum mismatch\n";
+            bad++;
+        }
+    }
+    
+    std::cout << "Scrubbed " << checked << " blocks, " << bad << " corrupt\n";
+    std::cout << "Metadata errors at open: " << (g_storage->get_checksum_errors() - bad) << "\n";
+    return (bad > 0 || g_storage->get_checksum_errors() > 0) ? 1 : 0;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         print_usage();
@@ -291,17 +434,26 @@ int main(int argc, char* argv[]) {
     
     g_storage = new OmniStorage();
     
+    ConfigParser::load("default.uconf");
+    uint64_t total_size = ConfigParser::get_uint("filesystem", "total_size", 104857600);
+    uint32_t stripe_count = ConfigParser::get_uint("filesystem", "stripe_count", 1);
+    g_storage->set_stripe_dirs(ConfigParser::get_list("filesystem", "stripe_dirs"));
+    g_storage->set_space_policy(ConfigParser::get_bool("filesystem", "preallocate", false),
+                                ConfigParser::get_bool("filesystem", "punch_holes", false));
+    
     struct stat st;
     if (stat("data/system.omni", &st) != 0) {
         std::cout << "Initializing OFS storage..." << std::endl;
-        if (!g_storage->create("data/system.omni", 104857600)) {
-            std::cerr << "Error: Failed to initialize storage\n";
+        if (!g_storage->create("data/system.omni", total_size, stripe_count)) {
+            std::cerr << (g_storage->in_use() ? "Error: Storage is in use by a running server\n"
+                                              : "Error: Failed to initialize storage\n");
             delete g_storage;
             return 1;
         }
     } else {
         if (!g_storage->open("data/system.omni")) {
-            std::cerr << "Error: Failed to open storage\n";
+            std::cerr << (g_storage->in_use() ? "Error: Storage is in use by a running server\n"
+                                              : "Error: Failed to open storage\n");
             delete g_storage;
             return 1;
         }
@@ -326,8 +478,16 @@ int main(int argc, char* argv[]) {
         result = cmd_change_pwd(argc, argv);
     } else if (command == "info") {
         result = cmd_info(argc, argv);
+    } else if (command == "usage") {
+        result = cmd_usage(argc, argv);
+    } else if (command == "quota") {
+        result = cmd_quota(argc, argv);
     } else if (command == "reset-admin") {
         result = cmd_reset_admin(argc, argv);
+    } else if (command == "grow") {
+        result = cmd_grow(argc, argv);
+    } else if (command == "scrub") {
+        result = cmd_scrub(argc, argv);
     } else {
         std::cerr << "Error: Unknown command '" << command << "'\n";
         print_usage();
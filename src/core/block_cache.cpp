@@ -0,0 +1,92 @@
+#include "block_cache.hpp"
+
+BlockCache::BlockCache() : capacity(0), epoch(0), hits(0), misses(0) {}
+
+void BlockCache::set_capacity(size_t capacity_blocks) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    capacity = capacity_blocks;
+    evict_to(capacity);
+}
+
+size_t BlockCache::get_capacity() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return capacity;
+}
+
+std::shared_ptr<const CachedBlock> BlockCache::get(uint32_t block_idx) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    
+    auto it = slots.find(block_idx);
+    if (it == slots.end()) {
+        misses++;
+        return nullptr;
+    }
+    
+    lru.splice(lru.begin(), lru, it->second.lru_pos);
+    hits++;
+    return it->second.block;
+}
+
+std::shared_ptr<const CachedBlock> BlockCache::peek(uint32_t block_idx) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    
+    auto it = slots.find(block_idx);
+    return (it != slots.end()) ? it->second.block : nullptr;
+}
+
+void BlockCache::put(uint32_t block_idx, std::shared_ptr<const CachedBlock> block, uint64_t sampled_epoch) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    
+    if (capacity == 0 || sampled_epoch != epoch) return;
+    
+    auto it = slots.find(block_idx);
+    if (it != slots.end()) {
+        it->second.block = block;
+        lru.splice(lru.begin(), lru, it->second.lru_pos);
+        return;
+    }
+    
+    evict_to(capacity - 1);
+    lru.push_front(block_idx);
+    slots[block_idx] = {block, lru.begin()};
+}
+
+void BlockCache::invalidate(uint32_t block_idx) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    epoch++;
+    
+    auto it = slots.find(block_idx);
+    if (it != slots.end()) {
+        lru.erase(it->second.lru_pos);
+        slots.erase(it);
+    }
+}
+
+void BlockCache::clear() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    epoch++;
+    lru.clear();
+    slots.clear();
+}
+
+uint64_t BlockCache::get_epoch() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return epoch;
+}
+
+uint64_t BlockCache::get_hits() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return hits;
+}
+
+uint64_t BlockCache::get_misses() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return misses;
+}
+
+void BlockCache::evict_to(size_t limit) {
+    while (slots.size() > limit && !lru.empty()) {
+        slots.erase(lru.back());
+        lru.pop_back();
+    }
+}
@@ -0,0 +1,194 @@
+#include "change_bus.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <thread>
+
+ChangeBus::ChangeBus() : next_watch_id(1), next_seq(1) {}
+
+static bool is_within(const std::string& path, const std::string& root) {
+    if (path.size() <= root.size() || path.compare(0, root.size(), root) != 0) return false;
+    return root == "/" || path[root.size()] == '/';
+}
+
+static std::string parent_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+}
+
+// True if a change at path belongs to the watch: the watched directory
+// itself, its children, or with recursive anything below it.
+bool ChangeBus::concerns(const Watch& watch, const std::string& path) {
+    if (path == watch.path) return true;
+    if (!is_within(path, watch.path)) return false;
+    return watch.recursive || parent_of(path) == watch.path;
+}
+
+// Folds event into the watch's queue. A later change to a path with an
+// uncollected event updates that event instead of adding one:
+//   CREATE + WRITE/ATTRIB  -> CREATE
+//   CREATE + DELETE        -> nothing
+//   WRITE/ATTRIB + WRITE/ATTRIB -> WRITE (ATTRIB if both were)
+//   WRITE/ATTRIB + DELETE  -> DELETE
+//   DELETE + CREATE        -> WRITE
+// Renames are never folded and end folding for both of their paths.
+// Dropped events stay in place with seq 0 so the indices remain valid.
+void ChangeBus::enqueue(Watch& watch, const ChangeEvent& event) {
+    if (event.type == ChangeType::RENAME) {
+        watch.latest.erase(event.path);
+        watch.latest.erase(event.old_path);
+    } else {
+        auto latest = watch.latest.find(event.path);
+        if (latest != watch.latest.end()) {
+            ChangeEvent& pending = watch.events[latest->second];
+            ChangeType merged = pending.type;
+            bool fold = true;
+            
+            switch (pending.type) {
+            case ChangeType::CREATE:
+                if (event.type == ChangeType::DELETE) {
+                    pending.seq = 0;
+                    watch.latest.erase(latest);
+                    return;
+                }
+                fold = event.type != ChangeType::CREATE;
+                break;
+            case ChangeType::WRITE:
+            case ChangeType::ATTRIB:
+                if (event.type == ChangeType::DELETE) merged = ChangeType::DELETE;
+                else if (event.type == ChangeType::WRITE) merged = ChangeType::WRITE;
+                else fold = event.type == ChangeType::ATTRIB;
+                break;
+            case ChangeType::DELETE:
+                fold = event.type == ChangeType::CREATE && event.entry_type == pending.entry_type;
+                merged = ChangeType::WRITE;
+                break;
+            default:
+                fold = false;
+                break;
+            }
+            
+            if (fold) {
+                ChangeType type = merged;
+                pending = event;
+                pending.type = type;
+                return;
+            }
+        }
+    }
+    
+    if (watch.events.size() >= QUEUE_LIMIT) {
+        watch.events.clear();
+        watch.latest.clear();
+        watch.overflow = true;
+    }
+    
+    watch.events.push_back(event);
+    if (event.type != ChangeType::RENAME) {
+        watch.latest[event.path] = watch.events.size() - 1;
+    }
+}
+
+uint64_t ChangeBus::subscribe(const std::string& path, bool recursive) {
+    std::shared_ptr<Watch> watch = std::make_shared<Watch>();
+    watch->path = path;
+    watch->recursive = recursive;
+    watch->overflow = false;
+    watch->closed = false;
+    watch->last_activity = time(nullptr);
+    
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    uint64_t watch_id = next_watch_id++;
+    watches[watch_id] = watch;
+    return watch_id;
+}
+
+bool ChangeBus::unsubscribe(uint64_t watch_id) {
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    auto it = watches.find(watch_id);
+    if (it == watches.end()) return false;
+    
+    it->second->closed = true;
+    it->second->cv.notify_all();
+    watches.erase(it);
+    return true;
+}
+
+uint64_t ChangeBus::publish(ChangeEvent event) {
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    if (event.seq == 0) event.seq = next_seq;
+    next_seq = std::max(next_seq, event.seq + 1);
+    
+    // A delete or rename of a watched directory's ancestor also ends or
+    // moves the watched directory.
+    bool structural = event.type == ChangeType::DELETE || event.type == ChangeType::RENAME;
+    
+    for (auto& entry : watches) {
+        Watch& watch = *entry.second;
+        bool relevant = concerns(watch, event.path) ||
+                        (event.type == ChangeType::RENAME && concerns(watch, event.old_path)) ||
+                        (structural && is_within(watch.path, event.path)) ||
+                        (event.type == ChangeType::RENAME && is_within(watch.path, event.old_path));
+        if (!relevant) continue;
+        
+        enqueue(watch, event);
+        watch.cv.notify_all();
+    }
+    return event.seq;
+}
+
+bool ChangeBus::wait(uint64_t watch_id, uint32_t timeout_ms, uint32_t coalesce_ms,
+                     std::vector<ChangeEvent>* out_events, bool* out_overflow) {
+    std::unique_lock<std::mutex> lock(bus_mutex);
+    auto it = watches.find(watch_id);
+    if (it == watches.end()) return false;
+    
+    std::shared_ptr<Watch> watch = it->second;
+    watch->last_activity = time(nullptr);
+    
+    watch->cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&watch] {
+        return watch->closed || watch->overflow || !watch->events.empty();
+    });
+    
+    if (!watch->closed && !watch->events.empty() && coalesce_ms > 0) {
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(coalesce_ms));
+        lock.lock();
+    }
+    
+    out_events->clear();
+    for (const ChangeEvent& event : watch->events) {
+        if (event.seq != 0) out_events->push_back(event);
+    }
+    watch->events.clear();
+    watch->latest.clear();
+    *out_overflow = watch->overflow;
+    watch->overflow = false;
+    watch->last_activity = time(nullptr);
+    return !watch->closed;
+}
+
+void ChangeBus::reap_idle(uint32_t idle_seconds) {
+    uint64_t now = time(nullptr);
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    
+    for (auto it = watches.begin(); it != watches.end();) {
+        if (now - it->second->last_activity > idle_seconds) {
+            it->second->closed = true;
+            it->second->cv.notify_all();
+            it = watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t ChangeBus::watch_count() {
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    return watches.size();
+}
+
+uint64_t ChangeBus::last_seq() {
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    return next_seq - 1;
+}
@@ -0,0 +1,490 @@
+#include "content_index.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+
+static const char INDEX_MAGIC[8] = {'O', 'F', 'S', 'C', 'I', 'X', '0', '1'};
+
+// BM25 parameters.
+static const double BM25_K1 = 1.2;
+static const double BM25_B = 0.75;
+
+static void put_varint(std::string* out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back((char)value);
+}
+
+static bool get_varint(const std::string& in, size_t* pos, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *pos < in.size(); shift += 7) {
+        uint8_t byte = (uint8_t)in[(*pos)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+// Walks the records of one posting list without decoding positions.
+class PostingReader {
+public:
+    explicit PostingReader(const std::string& list) : list(list), pos(0), doc(0), tf(0),
+        start(0), delta_end(0), positions(0), end(0) {}
+    
+    bool next() {
+        if (pos >= list.size()) return false;
+        
+        uint64_t delta, freq, length;
+        start = pos;
+        if (!get_varint(list, &pos, &delta)) return false;
+        delta_end = pos;
+        if (!get_varint(list, &pos, &freq) || !get_varint(list, &pos, &length)) return false;
+        if (length > list.size() - pos) return false;
+        
+        doc += (uint32_t)delta;
+        tf = (uint32_t)freq;
+        positions = pos;
+        pos += length;
+        end = pos;
+        return true;
+    }
+    
+    void decode_positions(std::vector<uint32_t>* out) const {
+        out->clear();
+        size_t at = positions;
+        uint64_t delta;
+        uint32_t position = 0;
+        while (at < end && get_varint(list, &at, &delta)) {
+            position += (uint32_t)delta;
+            out->push_back(position);
+        }
+    }
+    
+    const std::string& list;
+    size_t pos;
+    uint32_t doc;
+    uint32_t tf;
+    size_t start;
+    size_t delta_end;
+    size_t positions;
+    size_t end;
+};
+
+ContentIndex::ContentIndex() : total_length(0), dirty(false) {}
+
+void ContentIndex::tokenize(const std::string& text, std::vector<std::string>* tokens) {
+    std::string token;
+    bool too_long = false;
+    
+    for (size_t i = 0; i <= text.size(); i++) {
+        unsigned char c = i < text.size() ? (unsigned char)text[i] : ' ';
+        if (std::isalnum(c) || c >= 0x80) {
+            if (token.size() < MAX_TERM_LENGTH) token += (char)std::tolower(c);
+            else too_long = true;
+            continue;
+        }
+        if (!token.empty() && !too_long) tokens->push_back(token);
+        token.clear();
+        too_long = false;
+    }
+}
+
+uint32_t ContentIndex::term_id(const std::string& term) {
+    auto it = term_ids.find(term);
+    if (it != term_ids.end()) return it->second;
+    
+    uint32_t id = term_names.size();
+    term_ids[term] = id;
+    term_names.push_back(term);
+    postings.emplace_back();
+    doc_freq.push_back(0);
+    return id;
+}
+
+// Replaces the record for entry_idx with `record` (tf, length and positions,
+// without the delta), or removes it when record is null. Only the record and
+// the delta of the one after it are rewritten.
+void ContentIndex::splice(std::string* list, uint32_t entry_idx, const std::string* record) {
+    PostingReader reader(*list);
+    uint32_t prev = 0;
+    size_t cut_start = list->size();
+    size_t cut_end = list->size();
+    bool has_next = false;
+    uint32_t next_doc = 0;
+    
+    while (reader.next()) {
+        if (reader.doc < entry_idx) {
+            prev = reader.doc;
+            continue;
+        }
+        
+        cut_start = reader.start;
+        if (reader.doc == entry_idx && !reader.next()) break;
+        
+        has_next = true;
+        next_doc = reader.doc;
+        cut_end = reader.delta_end;
+        break;
+    }
+    
+    std::string replacement;
+    uint32_t last = prev;
+    if (record) {
+        put_varint(&replacement, entry_idx - prev);
+        replacement += *record;
+        last = entry_idx;
+    }
+    if (has_next) put_varint(&replacement, next_doc - last);
+    
+    list->replace(cut_start, cut_end - cut_start, replacement);
+}
+
+void ContentIndex::update(uint32_t entry_idx, const ContentVersion& version, const std::string& text) {
+    std::vector<std::string> tokens;
+    tokenize(text, &tokens);
+    
+    std::unordered_map<std::string, std::vector<uint32_t>> occurrences;
+    for (uint32_t i = 0; i < tokens.size(); i++) {
+        occurrences[tokens[i]].push_back(i);
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    remove_locked(entry_idx);
+    
+    Document doc;
+    doc.version = version;
+    doc.length = tokens.size();
+    doc.terms.reserve(occurrences.size());
+    
+    std::string record;
+    std::string encoded;
+    for (const auto& term : occurrences) {
+        encoded.clear();
+        uint32_t last = 0;
+        for (uint32_t position : term.second) {
+            put_varint(&encoded, position - last);
+            last = position;
+        }
+        
+        record.clear();
+        put_varint(&record, term.second.size());
+        put_varint(&record, encoded.size());
+        record += encoded;
+        
+        uint32_t id = term_id(term.first);
+        splice(&postings[id], entry_idx, &record);
+        doc_freq[id]++;
+        doc.terms.push_back(id);
+    }
+    
+    total_length += doc.length;
+    docs[entry_idx] = std::move(doc);
+    dirty = true;
+}
+
+void ContentIndex::remove(uint32_t entry_idx) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    remove_locked(entry_idx);
+}
+
+void ContentIndex::remove_locked(uint32_t entry_idx) {
+    auto it = docs.find(entry_idx);
+    if (it == docs.end()) return;
+    
+    for (uint32_t id : it->second.terms) {
+        splice(&postings[id], entry_idx, nullptr);
+        doc_freq[id]--;
+    }
+    total_length -= it->second.length;
+    docs.erase(it);
+    dirty = true;
+}
+
+bool ContentIndex::indexed_version(uint32_t entry_idx, ContentVersion* out_version) {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    auto it = docs.find(entry_idx);
+    if (it == docs.end()) return false;
+    
+    *out_version = it->second.version;
+    return true;
+}
+
+std::vector<uint32_t> ContentIndex::documents() {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    std::vector<uint32_t> result;
+    result.reserve(docs.size());
+    for (const auto& doc : docs) result.push_back(doc.first);
+    return result;
+}
+
+void ContentIndex::clear() {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    term_ids.clear();
+    term_names.clear();
+    postings.clear();
+    doc_freq.clear();
+    docs.clear();
+    total_length = 0;
+    dirty = true;
+}
+
+size_t ContentIndex::document_count() {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return docs.size();
+}
+
+size_t ContentIndex::term_count() {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    size_t count = 0;
+    for (uint32_t df : doc_freq) {
+        if (df > 0) count++;
+    }
+    return count;
+}
+
+bool ContentIndex::has_unsaved_changes() {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return dirty;
+}
+
+std::vector<ContentHit> ContentIndex::search(const std::string& query, size_t limit) {
+    // Text between quotes is a phrase; everything else is single words.
+    std::vector<std::vector<std::string>> clauses;
+    std::vector<std::string> terms;
+    std::stringstream segments(query);
+    std::string segment;
+    for (bool quoted = false; std::getline(segments, segment, '"'); quoted = !quoted) {
+        std::vector<std::string> tokens;
+        tokenize(segment, &tokens);
+        if (quoted && tokens.size() > 1) {
+            clauses.push_back(tokens);
+        }
+        terms.insert(terms.end(), tokens.begin(), tokens.end());
+    }
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    
+    std::vector<ContentHit> hits;
+    if (terms.empty() || limit == 0) return hits;
+    
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    if (docs.empty()) return hits;
+    
+    // Every record of every query term, located once.
+    struct Match {
+        uint32_t doc;
+        uint32_t tf;
+        size_t positions;
+        size_t end;
+    };
+    std::unordered_map<std::string, std::vector<Match>> matches;
+    std::vector<const std::vector<Match>*> by_size;
+    for (const std::string& term : terms) {
+        auto id = term_ids.find(term);
+        if (id == term_ids.end() || doc_freq[id->second] == 0) return hits;
+        
+        std::vector<Match>& list = matches[term];
+        PostingReader reader(postings[id->second]);
+        while (reader.next()) {
+            list.push_back({reader.doc, reader.tf, reader.positions, reader.end});
+        }
+        by_size.push_back(&list);
+    }
+    std::sort(by_size.begin(), by_size.end(),
+              [](const std::vector<Match>* a, const std::vector<Match>* b) { return a->size() < b->size(); });
+    
+    auto find = [&matches](const std::string& term, uint32_t doc) -> const Match* {
+        const std::vector<Match>& list = matches.at(term);
+        auto it = std::lower_bound(list.begin(), list.end(), doc,
+                                   [](const Match& m, uint32_t d) { return m.doc < d; });
+        return it != list.end() && it->doc == doc ? &*it : nullptr;
+    };
+    
+    auto positions_of = [this](const std::string& term, const Match& match, std::vector<uint32_t>* out) {
+        PostingReader reader(postings[term_ids.at(term)]);
+        reader.positions = match.positions;
+        reader.end = match.end;
+        reader.decode_positions(out);
+    };
+    
+    double doc_count = docs.size();
+    double average_length = std::max(1.0, (double)total_length / doc_count);
+    std::vector<std::vector<uint32_t>> phrase_positions;
+    
+    for (const Match& candidate : *by_size[0]) {
+        uint32_t doc = candidate.doc;
+        bool all = true;
+        for (size_t i = 1; i < by_size.size() && all; i++) {
+            auto it = std::lower_bound(by_size[i]->begin(), by_size[i]->end(), doc,
+                                       [](const Match& m, uint32_t d) { return m.doc < d; });
+            all = it != by_size[i]->end() && it->doc == doc;
+        }
+        if (!all) continue;
+        
+        bool phrases = true;
+        for (const auto& clause : clauses) {
+            phrase_positions.resize(clause.size());
+            for (size_t i = 0; i < clause.size(); i++) {
+                positions_of(clause[i], *find(clause[i], doc), &phrase_positions[i]);
+            }
+            
+            bool found = false;
+            for (uint32_t start : phrase_positions[0]) {
+                found = true;
+                for (size_t i = 1; i < clause.size() && found; i++) {
+                    found = std::binary_search(phrase_positions[i].begin(), phrase_positions[i].end(), start + i);
+                }
+                if (found) break;
+            }
+            if (!found) {
+                phrases = false;
+                break;
+            }
+        }
+        if (!phrases) continue;
+        
+        double length_norm = 1 - BM25_B + BM25_B * docs.at(doc).length / average_length;
+        double score = 0;
+        for (const std::string& term : terms) {
+            double df = doc_freq[term_ids.at(term)];
+            double tf = find(term, doc)->tf;
+            double idf = std::log(1 + (doc_count - df + 0.5) / (df + 0.5));
+            score += idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * length_norm);
+        }
+        hits.push_back({doc, score});
+    }
+    
+    auto better = [](const ContentHit& a, const ContentHit& b) {
+        return a.score != b.score ? a.score > b.score : a.entry_idx < b.entry_idx;
+    };
+    if (hits.size() > limit) {
+        std::partial_sort(hits.begin(), hits.begin() + limit, hits.end(), better);
+        hits.resize(limit);
+    } else {
+        std::sort(hits.begin(), hits.end(), better);
+    }
+    return hits;
+}
+
+bool ContentIndex::save(const std::string& path) {
+    std::string body;
+    {
+        std::unique_lock<std::shared_mutex> lock(index_mutex);
+        
+        put_varint(&body, docs.size());
+        for (const auto& doc : docs) {
+            put_varint(&body, doc.first);
+            put_varint(&body, doc.second.version.chain);
+            put_varint(&body, doc.second.version.size);
+            put_varint(&body, doc.second.version.modified_time);
+            put_varint(&body, doc.second.length);
+        }
+        
+        size_t live_terms = 0;
+        for (uint32_t df : doc_freq) {
+            if (df > 0) live_terms++;
+        }
+        put_varint(&body, live_terms);
+        for (uint32_t id = 0; id < term_names.size(); id++) {
+            if (doc_freq[id] == 0) continue;
+            put_varint(&body, term_names[id].size());
+            body += term_names[id];
+            put_varint(&body, postings[id].size());
+            body += postings[id];
+        }
+        dirty = false;
+    }
+    
+    uint32_t crc = CRC32C::compute(body.data(), body.size());
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        out.write((const char*)&crc, sizeof(crc));
+        out.write(body.data(), body.size());
+        if (!out) return false;
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool ContentIndex::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    
+    uint32_t crc;
+    size_t header = sizeof(INDEX_MAGIC) + sizeof(crc);
+    if (file.size() < header || memcmp(file.data(), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) return false;
+    memcpy(&crc, file.data() + sizeof(INDEX_MAGIC), sizeof(crc));
+    if (CRC32C::compute(file.data() + header, file.size() - header) != crc) return false;
+    
+    std::string body = file.substr(header);
+    size_t pos = 0;
+    uint64_t count;
+    
+    std::unordered_map<uint32_t, Document> loaded_docs;
+    uint64_t loaded_length = 0;
+    if (!get_varint(body, &pos, &count)) return false;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t idx, chain, size, modified, length;
+        if (!get_varint(body, &pos, &idx) || !get_varint(body, &pos, &chain) || !get_varint(body, &pos, &size) ||
+            !get_varint(body, &pos, &modified) || !get_varint(body, &pos, &length)) {
+            return false;
+        }
+        Document& doc = loaded_docs[(uint32_t)idx];
+        doc.version = {(uint32_t)chain, size, modified};
+        doc.length = (uint32_t)length;
+        loaded_length += length;
+    }
+    
+    std::unordered_map<std::string, uint32_t> loaded_ids;
+    std::vector<std::string> loaded_names;
+    std::vector<std::string> loaded_postings;
+    std::vector<uint32_t> loaded_freq;
+    if (!get_varint(body, &pos, &count)) return false;
+    for (uint64_t id = 0; id < count; id++) {
+        uint64_t name_length, list_length;
+        if (!get_varint(body, &pos, &name_length) || name_length > body.size() - pos) return false;
+        std::string name = body.substr(pos, name_length);
+        pos += name_length;
+        if (!get_varint(body, &pos, &list_length) || list_length > body.size() - pos) return false;
+        std::string list = body.substr(pos, list_length);
+        pos += list_length;
+        
+        // Each document's term list is rebuilt from the postings.
+        uint32_t df = 0;
+        PostingReader reader(list);
+        while (reader.next()) {
+            auto doc = loaded_docs.find(reader.doc);
+            if (doc == loaded_docs.end()) return false;
+            doc->second.terms.push_back(id);
+            df++;
+        }
+        if (reader.pos != list.size()) return false;
+        
+        loaded_ids[name] = id;
+        loaded_names.push_back(std::move(name));
+        loaded_postings.push_back(std::move(list));
+        loaded_freq.push_back(df);
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    term_ids.swap(loaded_ids);
+    term_names.swap(loaded_names);
+    postings.swap(loaded_postings);
+    doc_freq.swap(loaded_freq);
+    docs.swap(loaded_docs);
+    total_length = loaded_length;
+    dirty = false;
+    return true;
+}
@@ -2,25 +2,188 @@
 #include "omni_storage.hpp"
 #include "logger.hpp"
 #include "path_resolver.hpp"
+#include "content_index.hpp"
+#include "change_bus.hpp"
+#include "user_manager.hpp"
 #include <map>
+#include <set>
+#include <algorithm>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <random>
+#include <ctime>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ENTRY_LOCK_STRIPES 1024
+#define UPLOAD_IDLE_TIMEOUT 600
+#define CONTENT_INDEX_SAVE_INTERVAL 5
+#define WATCH_IDLE_TIMEOUT 120
+#define WATCH_COALESCE_MS 50
+#define READ_STREAM_BATCH_BLOCKS 64
 
 static OmniStorage* g_storage = nullptr;
-static std::mutex g_storage_mutex;
-static std::map<std::string, uint32_t> g_user_id_map;
-static uint32_t g_next_user_id = 1;
+
+// Lock hierarchy, always acquired top down:
+//
+//   g_storage_lock    shared by every operation; exclusive only for changes
+//                     to the container itself (grow)
+//   g_namespace_lock  shared while resolving paths or listing, exclusive
+//                     while entries are created, removed or renamed
+//   entry_lock(idx)   shared while a reader walks a file's block chain
+//
+// File contents are never written under the namespace lock: a new chain is
+// built unlocked and published with attach_chain(). The content it replaces
+// is retired only after taking the entry lock exclusively once, which waits
+// out every reader still walking it. Nothing waits for the namespace lock
+// while holding an entry lock.
+static std::shared_mutex g_storage_lock;
+static std::shared_mutex g_namespace_lock;
+static std::shared_mutex g_entry_locks[ENTRY_LOCK_STRIPES];
+
+// An open upload. Its chain is private until commit, so it is built under
+// the storage lock alone; `mutex` orders writes to one upload and `closed`
+// stops writes that race with commit, abort or reaping.
+struct UploadState {
+    std::mutex mutex;
+    std::string path;
+    uint32_t uploader;          // who began it; only they may write, commit or abort
+    uint32_t owner;             // of the file being replaced, else the uploader
+    uint64_t replaced_size;
+    ChainBuilder chain;
+    time_t last_activity;
+    bool closed;
+};
+
+static std::map<uint64_t, std::shared_ptr<UploadState>> g_uploads;
+static std::mutex g_upload_mutex;
+
+static std::thread g_scrub_thread;
+static std::mutex g_scrub_mutex;
+static std::condition_variable g_scrub_cv;
+static bool g_scrub_running = false;
+
+// Content indexing runs behind writes: the storage listener queues changed
+// entries in g_index_pending and one thread re-reads and indexes them.
+static ContentIndex g_content_index;
+static std::thread g_index_thread;
+static std::mutex g_index_mutex;
+static std::condition_variable g_index_cv;
+static std::set<uint32_t> g_index_pending;
+static std::string g_index_path;
+static uint64_t g_index_max_bytes = 0;
+static bool g_index_running = false;
+
+static ChangeBus g_change_bus;
 
 void set_storage_instance(OmniStorage* storage) {
     g_storage = storage;
 }
 
+static std::shared_mutex& entry_lock(uint32_t entry_idx) {
+    return g_entry_locks[entry_idx % ENTRY_LOCK_STRIPES];
+}
+
+// Hands the content entry_idx held as `before` to the storage, which keeps
+// it as a version or frees it, once no reader can still be on its chain.
+// The entry lock stays shared meanwhile so the chain that replaced it, which
+// the version may share blocks with, cannot be retired in turn.
+static void retire_content(uint32_t entry_idx, const MetadataEntry& before) {
+    { std::unique_lock<std::shared_mutex> grace(entry_lock(entry_idx)); }
+    std::shared_lock<std::shared_mutex> lock(entry_lock(entry_idx));
+    g_storage->retire_chain(entry_idx, before);
+}
+
+static ChangeEvent make_change(ChangeType type, const std::string& path, uint32_t entry_idx,
+                               const MetadataEntry& entry, const std::string& old_path = "") {
+    ChangeEvent event;
+    event.seq = 0;
+    event.type = type;
+    event.entry_type = entry.type;
+    event.entry = entry_idx;
+    event.path = path;
+    event.old_path = old_path;
+    event.size = entry.total_size;
+    event.modified_time = entry.modified_time;
+    return event;
+}
+
+static ChangeRecord make_record(ChangeType type, uint32_t entry_idx, const MetadataEntry& entry) {
+    ChangeRecord record;
+    memset(&record, 0, sizeof(record));
+    record.op = static_cast<uint8_t>(type);
+    record.type = entry.type;
+    record.entry = entry_idx;
+    record.parent = entry.parent_index;
+    memcpy(record.name, entry.name, sizeof(record.name));
+    record.size = entry.total_size;
+    record.modified_time = entry.modified_time;
+    return record;
+}
+
+// Records a change in the change log and tells watchers about it, under the
+// log's sequence number. Called before the namespace lock that covered the
+// change is released, so sequence numbers follow the order in which changes
+// became visible.
+static void publish_change(ChangeType type, const std::string& path, uint32_t entry_idx,
+                           const std::string& old_path = "") {
+    MetadataEntry entry;
+    if (!g_storage->snapshot_entry(entry_idx, &entry)) return;
+    
+    ChangeEvent event = make_change(type, path, entry_idx, entry, old_path);
+    event.seq = g_storage->log_change(make_record(type, entry_idx, entry));
+    g_change_bus.publish(event);
+}
+
+// Records a change only in the change log, for the entries inside a tree
+// whose watchers get a single event for its root.
+static void log_change(ChangeType type, uint32_t entry_idx) {
+    MetadataEntry entry;
+    if (g_storage->snapshot_entry(entry_idx, &entry)) {
+        g_storage->log_change(make_record(type, entry_idx, entry));
+    }
+}
+
 uint32_t get_user_id(const std::string& username) {
-    auto it = g_user_id_map.find(username);
-    if (it != g_user_id_map.end()) return it->second;
-    
-    uint32_t id = g_next_user_id++;
-    g_user_id_map[username] = id;
-    return id;
+    UserInfo user;
+    return g_storage && g_storage->get_user(username, &user) ? user.user_id : 0;
+}
+
+static std::string get_user_name(uint32_t user_id) {
+    UserInfo user;
+    return g_storage->get_user_by_id(user_id, &user) ? std::string(user.username) : "";
+}
+
+// Copies an entry's name into dst, cut to fit and always terminated. The
+// name is read no further than its own field, so a full one is safe too.
+template <size_t N>
+static void copy_entry_name(char (&dst)[N], const MetadataEntry& entry) {
+    size_t length = strnlen(entry.name, std::min(sizeof(entry.name), N - 1));
+    memcpy(dst, entry.name, length);
+    dst[length] = '\0';
+}
+
+// The user a session acts for, who owns what it creates and is charged for
+// it. Calls without a session act for user 1, the first account, which
+// owned everything before ownership was tracked.
+static uint32_t session_user(OFS_Session session) {
+    std::string username;
+    UserRole role;
+    if (session && verify_session(session, username, role) == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        uint32_t user_id = get_user_id(username);
+        if (user_id != 0) return user_id;
+    }
+    return 1;
+}
+
+// Whether replacing a file's data with size bytes fits its owner's quota.
+static bool rewrite_within_quota(const MetadataEntry& entry, uint64_t size) {
+    return size <= entry.total_size || g_storage->within_quota(entry.owner_id, 0, size - entry.total_size);
 }
 
 uint32_t find_entry_by_path(const std::string& path, uint32_t user_id) {
@@ -28,23 +191,12 @@ uint32_t find_entry_by_path(const std::string& path, uint32_t user_id) {
     
     if (path == "/") return 0;
     
-    std::vector<std::string> parts = PathResolver::split(path);
+    PathComponents parts;
+    PathResolver::tokenize(path, &parts);
     uint32_t current = 0;
     
-    for (const auto& part : parts) {
-        std::vector<uint32_t> children = g_storage->list_children(current);
-        bool found = false;
-        
-        for (uint32_t child_idx : children) {
-            MetadataEntry* entry = g_storage->get_entry(child_idx);
-            if (entry && strcmp(entry->name, part.c_str()) == 0) {
-                current = child_idx;
-                found = true;
-                break;
-            }
-        }
-        
-        if (!found) return 0xFFFFFFFF;
+    for (size_t i = 0; i < parts.size() && current != 0xFFFFFFFF; i++) {
+        current = g_storage->find_child(current, parts[i]);
     }
     
     return current;
@@ -56,299 +208,1680 @@ int file_create(OFS_Session session, const std::string& path, const void* data,
     int validation = PathResolver::validate_path(path);
     if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
     
     std::string parent_path = PathResolver::get_parent(path);
     std::string filename = PathResolver::get_filename(path);
     
-    uint32_t user_id = 1;
-    uint32_t parent_idx = find_entry_by_path(parent_path, user_id);
-    
-    if (parent_idx == 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
-    }
-    
-    if (find_entry_by_path(path, user_id) != 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    uint32_t user_id = session_user(session);
+    uint64_t data_size = data ? size : 0;
+    {
+        // Fail fast before writing any data.
+        std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        if (find_entry_by_path(parent_path, user_id) == 0xFFFFFFFF) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        }
+        if (find_entry_by_path(path, user_id) != 0xFFFFFFFF) {
+            return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+        }
+        if (!g_storage->within_quota(user_id, 1, data_size)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        }
     }
     
-    uint32_t entry_idx = g_storage->allocate_entry(0, parent_idx, filename, user_id);
-    if (entry_idx == 0xFFFFFFFF) {
+    uint32_t chain = g_storage->write_chain(data, data_size);
+    if (chain == 0xFFFFFFFF) {
         return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
     }
     
-    if (data && size > 0) {
-        if (!g_storage->write_file_data(entry_idx, data, size)) {
-            g_storage->free_entry(entry_idx);
-            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        g_storage->begin_group();
+        
+        uint32_t parent_idx = find_entry_by_path(parent_path, user_id);
+        uint32_t entry_idx = 0xFFFFFFFF;
+        
+        if (parent_idx == 0xFFFFFFFF) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        } else if (find_entry_by_path(path, user_id) != 0xFFFFFFFF) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+        } else if (!g_storage->within_quota(user_id, 1, data_size)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        } else if ((entry_idx = g_storage->allocate_entry(0, parent_idx, filename, user_id)) == 0xFFFFFFFF) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        } else {
+            g_storage->attach_chain(entry_idx, chain, data_size);
+            publish_change(ChangeType::CREATE, path, entry_idx);
         }
+        g_storage->end_group();
+    }
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        // The chain was never published, so nobody can be reading it.
+        g_storage->free_block_chain(chain);
+        return result;
     }
     
     Logger::log_file_op("CREATE", path, "user", true);
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_read(OFS_Session session, const std::string& path, void** out_buffer, size_t* out_size) {
+int file_read(OFS_Session session, const std::string& path, SharedBuffer* out_buffer) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
     int validation = PathResolver::validate_path(path);
     if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
     
     uint32_t entry_idx = find_entry_by_path(path, 1);
     if (entry_idx == 0xFFFFFFFF) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
     
-    MetadataEntry* entry = g_storage->get_entry(entry_idx);
-    if (!entry || entry->type != 0) {
+    MetadataEntry entry;
+    if (!g_storage->snapshot_entry(entry_idx, &entry) || entry.type != 0) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
-    *out_size = entry->total_size;
-    if (*out_size == 0) {
-        *out_buffer = nullptr;
+    // Pin the chain, then let namespace writers proceed during the read.
+    std::shared_lock<std::shared_mutex> data_lock(entry_lock(entry_idx));
+    ns_lock.unlock();
+    
+    *out_buffer = SharedBuffer();
+    if (entry.total_size == 0) {
         return static_cast<int>(OFSErrorCodes::SUCCESS);
     }
     
-    *out_buffer = new char[*out_size];
-    size_t read = g_storage->read_file_data(entry_idx, *out_buffer, *out_size);
-    
-    if (read != *out_size) {
-        delete[] (char*)*out_buffer;
-        *out_buffer = nullptr;
-        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    if (entry.total_size <= BLOCK_SIZE - sizeof(BlockHeader)) {
+        SharedBuffer block;
+        if (!g_storage->read_block_view(entry.start_block, &block, nullptr) || block.size() < entry.total_size) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        *out_buffer = block.slice(0, entry.total_size);
+    } else {
+        std::vector<uint8_t> data(entry.total_size);
+        if (g_storage->read_chain(entry_idx, entry.start_block, data.data(), data.size()) != data.size()) {
+            return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+        *out_buffer = SharedBuffer::wrap(std::move(data));
     }
     
     Logger::log_file_op("READ", path, "user", true);
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_edit(OFS_Session session, const std::string& path, const void* data, size_t size, uint64_t index) {
-    return file_delete(session, path) == 0 ? file_create(session, path, data, size) : static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
-}
-
-int file_delete(OFS_Session session, const std::string& path) {
+int file_read_stream(OFS_Session session, const std::string& path,
+                     const std::function<bool(uint64_t size)>& on_open, const ChunkCallback& on_chunk) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
     int validation = PathResolver::validate_path(path);
     if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
     
     uint32_t entry_idx = find_entry_by_path(path, 1);
     if (entry_idx == 0xFFFFFFFF) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
     
-    if (!g_storage->free_entry(entry_idx)) {
-        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    MetadataEntry entry;
+    if (!g_storage->snapshot_entry(entry_idx, &entry) || entry.type != 0) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
-    Logger::log_file_op("DELETE", path, "user", true);
+    // The callbacks write to a client socket and may block for as long as
+    // the client likes, so no lock is held across them. Taking a reference
+    // to the chain under the entry lock keeps it from being freed when the
+    // file is rewritten or deleted meanwhile; the stream sees the content
+    // as it was when it started.
+    uint32_t chain;
+    {
+        std::shared_lock<std::shared_mutex> data_lock(entry_lock(entry_idx));
+        ns_lock.unlock();
+        chain = g_storage->share_chain(entry.start_block);
+    }
+    storage_lock.unlock();
+    
+    bool opened = on_open(entry.total_size);
+    int result = static_cast<int>(opened ? OFSErrorCodes::SUCCESS : OFSErrorCodes::ERROR_IO_ERROR);
+    
+    // Blocks are read as views in batches under the storage lock, which
+    // keeps the container from growing under the reads, and sent after it
+    // is released.
+    uint64_t delivered = 0;
+    uint32_t block = chain;
+    std::vector<SharedBuffer> batch;
+    while (result == static_cast<int>(OFSErrorCodes::SUCCESS) && delivered < entry.total_size) {
+        batch.clear();
+        uint64_t got;
+        {
+            std::shared_lock<std::shared_mutex> read_lock(g_storage_lock);
+            got = g_storage->read_chain_views(entry_idx, chain, &block, entry.total_size - delivered,
+                                              READ_STREAM_BATCH_BLOCKS, &batch);
+        }
+        if (got == 0) result = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+        
+        for (const SharedBuffer& view : batch) {
+            if (!on_chunk(view)) {
+                result = static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+                break;
+            }
+        }
+        delivered += got;
+    }
+    if (opened) Logger::log_file_op("READ", path, "user", result == static_cast<int>(OFSErrorCodes::SUCCESS));
+    
+    if (chain != 0) {
+        std::shared_lock<std::shared_mutex> unpin_lock(g_storage_lock);
+        g_storage->free_block_chain(chain);
+    }
+    return result;
+}
+
+// The upload, if it exists and session began it. With take it is also
+// removed from the table; it still has to be closed by the caller.
+static int find_upload(OFS_Session session, uint64_t upload_id, bool take,
+                       std::shared_ptr<UploadState>* out_upload) {
+    uint32_t user_id = session_user(session);
+    std::lock_guard<std::mutex> lock(g_upload_mutex);
+    auto it = g_uploads.find(upload_id);
+    if (it == g_uploads.end()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (it->second->uploader != user_id) return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    
+    *out_upload = it->second;
+    if (take) g_uploads.erase(it);
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_truncate(OFS_Session session, const std::string& path) {
+// Removes an upload from the table; it still has to be closed by the caller.
+static std::shared_ptr<UploadState> take_upload(uint64_t upload_id) {
+    std::lock_guard<std::mutex> lock(g_upload_mutex);
+    auto it = g_uploads.find(upload_id);
+    if (it == g_uploads.end()) return nullptr;
+    
+    std::shared_ptr<UploadState> upload = it->second;
+    g_uploads.erase(it);
+    return upload;
+}
+
+static void close_upload(const std::shared_ptr<UploadState>& upload) {
+    std::lock_guard<std::mutex> lock(upload->mutex);
+    if (upload->closed) return;
+    upload->closed = true;
+    g_storage->abandon_chain(upload->chain);
+}
+
+static void reap_idle_uploads() {
+    std::vector<std::shared_ptr<UploadState>> idle;
+    time_t now = time(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(g_upload_mutex);
+        for (auto it = g_uploads.begin(); it != g_uploads.end();) {
+            if (now - it->second->last_activity > UPLOAD_IDLE_TIMEOUT) {
+                idle.push_back(it->second);
+                it = g_uploads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    for (auto& upload : idle) {
+        Logger::warn("Upload of " + upload->path + " timed out");
+        close_upload(upload);
+    }
+}
+
+int upload_begin(OFS_Session session, const std::string& path, uint64_t* out_upload_id) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    uint32_t entry_idx = find_entry_by_path(path, 1);
-    if (entry_idx == 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    reap_idle_uploads();
+    
+    auto upload = std::make_shared<UploadState>();
+    upload->uploader = session_user(session);
+    upload->owner = upload->uploader;
+    upload->replaced_size = 0;
+    {
+        std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        if (find_entry_by_path(PathResolver::get_parent(path), 1) == 0xFFFFFFFF) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        }
+        uint32_t existing = find_entry_by_path(path, 1);
+        if (existing != 0xFFFFFFFF) {
+            MetadataEntry* entry = g_storage->get_entry(existing);
+            if (entry->type != 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            upload->owner = entry->owner_id;
+            upload->replaced_size = entry->total_size;
+        } else if (!g_storage->within_quota(upload->owner, 1, 0)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        }
     }
     
-    return g_storage->write_file_data(entry_idx, nullptr, 0) ? 
-           static_cast<int>(OFSErrorCodes::SUCCESS) : 
-           static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    upload->path = path;
+    upload->last_activity = time(nullptr);
+    upload->closed = false;
+    
+    // Ids are unguessable, and below 2^53 so JSON clients can hold them.
+    static std::mt19937_64 rng(std::random_device{}());
+    std::lock_guard<std::mutex> lock(g_upload_mutex);
+    uint64_t upload_id;
+    do {
+        upload_id = rng() & ((1ULL << 53) - 1);
+    } while (upload_id == 0 || g_uploads.count(upload_id));
+    
+    g_uploads[upload_id] = upload;
+    *out_upload_id = upload_id;
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int file_exists(OFS_Session session, const std::string& path) {
+int upload_write(OFS_Session session, uint64_t upload_id, const void* data, size_t size) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_ptr<UploadState> upload;
+    int found = find_upload(session, upload_id, false, &upload);
+    if (found != static_cast<int>(OFSErrorCodes::SUCCESS)) return found;
     
-    return find_entry_by_path(path, 1) != 0xFFFFFFFF ? 
-           static_cast<int>(OFSErrorCodes::SUCCESS) : 
-           static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    int result = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        if (upload->closed) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        
+        upload->last_activity = time(nullptr);
+        
+        // Checked as the blocks are allocated; commit checks again exactly.
+        uint64_t total = upload->chain.size + size;
+        if (total > upload->replaced_size &&
+            !g_storage->within_quota(upload->owner, 0, total - upload->replaced_size)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        } else if (g_storage->append_chain(upload->chain, data, size)) {
+            return static_cast<int>(OFSErrorCodes::SUCCESS);
+        }
+    }
+    
+    if (take_upload(upload_id)) close_upload(upload);
+    return result;
 }
 
-int file_rename(OFS_Session session, const std::string& old_path, const std::string& new_path) {
+int upload_commit(OFS_Session session, uint64_t upload_id, uint64_t* out_size) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_ptr<UploadState> upload;
+    int found = find_upload(session, upload_id, true, &upload);
+    if (found != static_cast<int>(OFSErrorCodes::SUCCESS)) return found;
     
-    uint32_t old_idx = find_entry_by_path(old_path, 1);
-    if (old_idx == 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    
+    uint32_t chain;
+    uint64_t size;
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        if (upload->closed) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        upload->closed = true;
+        
+        size = upload->chain.size;
+        chain = g_storage->finish_chain(upload->chain);
+    }
+    if (chain == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
     }
     
-    if (find_entry_by_path(new_path, 1) != 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    const std::string& path = upload->path;
+    int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    uint32_t entry_idx = 0xFFFFFFFF;
+    bool replaced = false;
+    MetadataEntry before;
+    {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        g_storage->begin_group();
+        
+        uint32_t parent_idx = find_entry_by_path(PathResolver::get_parent(path), 1);
+        entry_idx = find_entry_by_path(path, 1);
+        
+        if (parent_idx == 0xFFFFFFFF) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        } else if (entry_idx != 0xFFFFFFFF) {
+            if (g_storage->get_entry(entry_idx)->type != 0) {
+                result = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            } else if (!rewrite_within_quota(*g_storage->get_entry(entry_idx), size)) {
+                result = static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+            } else {
+                replaced = g_storage->snapshot_entry(entry_idx, &before);
+                g_storage->attach_chain(entry_idx, chain, size);
+                publish_change(ChangeType::WRITE, path, entry_idx);
+            }
+        } else if (!g_storage->within_quota(upload->owner, 1, size)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        } else if ((entry_idx = g_storage->allocate_entry(0, parent_idx, PathResolver::get_filename(path), upload->owner)) == 0xFFFFFFFF) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        } else {
+            g_storage->attach_chain(entry_idx, chain, size);
+            publish_change(ChangeType::CREATE, path, entry_idx);
+        }
+        g_storage->end_group();
     }
     
-    MetadataEntry* entry = g_storage->get_entry(old_idx);
-    std::string new_name = PathResolver::get_filename(new_path);
-    strncpy(entry->name, new_name.c_str(), 31);
-    entry->name[31] = '\0';
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        g_storage->free_block_chain(chain);
+        return result;
+    }
+    if (replaced) retire_content(entry_idx, before);
     
+    if (out_size) *out_size = size;
+    Logger::log_file_op("UPLOAD", path, "user", true);
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int dir_create(OFS_Session session, const std::string& path) {
+int upload_abort(OFS_Session session, uint64_t upload_id) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::shared_ptr<UploadState> upload;
+    int found = find_upload(session, upload_id, true, &upload);
+    if (found != static_cast<int>(OFSErrorCodes::SUCCESS)) return found;
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    close_upload(upload);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int watch_open(OFS_Session session, const std::string& path, bool recursive, uint64_t* out_watch_id) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
     int validation = PathResolver::validate_path(path);
     if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    g_change_bus.reap_idle(WATCH_IDLE_TIMEOUT);
     
-    std::string parent_path = PathResolver::get_parent(path);
-    std::string dirname = PathResolver::get_filename(path);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
     
-    uint32_t parent_idx = find_entry_by_path(parent_path, 1);
-    if (parent_idx == 0xFFFFFFFF) {
+    if (find_entry_by_path(path, 1) == 0xFFFFFFFF) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
     
-    if (find_entry_by_path(path, 1) != 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    // Subscribed under the namespace lock, so no change to path can fall
+    // between the caller's last listing and the first event.
+    *out_watch_id = g_change_bus.subscribe(path, recursive);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int watch_poll(uint64_t watch_id, uint32_t timeout_ms, std::vector<ChangeEvent>* out_events, bool* out_overflow) {
+    if (!g_change_bus.wait(watch_id, timeout_ms, WATCH_COALESCE_MS, out_events, out_overflow)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int watch_close(uint64_t watch_id) {
+    return g_change_bus.unsubscribe(watch_id) ? static_cast<int>(OFSErrorCodes::SUCCESS)
+                                              : static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+int changes_since(OFS_Session session, uint64_t since, size_t limit,
+                  std::vector<ChangeRecord>* out_records, uint64_t* out_last_seq) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    if (!g_storage->has_change_log()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED);
     
-    uint32_t entry_idx = g_storage->allocate_entry(1, parent_idx, dirname, 1);
-    if (entry_idx == 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    *out_records = g_storage->read_changes(since, limit, out_last_seq);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Publishes chain as the new content of the file at path and retires what
+// it replaces. The chain is freed if the file is gone or over quota.
+static int replace_content(const std::string& path, uint32_t chain, uint64_t size) {
+    int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    uint32_t entry_idx;
+    MetadataEntry before;
+    {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        g_storage->begin_group();
+        
+        entry_idx = find_entry_by_path(path, 1);
+        if (entry_idx == 0xFFFFFFFF || !g_storage->snapshot_entry(entry_idx, &before)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        } else if (before.type != 0) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        } else if (!rewrite_within_quota(before, size)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        } else {
+            g_storage->attach_chain(entry_idx, chain, size);
+            publish_change(ChangeType::WRITE, path, entry_idx);
+        }
+        g_storage->end_group();
     }
     
-    Logger::log_file_op("MKDIR", path, "user", true);
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        g_storage->free_block_chain(chain);
+        return result;
+    }
+    retire_content(entry_idx, before);
+    return result;
 }
 
-int dir_list(OFS_Session session, const std::string& path, FileEntry** out_entries, int* out_count) {
+int file_edit(OFS_Session session, const std::string& path, const void* data, size_t size, uint64_t index) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
     int validation = PathResolver::validate_path(path);
     if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
-    
-    uint32_t dir_idx = find_entry_by_path(path, 1);
-    if (dir_idx == 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    uint64_t data_size = data ? size : 0;
+    bool exists;
+    {
+        std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+        std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        
+        uint32_t entry_idx = find_entry_by_path(path, 1);
+        exists = entry_idx != 0xFFFFFFFF;
+        if (exists) {
+            MetadataEntry* entry = g_storage->get_entry(entry_idx);
+            if (entry->type != 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            if (!rewrite_within_quota(*entry, data_size)) return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        }
     }
+    if (!exists) return file_create(session, path, data, size);
     
-    std::vector<uint32_t> children = g_storage->list_children(dir_idx);
-    *out_count = children.size();
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
     
-    if (*out_count == 0) {
-        *out_entries = nullptr;
-        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    uint32_t chain = g_storage->write_chain(data, data_size);
+    if (chain == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    
+    int result = replace_content(path, chain, data_size);
+    if (result == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        Logger::log_file_op("EDIT", path, "user", true);
     }
+    return result;
+}
+
+int file_delete(OFS_Session session, const std::string& path) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    *out_entries = new FileEntry[*out_count];
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
     
-    for (int i = 0; i < *out_count; i++) {
-        MetadataEntry* entry = g_storage->get_entry(children[i]);
-        if (entry) {
-            strncpy((*out_entries)[i].name, entry->name, sizeof((*out_entries)[i].name));
-            (*out_entries)[i].type = entry->type;
-            (*out_entries)[i].size = entry->total_size;
-            (*out_entries)[i].permissions = entry->permissions;
-            (*out_entries)[i].created_time = entry->created_time;
-            (*out_entries)[i].modified_time = entry->modified_time;
-            (*out_entries)[i].inode = children[i];
+    uint32_t entry_idx;
+    MetadataEntry before;
+    {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        
+        entry_idx = find_entry_by_path(path, 1);
+        if (entry_idx == 0xFFFFFFFF || !g_storage->snapshot_entry(entry_idx, &before)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
         }
+        publish_change(ChangeType::DELETE, path, entry_idx);
+        g_storage->detach_entry(entry_idx);
     }
+    retire_content(entry_idx, before);
     
-    Logger::log_file_op("LISTDIR", path, "user", true);
+    Logger::log_file_op("DELETE", path, "user", true);
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int dir_delete(OFS_Session session, const std::string& path) {
+int file_truncate(OFS_Session session, const std::string& path) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    uint32_t dir_idx = find_entry_by_path(path, 1);
-    if (dir_idx == 0xFFFFFFFF) {
-        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
-    }
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
     
-    std::vector<uint32_t> children = g_storage->list_children(dir_idx);
-    if (!children.empty()) {
-        return static_cast<int>(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+    // Exclusive, as in replace_content(): two truncates of one file must not
+    // both snapshot the same chain and retire it twice.
+    uint32_t entry_idx;
+    MetadataEntry before;
+    int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        g_storage->begin_group();
+        
+        entry_idx = find_entry_by_path(path, 1);
+        if (entry_idx == 0xFFFFFFFF || !g_storage->snapshot_entry(entry_idx, &before)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        } else if (before.type != 0) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        } else {
+            g_storage->attach_chain(entry_idx, 0, 0);
+            publish_change(ChangeType::WRITE, path, entry_idx);
+        }
+        g_storage->end_group();
     }
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) return result;
+    retire_content(entry_idx, before);
     
-    return g_storage->free_entry(dir_idx) ? 
-           static_cast<int>(OFSErrorCodes::SUCCESS) : 
-           static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
-}
-
-int dir_exists(OFS_Session session, const std::string& path) {
-    return file_exists(session, path);
-}
-
-void free_buffer(void* buffer) {
-    delete[] (char*)buffer;
+    return result;
 }
 
-int get_metadata(OFS_Session session, const std::string& path, FileMetadata* metadata) {
+int file_versions(OFS_Session session, const std::string& path, std::vector<VersionRecord>* out_versions) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    if (!g_storage->has_versions()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
     
     uint32_t entry_idx = find_entry_by_path(path, 1);
     if (entry_idx == 0xFFFFFFFF) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
+    if (g_storage->get_entry(entry_idx)->type != 0) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    *out_versions = g_storage->list_versions(entry_idx);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int file_version_restore(OFS_Session session, const std::string& path, uint32_t version) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    if (!g_storage->has_versions()) return static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    
+    VersionRecord record;
+    {
+        std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        
+        uint32_t entry_idx = find_entry_by_path(path, 1);
+        if (entry_idx == 0xFFFFFFFF || !g_storage->get_version(entry_idx, version, &record)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        }
+        if (!rewrite_within_quota(*g_storage->get_entry(entry_idx), record.size)) {
+            return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        }
+    }
     
-    MetadataEntry* entry = g_storage->get_entry(entry_idx);
-    if (!entry) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    // The version is copied rather than relinked: its blocks may still
+    // belong to other versions or to the current content.
+    ChainBuilder chain;
+    bool written = true;
+    uint64_t copied = g_storage->stream_version(record, [&chain, &written](const SharedBuffer& data) {
+        written = g_storage->append_chain(chain, data.data(), data.size());
+        return written;
+    });
+    if (!written || copied != record.size) {
+        g_storage->abandon_chain(chain);
+        return written ? static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND)
+                       : static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
     
-    strncpy(metadata->path, path.c_str(), sizeof(metadata->path));
-    strncpy(metadata->entry.name, entry->name, sizeof(metadata->entry.name));
-    metadata->entry.type = entry->type;
-    metadata->entry.size = entry->total_size;
-    metadata->entry.permissions = entry->permissions;
-    metadata->entry.created_time = entry->created_time;
-    metadata->entry.modified_time = entry->modified_time;
+    uint32_t first_block = g_storage->finish_chain(chain);
+    if (first_block == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
     
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    int result = replace_content(path, first_block, record.size);
+    if (result == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        Logger::log_file_op("RESTORE", path + " v" + std::to_string(version), "user", true);
+    }
+    return result;
 }
 
-int set_permissions(OFS_Session session, const std::string& path, uint32_t permissions) {
+int file_exists(OFS_Session session, const std::string& path) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
     
-    uint32_t entry_idx = find_entry_by_path(path, 1);
-    if (entry_idx == 0xFFFFFFFF) {
+    return find_entry_by_path(path, 1) != 0xFFFFFFFF ? 
+           static_cast<int>(OFSErrorCodes::SUCCESS) : 
+           static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+// Re-parents and renames entry_idx in one metadata update, so readers
+// resolve either the old path or the new one. Caller holds the namespace
+// lock exclusively and has checked that new_path is free.
+static int move_entry(uint32_t entry_idx, const std::string& new_path) {
+    if (entry_idx == 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    
+    uint32_t parent_idx = find_entry_by_path(PathResolver::get_parent(new_path), 1);
+    if (parent_idx == 0xFFFFFFFF) {
         return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
     }
+    if (g_storage->get_entry(parent_idx)->type != 1) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
     
-    MetadataEntry* entry = g_storage->get_entry(entry_idx);
-    if (entry) {
-        entry->permissions = permissions;
-        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    // A directory cannot be moved below itself.
+    for (uint32_t ancestor = parent_idx; ancestor != 0; ancestor = g_storage->get_entry(ancestor)->parent_index) {
+        if (ancestor == entry_idx) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
     
-    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    std::string new_name = PathResolver::get_filename(new_path);
+    g_storage->update_entry(entry_idx, [&](MetadataEntry& entry) {
+        strncpy(entry.name, new_name.c_str(), 31);
+        entry.name[31] = '\0';
+        entry.parent_index = parent_idx;
+        entry.modified_time = time(nullptr);
+    });
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-int get_stats(OFS_Session session, FSStats* stats) {
+int file_rename(OFS_Session session, const std::string& old_path, const std::string& new_path) {
     if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     
-    std::lock_guard<std::mutex> lock(g_storage_mutex);
+    int validation = PathResolver::validate_path(old_path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    validation = PathResolver::validate_path(new_path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
     
-    stats->free_space = g_storage->get_free_space();
-    stats->used_space = g_storage->get_used_blocks() * 65536;
-    stats->total_size = g_storage->get_total_blocks() * 65536;
-    stats->total_files = 0;
-    stats->total_directories = 0;
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
     
-    return static_cast<int>(OFSErrorCodes::SUCCESS);
+    uint32_t old_idx = find_entry_by_path(old_path, 1);
+    if (old_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (find_entry_by_path(new_path, 1) != 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    }
+    
+    int result = move_entry(old_idx, new_path);
+    if (result == static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        publish_change(ChangeType::RENAME, new_path, old_idx, old_path);
+        Logger::log_file_op("RENAME", old_path + " -> " + new_path, "user", true);
+    }
+    return result;
+}
+
+// How an entry looked before a batch touched it.
+struct BatchUndo {
+    uint32_t entry_idx;
+    bool existed;
+    MetadataEntry saved;
+};
+
+struct BatchState {
+    std::vector<BatchUndo> undo;
+    std::vector<BatchUndo> released;                        // contents replaced or deleted
+    std::vector<ChangeEvent> changes;                       // published unless rolled back
+    std::vector<ChangeRecord> records;                      // logged with changes
+};
+
+static void batch_change(BatchState& state, ChangeType type, const std::string& path, uint32_t entry_idx,
+                         const std::string& old_path = "") {
+    MetadataEntry entry;
+    if (g_storage->snapshot_entry(entry_idx, &entry)) {
+        state.changes.push_back(make_change(type, path, entry_idx, entry, old_path));
+        state.records.push_back(make_record(type, entry_idx, entry));
+    }
+}
+
+static void batch_save(BatchState& state, uint32_t entry_idx, bool existed) {
+    BatchUndo undo;
+    undo.entry_idx = entry_idx;
+    undo.existed = existed;
+    if (existed) g_storage->snapshot_entry(entry_idx, &undo.saved);
+    state.undo.push_back(undo);
+}
+
+// Applies one op, publishing its pre-written chain if it has one. Contents
+// it replaces are queued in state.released rather than retired, so a
+// rollback can still restore them. New entries belong to owner. Caller holds the
+// namespace lock exclusively.
+static int batch_apply(const BatchOp& op, uint32_t chain, uint32_t owner, BatchState& state) {
+    int validation = PathResolver::validate_path(op.path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    uint32_t entry_idx = find_entry_by_path(op.path, 1);
+    
+    switch (op.type) {
+    case BatchOpType::CREATE:
+    case BatchOpType::WRITE:
+    case BatchOpType::MKDIR: {
+        if (entry_idx != 0xFFFFFFFF) {
+            if (op.type != BatchOpType::WRITE) return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+            if (g_storage->get_entry(entry_idx)->type != 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            if (!rewrite_within_quota(*g_storage->get_entry(entry_idx), op.data.size())) return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+            
+            batch_save(state, entry_idx, true);
+            state.released.push_back(state.undo.back());
+            g_storage->attach_chain(entry_idx, chain, op.data.size());
+            batch_change(state, ChangeType::WRITE, op.path, entry_idx);
+            return static_cast<int>(OFSErrorCodes::SUCCESS);
+        }
+        
+        uint32_t parent_idx = find_entry_by_path(PathResolver::get_parent(op.path), 1);
+        if (parent_idx == 0xFFFFFFFF) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        
+        uint8_t type = op.type == BatchOpType::MKDIR ? 1 : 0;
+        if (!g_storage->within_quota(owner, 1, type == 0 ? op.data.size() : 0)) return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+        entry_idx = g_storage->allocate_entry(type, parent_idx, PathResolver::get_filename(op.path), owner);
+        if (entry_idx == 0xFFFFFFFF) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        
+        batch_save(state, entry_idx, false);
+        if (type == 0) g_storage->attach_chain(entry_idx, chain, op.data.size());
+        batch_change(state, ChangeType::CREATE, op.path, entry_idx);
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    
+    case BatchOpType::DELETE:
+        if (entry_idx == 0xFFFFFFFF) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        if (entry_idx == 0) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        if (g_storage->get_entry(entry_idx)->type == 1 && !g_storage->list_children(entry_idx).empty()) {
+            return static_cast<int>(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+        }
+        
+        batch_save(state, entry_idx, true);
+        state.released.push_back(state.undo.back());
+        batch_change(state, ChangeType::DELETE, op.path, entry_idx);
+        g_storage->detach_entry(entry_idx);
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    
+    case BatchOpType::RENAME: {
+        validation = PathResolver::validate_path(op.new_path);
+        if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+        if (entry_idx == 0xFFFFFFFF) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        if (find_entry_by_path(op.new_path, 1) != 0xFFFFFFFF) return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+        
+        batch_save(state, entry_idx, true);
+        int result = move_entry(entry_idx, op.new_path);
+        if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) state.undo.pop_back();
+        else batch_change(state, ChangeType::RENAME, op.new_path, entry_idx, op.path);
+        return result;
+    }
+    }
+    
+    return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+}
+
+static void batch_rollback(BatchState& state) {
+    for (auto it = state.undo.rbegin(); it != state.undo.rend(); ++it) {
+        if (it->existed) {
+            g_storage->restore_entry(it->entry_idx, it->saved);
+        } else {
+            g_storage->detach_entry(it->entry_idx);
+        }
+    }
+    state.released.clear();
+    state.changes.clear();
+    state.records.clear();
+}
+
+int file_batch(OFS_Session session, const std::vector<BatchOp>& ops, bool atomic, std::vector<int>* results) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    const int not_run = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    results->assign(ops.size(), not_run);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    
+    // As in file_create(), contents are written before the namespace lock
+    // is taken.
+    std::vector<uint32_t> chains(ops.size(), 0);
+    std::vector<int> write_errors(ops.size(), 0);
+    bool failed = false;
+    
+    for (size_t i = 0; i < ops.size() && !(atomic && failed); i++) {
+        if (ops[i].type != BatchOpType::CREATE && ops[i].type != BatchOpType::WRITE) continue;
+        
+        chains[i] = g_storage->write_chain(ops[i].data.data(), ops[i].data.size());
+        if (chains[i] == 0xFFFFFFFF) {
+            chains[i] = 0;
+            write_errors[i] = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+            failed = true;
+        }
+    }
+    if (atomic && failed) {
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (write_errors[i] != 0) (*results)[i] = write_errors[i];
+        }
+    }
+    
+    BatchState state;
+    uint32_t owner = session_user(session);
+    if (!(atomic && failed)) {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        g_storage->begin_group();
+        
+        for (size_t i = 0; i < ops.size(); i++) {
+            int result = write_errors[i] != 0 ? write_errors[i] : batch_apply(ops[i], chains[i], owner, state);
+            (*results)[i] = result;
+            
+            if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+                failed = true;
+                if (atomic) break;
+            }
+        }
+        
+        if (atomic && failed) batch_rollback(state);
+        for (size_t i = 0; i < state.changes.size(); i++) {
+            state.changes[i].seq = g_storage->log_change(state.records[i]);
+            g_change_bus.publish(state.changes[i]);
+        }
+        g_storage->end_group();
+    }
+    
+    // Chains that were never published can be freed directly.
+    bool rolled_back = atomic && failed;
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (chains[i] != 0 && (rolled_back || (*results)[i] != static_cast<int>(OFSErrorCodes::SUCCESS))) {
+            g_storage->free_block_chain(chains[i]);
+        }
+    }
+    for (const BatchUndo& released : state.released) {
+        retire_content(released.entry_idx, released.saved);
+    }
+    
+    Logger::log_file_op("BATCH", std::to_string(ops.size()) + " ops", "user", !failed);
+    
+    for (int result : *results) {
+        if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) return result;
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_create(OFS_Session session, const std::string& path) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    std::string parent_path = PathResolver::get_parent(path);
+    std::string dirname = PathResolver::get_filename(path);
+    
+    uint32_t parent_idx = find_entry_by_path(parent_path, 1);
+    if (parent_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (find_entry_by_path(path, 1) != 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    }
+    
+    uint32_t owner = session_user(session);
+    if (!g_storage->within_quota(owner, 1, 0)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+    }
+    
+    uint32_t entry_idx = g_storage->allocate_entry(1, parent_idx, dirname, owner);
+    if (entry_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    publish_change(ChangeType::CREATE, path, entry_idx);
+    
+    Logger::log_file_op("MKDIR", path, "user", true);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_list(OFS_Session session, const std::string& path, std::vector<FileEntry>* out_entries) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t dir_idx = find_entry_by_path(path, 1);
+    if (dir_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    std::vector<uint32_t> children = g_storage->list_children(dir_idx);
+    out_entries->clear();
+    out_entries->reserve(children.size());
+    
+    for (uint32_t child : children) {
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(child, &entry)) continue;
+        
+        FileEntry file;
+        memset(&file, 0, sizeof(file));
+        copy_entry_name(file.name, entry);
+        file.type = entry.type;
+        file.size = entry.total_size;
+        file.permissions = entry.permissions;
+        file.created_time = entry.created_time;
+        file.modified_time = entry.modified_time;
+        strncpy(file.owner, get_user_name(entry.owner_id).c_str(), sizeof(file.owner) - 1);
+        file.inode = child;
+        out_entries->push_back(file);
+    }
+    
+    Logger::log_file_op("LISTDIR", path, "user", true);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Position of an entry in a listing order. Names are unique within a
+// directory, so (value, name) is a total order.
+struct DirSortPosition {
+    uint64_t value;
+    std::string name;
+};
+
+static DirSortPosition sort_position(const MetadataEntry& entry, DirSortKey sort) {
+    DirSortPosition position;
+    position.value = sort == DirSortKey::SIZE ? entry.total_size :
+                     sort == DirSortKey::MODIFIED ? entry.modified_time : 0;
+    position.name = entry.name;
+    return position;
+}
+
+// Cursors are the hex form of "value:name", opaque to clients.
+static std::string encode_cursor(const DirSortPosition& position) {
+    static const char digits[] = "0123456789abcdef";
+    std::string raw = std::to_string(position.value) + ":" + position.name;
+    std::string cursor;
+    for (unsigned char c : raw) {
+        cursor += digits[c >> 4];
+        cursor += digits[c & 0xF];
+    }
+    return cursor;
+}
+
+static bool decode_cursor(const std::string& cursor, DirSortPosition* position) {
+    if (cursor.size() % 2 != 0) return false;
+    
+    std::string raw;
+    for (size_t i = 0; i < cursor.size(); i += 2) {
+        char* end;
+        std::string byte = cursor.substr(i, 2);
+        long value = strtol(byte.c_str(), &end, 16);
+        if (*end != '\0') return false;
+        raw += (char)value;
+    }
+    
+    size_t colon = raw.find(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    position->value = strtoull(raw.substr(0, colon).c_str(), nullptr, 10);
+    position->name = raw.substr(colon + 1);
+    return true;
+}
+
+int dir_list_page(OFS_Session session, const std::string& path, const DirListOptions& options, DirPage* out_page) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    DirSortPosition cursor;
+    bool has_cursor = !options.cursor.empty();
+    if (has_cursor && !decode_cursor(options.cursor, &cursor)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    auto before = [&options](const DirSortPosition& a, const DirSortPosition& b) {
+        bool less = a.value != b.value ? a.value < b.value : a.name < b.name;
+        bool greater = a.value != b.value ? a.value > b.value : a.name > b.name;
+        return options.descending ? greater : less;
+    };
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t dir_idx = find_entry_by_path(path, 1);
+    if (dir_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    // The first limit + 1 entries after the cursor, kept in a max-heap so
+    // only one page is ever held; the extra one says whether more follow.
+    typedef std::pair<DirSortPosition, uint32_t> Candidate;
+    auto heap_order = [&before](const Candidate& a, const Candidate& b) { return before(a.first, b.first); };
+    std::vector<Candidate> heap;
+    size_t keep = (size_t)std::max<uint32_t>(options.limit, 1) + 1;
+    
+    for (uint32_t child : g_storage->list_children(dir_idx)) {
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(child, &entry)) continue;
+        if (options.type_filter >= 0 && entry.type != options.type_filter) continue;
+        if (!options.name_filter.empty() && strstr(entry.name, options.name_filter.c_str()) == nullptr) continue;
+        
+        DirSortPosition position = sort_position(entry, options.sort);
+        if (has_cursor && !before(cursor, position)) continue;
+        if (heap.size() == keep && !before(position, heap.front().first)) continue;
+        
+        heap.push_back({position, child});
+        std::push_heap(heap.begin(), heap.end(), heap_order);
+        if (heap.size() > keep) {
+            std::pop_heap(heap.begin(), heap.end(), heap_order);
+            heap.pop_back();
+        }
+    }
+    
+    std::sort_heap(heap.begin(), heap.end(), heap_order);
+    bool more = heap.size() == keep;
+    if (more) heap.pop_back();
+    
+    out_page->entries.clear();
+    out_page->entries.reserve(heap.size());
+    for (const Candidate& candidate : heap) {
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(candidate.second, &entry)) continue;
+        
+        FileEntry file;
+        memset(&file, 0, sizeof(file));
+        copy_entry_name(file.name, entry);
+        file.type = entry.type;
+        file.size = entry.total_size;
+        file.permissions = entry.permissions;
+        file.created_time = entry.created_time;
+        file.modified_time = entry.modified_time;
+        strncpy(file.owner, get_user_name(entry.owner_id).c_str(), sizeof(file.owner) - 1);
+        file.inode = candidate.second;
+        out_page->entries.push_back(file);
+    }
+    out_page->next_cursor = more && !heap.empty() ? encode_cursor(heap.back().first) : "";
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_delete(OFS_Session session, const std::string& path) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t dir_idx = find_entry_by_path(path, 1);
+    if (dir_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    std::vector<uint32_t> children = g_storage->list_children(dir_idx);
+    if (!children.empty()) {
+        return static_cast<int>(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+    }
+    
+    publish_change(ChangeType::DELETE, path, dir_idx);
+    return g_storage->free_entry(dir_idx) ? 
+           static_cast<int>(OFSErrorCodes::SUCCESS) : 
+           static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+}
+
+int dir_exists(OFS_Session session, const std::string& path) {
+    return file_exists(session, path);
+}
+
+// The subtree rooted at root_idx, parents before children. Caller holds the
+// namespace lock.
+static std::vector<uint32_t> collect_subtree(uint32_t root_idx) {
+    std::vector<uint32_t> entries(1, root_idx);
+    for (size_t i = 0; i < entries.size(); i++) {
+        for (uint32_t child : g_storage->list_children(entries[i])) {
+            entries.push_back(child);
+        }
+    }
+    return entries;
+}
+
+int dir_delete_tree(OFS_Session session, const std::string& path, uint32_t* out_removed) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    if (path == "/") return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    
+    std::vector<uint32_t> subtree;
+    std::vector<std::pair<uint32_t, MetadataEntry>> removed;
+    {
+        std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        
+        uint32_t entry_idx = find_entry_by_path(path, 1);
+        if (entry_idx == 0xFFFFFFFF) {
+            return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+        }
+        
+        // One event for the root; watchers below it are told by ancestry.
+        // The change log gets every entry, children first, so the root's
+        // sequence number covers the whole tree.
+        subtree = collect_subtree(entry_idx);
+        for (auto it = subtree.rbegin(); *it != entry_idx; ++it) {
+            log_change(ChangeType::DELETE, *it);
+        }
+        publish_change(ChangeType::DELETE, path, entry_idx);
+        g_storage->begin_group();
+        for (auto it = subtree.rbegin(); it != subtree.rend(); ++it) {
+            MetadataEntry before;
+            if (g_storage->snapshot_entry(*it, &before) && before.type == 0) removed.push_back({*it, before});
+            g_storage->detach_entry(*it);
+        }
+        g_storage->end_group();
+    }
+    
+    g_storage->begin_group();
+    for (const auto& entry : removed) {
+        retire_content(entry.first, entry.second);
+    }
+    g_storage->end_group();
+    
+    if (out_removed) *out_removed = subtree.size();
+    Logger::log_file_op("RMTREE", path, "user", true);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_copy_tree(OFS_Session session, const std::string& src_path, const std::string& dst_path, uint32_t* out_copied) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(src_path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    validation = PathResolver::validate_path(dst_path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    if (dst_path == src_path || dst_path.compare(0, src_path.size() + 1, src_path + "/") == 0 || src_path == "/") {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t src_idx = find_entry_by_path(src_path, 1);
+    if (src_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    if (find_entry_by_path(dst_path, 1) != 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_FILE_EXISTS);
+    }
+    uint32_t dst_parent = find_entry_by_path(PathResolver::get_parent(dst_path), 1);
+    if (dst_parent == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    // Breadth first: each source entry paired with the parent of its copy.
+    // The copies belong to, and are charged to, whoever makes them.
+    std::vector<std::pair<uint32_t, uint32_t>> pending(1, {src_idx, dst_parent});
+    std::vector<uint32_t> created;
+    uint32_t owner = session_user(session);
+    int result = static_cast<int>(OFSErrorCodes::SUCCESS);
+    
+    g_storage->begin_group();
+    for (size_t i = 0; i < pending.size(); i++) {
+        MetadataEntry source;
+        if (!g_storage->snapshot_entry(pending[i].first, &source)) continue;
+        
+        std::string name = i == 0 ? PathResolver::get_filename(dst_path) : std::string(source.name);
+        if (!g_storage->within_quota(owner, 1, source.type == 0 ? source.total_size : 0)) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_QUOTA_EXCEEDED);
+            break;
+        }
+        uint32_t copy_idx = g_storage->allocate_entry(source.type, pending[i].second, name, owner);
+        if (copy_idx == 0xFFFFFFFF) {
+            result = static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+            break;
+        }
+        created.push_back(copy_idx);
+        
+        g_storage->update_entry(copy_idx, [&](MetadataEntry& entry) {
+            entry.permissions = source.permissions;
+        });
+        
+        if (source.type == 0) {
+            g_storage->attach_chain(copy_idx, g_storage->share_chain(source.start_block), source.total_size);
+        } else {
+            for (uint32_t child : g_storage->list_children(pending[i].first)) {
+                pending.push_back({child, copy_idx});
+            }
+        }
+    }
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) {
+        // The copies were never visible, so their references can go at once.
+        for (auto it = created.rbegin(); it != created.rend(); ++it) {
+            g_storage->free_block_chain(g_storage->detach_entry(*it));
+        }
+    } else {
+        publish_change(ChangeType::CREATE, dst_path, created.front());
+        for (size_t i = 1; i < created.size(); i++) {
+            log_change(ChangeType::CREATE, created[i]);
+        }
+    }
+    g_storage->end_group();
+    
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) return result;
+    
+    if (out_copied) *out_copied = created.size();
+    Logger::log_file_op("COPYTREE", src_path + " -> " + dst_path, "user", true);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int dir_usage(OFS_Session session, const std::string& path, TreeUsage* out_usage) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    int validation = PathResolver::validate_path(path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t entry_idx = find_entry_by_path(path, 1);
+    if (entry_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    const uint64_t payload = BLOCK_SIZE - sizeof(BlockHeader);
+    std::set<uint32_t> chains;
+    *out_usage = TreeUsage();
+    
+    for (uint32_t idx : collect_subtree(entry_idx)) {
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(idx, &entry)) continue;
+        
+        if (entry.type == 1) {
+            out_usage->directories++;
+            continue;
+        }
+        
+        out_usage->files++;
+        out_usage->bytes += entry.total_size;
+        if (entry.start_block != 0 && chains.insert(entry.start_block).second) {
+            out_usage->blocks += (entry.total_size + payload - 1) / payload;
+        }
+    }
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+// Rebuilds an entry's path by walking parent links up to the root. Caller
+// holds the namespace lock. Sets *in_scope when scope_idx is an ancestor.
+static std::string entry_path(uint32_t entry_idx, uint32_t scope_idx, bool* in_scope) {
+    std::vector<std::string> parts;
+    *in_scope = scope_idx == 0;
+    
+    uint32_t current = entry_idx;
+    for (size_t depth = 0; current != 0 && depth < MAX_METADATA_ENTRIES; depth++) {
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(current, &entry)) return "";
+        parts.push_back(entry.name);
+        current = entry.parent_index;
+        if (current == scope_idx) *in_scope = true;
+    }
+    if (current != 0) return "";
+    
+    std::string path;
+    for (auto it = parts.rbegin(); it != parts.rend(); ++it) {
+        path += "/" + *it;
+    }
+    return path.empty() ? "/" : path;
+}
+
+int file_search(OFS_Session session, const std::string& pattern, const std::string& scope_path,
+                uint32_t limit, std::vector<SearchHit>* out_hits) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    if (pattern.empty()) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    
+    int validation = PathResolver::validate_path(scope_path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t scope_idx = find_entry_by_path(scope_path, 1);
+    if (scope_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    // Scoped queries may discard matches, so only the unscoped one can stop
+    // the index early.
+    size_t wanted = std::max<uint32_t>(limit, 1);
+    std::vector<uint32_t> matches = g_storage->search_names(pattern, scope_idx == 0 ? wanted : SIZE_MAX);
+    
+    out_hits->clear();
+    for (uint32_t idx : matches) {
+        if (out_hits->size() == wanted) break;
+        
+        bool in_scope = false;
+        std::string path = entry_path(idx, scope_idx, &in_scope);
+        if (path.empty() || !in_scope) continue;
+        
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(idx, &entry)) continue;
+        
+        SearchHit hit;
+        hit.path = path;
+        hit.score = 0;
+        memset(&hit.entry, 0, sizeof(hit.entry));
+        strncpy(hit.entry.name, entry.name, sizeof(hit.entry.name) - 1);
+        hit.entry.type = entry.type;
+        hit.entry.size = entry.total_size;
+        hit.entry.permissions = entry.permissions;
+        hit.entry.created_time = entry.created_time;
+        hit.entry.modified_time = entry.modified_time;
+        strncpy(hit.entry.owner, get_user_name(entry.owner_id).c_str(), sizeof(hit.entry.owner) - 1);
+        hit.entry.inode = idx;
+        out_hits->push_back(hit);
+    }
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int content_search(OFS_Session session, const std::string& query, const std::string& scope_path,
+                   uint32_t limit, std::vector<SearchHit>* out_hits) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    {
+        std::lock_guard<std::mutex> lock(g_index_mutex);
+        if (!g_index_running) return static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED);
+    }
+    
+    int validation = PathResolver::validate_path(scope_path);
+    if (validation != static_cast<int>(OFSErrorCodes::SUCCESS)) return validation;
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t scope_idx = find_entry_by_path(scope_path, 1);
+    if (scope_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    size_t wanted = std::max<uint32_t>(limit, 1);
+    std::vector<ContentHit> matches = g_content_index.search(query, scope_idx == 0 ? wanted : SIZE_MAX);
+    
+    out_hits->clear();
+    for (const ContentHit& match : matches) {
+        if (out_hits->size() == wanted) break;
+        
+        bool in_scope = false;
+        std::string path = entry_path(match.entry_idx, scope_idx, &in_scope);
+        if (path.empty() || !in_scope) continue;
+        
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(match.entry_idx, &entry) || entry.type != 0) continue;
+        
+        SearchHit hit;
+        hit.path = path;
+        hit.score = match.score;
+        memset(&hit.entry, 0, sizeof(hit.entry));
+        strncpy(hit.entry.name, entry.name, sizeof(hit.entry.name) - 1);
+        hit.entry.type = entry.type;
+        hit.entry.size = entry.total_size;
+        hit.entry.permissions = entry.permissions;
+        hit.entry.created_time = entry.created_time;
+        hit.entry.modified_time = entry.modified_time;
+        strncpy(hit.entry.owner, get_user_name(entry.owner_id).c_str(), sizeof(hit.entry.owner) - 1);
+        hit.entry.inode = match.entry_idx;
+        out_hits->push_back(hit);
+    }
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int get_metadata(OFS_Session session, const std::string& path, FileMetadata* metadata) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t entry_idx = find_entry_by_path(path, 1);
+    if (entry_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    MetadataEntry entry;
+    if (!g_storage->snapshot_entry(entry_idx, &entry)) return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    
+    strncpy(metadata->path, path.c_str(), sizeof(metadata->path));
+    strncpy(metadata->entry.name, entry.name, sizeof(metadata->entry.name));
+    metadata->entry.type = entry.type;
+    metadata->entry.size = entry.total_size;
+    metadata->entry.permissions = entry.permissions;
+    metadata->entry.created_time = entry.created_time;
+    metadata->entry.modified_time = entry.modified_time;
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int set_permissions(OFS_Session session, const std::string& path, uint32_t permissions) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    std::unique_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+    
+    uint32_t entry_idx = find_entry_by_path(path, 1);
+    if (entry_idx == 0xFFFFFFFF) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    if (g_storage->update_entry(entry_idx, [permissions](MetadataEntry& entry) {
+            entry.permissions = permissions;
+        })) {
+        publish_change(ChangeType::ATTRIB, path, entry_idx);
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    
+    return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+}
+
+int get_stats(OFS_Session session, FSStats* stats) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    
+    stats->free_space = g_storage->get_free_space();
+    stats->used_space = (uint64_t)g_storage->get_used_blocks() * BLOCK_SIZE;
+    stats->total_size = (uint64_t)g_storage->get_total_blocks() * BLOCK_SIZE;
+    stats->total_files = 0;
+    stats->total_directories = 0;
+    stats->checksum_errors = g_storage->get_checksum_errors();
+    stats->blocks_verified = g_storage->get_blocks_verified();
+    stats->cache_hits = g_storage->get_cache_hits();
+    stats->cache_misses = g_storage->get_cache_misses();
+    stats->dirty_bytes = g_storage->get_dirty_bytes();
+    stats->flushes = g_storage->get_flush_count();
+    stats->bytes_copied = g_storage->get_bytes_copied();
+    stats->bytes_shared = g_storage->get_bytes_shared();
+    
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int sync_storage(OFS_Session session) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    // Only the storage lock: the flush is serialized inside OmniStorage, and
+    // nothing else needs to stall for the fsync.
+    std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    if (!g_storage->sync()) {
+        Logger::error("Storage sync failed");
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int grow_storage(OFS_Session session, uint64_t new_total_size) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::unique_lock<std::shared_mutex> storage_lock(g_storage_lock);
+    
+    if (new_total_size <= g_storage->get_total_size()) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    
+    uint32_t old_blocks = g_storage->get_total_blocks();
+    if (!g_storage->grow(new_total_size)) {
+        Logger::error("Container growth to " + std::to_string(new_total_size) + " bytes failed");
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    
+    Logger::info("Container grown from " + std::to_string(old_blocks) + " to " +
+                 std::to_string(g_storage->get_total_blocks()) + " blocks");
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+static void scrub_loop(uint32_t interval_ms, uint32_t batch_size) {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    
+    uint32_t cursor = 0;
+    std::unique_lock<std::mutex> scrub_lock(g_scrub_mutex);
+    
+    while (g_scrub_running) {
+        scrub_lock.unlock();
+        {
+            std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+            uint32_t total = g_storage->get_total_blocks();
+            
+            for (uint32_t i = 0; i < batch_size && total > 0; i++) {
+                cursor = (cursor + 1) % total;
+                if (g_storage->is_block_used(cursor)) {
+                    g_storage->verify_block(cursor);
+                }
+            }
+        }
+        scrub_lock.lock();
+        
+        g_scrub_cv.wait_for(scrub_lock, std::chrono::milliseconds(interval_ms),
+                            [] { return !g_scrub_running; });
+    }
+}
+
+void start_scrubber(uint32_t interval_ms, uint32_t batch_size) {
+    if (!g_storage || batch_size == 0) return;
+    
+    std::lock_guard<std::mutex> lock(g_scrub_mutex);
+    if (g_scrub_running) return;
+    
+    g_scrub_running = true;
+    g_scrub_thread = std::thread(scrub_loop, interval_ms, batch_size);
+    Logger::info("Block scrubber started");
+}
+
+void stop_scrubber() {
+    {
+        std::lock_guard<std::mutex> lock(g_scrub_mutex);
+        if (!g_scrub_running) return;
+        g_scrub_running = false;
+    }
+    g_scrub_cv.notify_all();
+    g_scrub_thread.join();
+    Logger::info("Block scrubber stopped");
+}
+
+// Brings one entry's postings up to date with what is stored now.
+static void refresh_content(uint32_t entry_idx) {
+    std::string text;
+    ContentVersion version;
+    {
+        std::shared_lock<std::shared_mutex> storage_lock(g_storage_lock);
+        std::shared_lock<std::shared_mutex> ns_lock(g_namespace_lock);
+        
+        MetadataEntry entry;
+        if (!g_storage->snapshot_entry(entry_idx, &entry) || entry.type != 0 ||
+            entry.start_block == 0 || entry.total_size > g_index_max_bytes) {
+            g_content_index.remove(entry_idx);
+            return;
+        }
+        
+        version = {entry.start_block, entry.total_size, entry.modified_time};
+        ContentVersion indexed;
+        if (g_content_index.indexed_version(entry_idx, &indexed) && indexed == version) return;
+        
+        std::shared_lock<std::shared_mutex> data_lock(entry_lock(entry_idx));
+        ns_lock.unlock();
+        
+        text.resize(entry.total_size);
+        if (g_storage->read_chain(entry_idx, entry.start_block, &text[0], text.size()) != text.size()) {
+            return;
+        }
+    }
+    
+    // Anything with a NUL near the start is treated as binary.
+    if (text.find('\0', 0) < 8192) {
+        g_content_index.remove(entry_idx);
+        return;
+    }
+    g_content_index.update(entry_idx, version, text);
+}
+
+static void index_loop() {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+    
+    auto last_save = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> index_lock(g_index_mutex);
+    
+    while (g_index_running) {
+        if (!g_index_pending.empty()) {
+            uint32_t entry_idx = *g_index_pending.begin();
+            g_index_pending.erase(g_index_pending.begin());
+            index_lock.unlock();
+            refresh_content(entry_idx);
+            index_lock.lock();
+            continue;
+        }
+        
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_save >= std::chrono::seconds(CONTENT_INDEX_SAVE_INTERVAL) &&
+            g_content_index.has_unsaved_changes()) {
+            index_lock.unlock();
+            g_content_index.save(g_index_path);
+            index_lock.lock();
+            last_save = now;
+            continue;
+        }
+        
+        g_index_cv.wait_for(index_lock, std::chrono::seconds(CONTENT_INDEX_SAVE_INTERVAL),
+                            [] { return !g_index_running || !g_index_pending.empty(); });
+    }
+}
+
+static void queue_content(uint32_t entry_idx) {
+    {
+        std::lock_guard<std::mutex> lock(g_index_mutex);
+        g_index_pending.insert(entry_idx);
+    }
+    g_index_cv.notify_one();
+}
+
+void start_content_index(const std::string& index_path, uint64_t max_file_bytes) {
+    if (!g_storage) return;
+    
+    // Registered first so that nothing written during the reconcile is
+    // missed; the listener only queues, and the queue is drained later.
+    g_storage->set_content_listener(queue_content);
+    
+    std::lock_guard<std::mutex> lock(g_index_mutex);
+    if (g_index_running) return;
+    
+    g_index_path = index_path;
+    g_index_max_bytes = max_file_bytes;
+    if (!g_content_index.load(index_path)) {
+        g_content_index.clear();
+        Logger::info("Content index will be rebuilt");
+    }
+    
+    // Reconcile with the container: every indexed entry and every file is
+    // checked once, and only those whose version changed are read.
+    for (uint32_t entry_idx : g_content_index.documents()) {
+        g_index_pending.insert(entry_idx);
+    }
+    for (uint32_t entry_idx = 1; entry_idx < MAX_METADATA_ENTRIES; entry_idx++) {
+        MetadataEntry entry;
+        if (g_storage->snapshot_entry(entry_idx, &entry) && entry.type == 0 && entry.start_block != 0) {
+            g_index_pending.insert(entry_idx);
+        }
+    }
+    
+    g_index_running = true;
+    g_index_thread = std::thread(index_loop);
+    Logger::info("Content indexer started");
+}
+
+void stop_content_index() {
+    {
+        std::lock_guard<std::mutex> lock(g_index_mutex);
+        if (!g_index_running) return;
+        g_index_running = false;
+    }
+    g_storage->set_content_listener(nullptr);
+    g_index_cv.notify_all();
+    g_index_thread.join();
+    g_content_index.save(g_index_path);
+    Logger::info("Content indexer stopped");
 }
 
 const char* get_error_message(int error_code) {
@@ -362,6 +1895,7 @@ const char* get_error_message(int error_code) {
         case OFSErrorCodes::ERROR_NO_SPACE: return "No space";
         case OFSErrorCodes::ERROR_INVALID_CONFIG: return "Invalid config";
         case OFSErrorCodes::ERROR_NOT_IMPLEMENTED: return "Not implemented";
+        case OFSErrorCodes::ERROR_QUOTA_EXCEEDED: return "Quota exceeded";
         case OFSErrorCodes::ERROR_INVALID_SESSION: return "Invalid session";
         case OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY: return "Directory not empty";
         case OFSErrorCodes::ERROR_INVALID_OPERATION: return "Invalid operation";
@@ -3,7 +3,25 @@
 #include "logger.hpp"
 #include <fstream>
 #include <cstring>
+#include <cerrno>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+static bool write_region(int fd, uint64_t offset, const void* data, uint64_t size) {
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, ptr, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
 
 int fs_format(const std::string& omni_path, const std::string& config_path) {
     Logger::info("Formatting OFS file: " + omni_path);
@@ -22,13 +40,16 @@ int fs_format(const std::string& omni_path, const std::string& config_path) {
     uint64_t block_size = ConfigParser::get_uint("filesystem", "block_size", 4096);
     uint32_t max_users = ConfigParser::get_uint("filesystem", "max_users", 50);
     
-    std::ofstream file(omni_path, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) {
+    bool preallocate = ConfigParser::get_bool("filesystem", "preallocate", false);
+    
+    int fd = open(omni_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         Logger::error("Failed to create omni file: " + omni_path);
         return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
     
     OMNIHeader header;
+    std::memset(&header, 0, sizeof(header));
     std::memcpy(header.magic, "OMNIFS01", 8);
     header.format_version = 0x00010000;
     header.total_size = total_size;
@@ -37,66 +58,65 @@ int fs_format(const std::string& omni_path, const std::string& config_path) {
     header.max_users = max_users;
     header.user_table_offset = 512;
     
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t user_table_size = max_users * sizeof(UserInfo);
+    uint64_t metadata_area_size = 1024 * 1024;
+    uint64_t tables_end = header.header_size + user_table_size + metadata_area_size;
+    if (total_size <= tables_end) {
+        Logger::error("total_size too small for the system tables");
+        close(fd);
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_CONFIG);
+    }
+    uint64_t num_blocks = (total_size - tables_end) / block_size;
     
-    if (file.fail()) {
-        Logger::error("Failed to write header to omni file");
-        file.close();
+    // Size the file first so everything past the tables is a hole (or, with
+    // preallocate, reserved without being written).
+    bool sized = false;
+    if (preallocate) {
+        sized = fallocate(fd, 0, 0, total_size) == 0;
+    }
+    if (!sized && ftruncate(fd, total_size) != 0) {
+        Logger::error("Failed to size omni file to " + std::to_string(total_size) + " bytes");
+        close(fd);
         return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
     
-    uint64_t user_table_size = max_users * sizeof(UserInfo);
-    char* user_table = new char[user_table_size];
-    std::memset(user_table, 0, user_table_size);
+    if (!write_region(fd, 0, &header, sizeof(header))) {
+        Logger::error("Failed to write header to omni file");
+        close(fd);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    }
     
-    file.write(user_table, user_table_size);
-    delete[] user_table;
+    // The empty tables are written explicitly, each as a single write, so
+    // they are allocated up front and stay contiguous on disk.
+    std::vector<char> zeros(std::max(std::max(user_table_size, num_blocks), metadata_area_size), 0);
+    uint64_t offset = header.header_size;
     
-    if (file.fail()) {
+    if (!write_region(fd, offset, zeros.data(), user_table_size)) {
         Logger::error("Failed to write user table");
-        file.close();
+        close(fd);
         return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
+    offset += user_table_size;
     
-    uint64_t metadata_area_size = 1024 * 1024;
-    uint64_t num_blocks = (total_size - header.header_size - user_table_size - metadata_area_size) / block_size;
-    
-    char* bitmap = new char[num_blocks];
-    std::memset(bitmap, 0, num_blocks);
-    
-    file.write(bitmap, num_blocks);
-    delete[] bitmap;
-    
-    if (file.fail()) {
+    if (!write_region(fd, offset, zeros.data(), num_blocks)) {
         Logger::error("Failed to write bitmap");
-        file.close();
+        close(fd);
         return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
+    offset += num_blocks;
     
-    char* metadata = new char[metadata_area_size];
-    std::memset(metadata, 0, metadata_area_size);
-    
-    file.write(metadata, metadata_area_size);
-    delete[] metadata;
-    
-    if (file.fail()) {
+    if (!write_region(fd, offset, zeros.data(), metadata_area_size)) {
         Logger::error("Failed to write metadata area");
-        file.close();
+        close(fd);
         return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
     
-    char* padding = new char[65536];
-    std::memset(padding, 0, 65536);
-    
-    uint64_t written = header.header_size + user_table_size + num_blocks + metadata_area_size;
-    while (written < total_size && file.good()) {
-        uint64_t to_write = std::min(static_cast<uint64_t>(65536), total_size - written);
-        file.write(padding, to_write);
-        written += to_write;
+    if (fsync(fd) != 0) {
+        Logger::error("Failed to sync omni file");
+        close(fd);
+        return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
     }
-    
-    delete[] padding;
-    file.close();
+    close(fd);
     
     Logger::info("OFS file formatted successfully");
     return static_cast<int>(OFSErrorCodes::SUCCESS);
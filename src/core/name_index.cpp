@@ -0,0 +1,153 @@
+#include "name_index.hpp"
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <fnmatch.h>
+
+static std::string lowered(const std::string& str) {
+    std::string result = str;
+    std::transform(result.begin(), result.end(), result.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return result;
+}
+
+std::vector<uint32_t> NameIndex::trigrams(const std::string& lowered) {
+    std::vector<uint32_t> grams;
+    for (size_t i = 0; i + 3 <= lowered.size(); i++) {
+        grams.push_back((uint8_t)lowered[i] << 16 | (uint8_t)lowered[i + 1] << 8 | (uint8_t)lowered[i + 2]);
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+// The literal stretches of a glob; any match contains each of them.
+std::vector<std::string> NameIndex::literal_runs(const std::string& glob) {
+    std::vector<std::string> runs(1);
+    for (size_t i = 0; i < glob.size(); i++) {
+        char c = glob[i];
+        if (c == '*' || c == '?') {
+            runs.emplace_back();
+        } else if (c == '[') {
+            size_t close = glob.find(']', i + 2);
+            if (close == std::string::npos) break;
+            i = close;
+            runs.emplace_back();
+        } else {
+            if (c == '\\' && i + 1 < glob.size()) c = glob[++i];
+            runs.back() += c;
+        }
+    }
+    return runs;
+}
+
+void NameIndex::insert(uint32_t entry_idx, const std::string& name) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    
+    std::string key = lowered(name);
+    auto existing = names.find(entry_idx);
+    if (existing != names.end()) {
+        if (existing->second == key) return;
+        erase_locked(entry_idx);
+    }
+    
+    for (uint32_t gram : trigrams(key)) {
+        std::vector<uint32_t>& list = postings[gram];
+        list.insert(std::lower_bound(list.begin(), list.end(), entry_idx), entry_idx);
+    }
+    names[entry_idx] = key;
+}
+
+void NameIndex::erase(uint32_t entry_idx) {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    erase_locked(entry_idx);
+}
+
+void NameIndex::erase_locked(uint32_t entry_idx) {
+    auto it = names.find(entry_idx);
+    if (it == names.end()) return;
+    
+    for (uint32_t gram : trigrams(it->second)) {
+        auto list = postings.find(gram);
+        if (list == postings.end()) continue;
+        
+        auto pos = std::lower_bound(list->second.begin(), list->second.end(), entry_idx);
+        if (pos != list->second.end() && *pos == entry_idx) list->second.erase(pos);
+        if (list->second.empty()) postings.erase(list);
+    }
+    names.erase(it);
+}
+
+void NameIndex::clear() {
+    std::unique_lock<std::shared_mutex> lock(index_mutex);
+    names.clear();
+    postings.clear();
+}
+
+size_t NameIndex::size() {
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    return names.size();
+}
+
+// Intersection of the posting lists, smallest first. Caller holds the lock.
+std::vector<uint32_t> NameIndex::candidates(const std::vector<uint32_t>& grams) {
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (uint32_t gram : grams) {
+        auto it = postings.find(gram);
+        if (it == postings.end()) return std::vector<uint32_t>();
+        lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+    
+    std::vector<uint32_t> result = *lists[0];
+    std::vector<uint32_t> next;
+    for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+        next.clear();
+        std::set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(),
+                              std::back_inserter(next));
+        result.swap(next);
+    }
+    return result;
+}
+
+std::vector<uint32_t> NameIndex::search(const std::string& pattern, size_t limit) {
+    std::string query = lowered(pattern);
+    bool glob = query.find_first_of("*?[") != std::string::npos;
+    
+    std::vector<uint32_t> grams;
+    if (glob) {
+        for (const std::string& run : literal_runs(query)) {
+            std::vector<uint32_t> run_grams = trigrams(run);
+            grams.insert(grams.end(), run_grams.begin(), run_grams.end());
+        }
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    } else {
+        grams = trigrams(query);
+    }
+    
+    std::shared_lock<std::shared_mutex> lock(index_mutex);
+    
+    auto matches = [&](const std::string& name) {
+        return glob ? fnmatch(query.c_str(), name.c_str(), 0) == 0
+                    : name.find(query) != std::string::npos;
+    };
+    
+    std::vector<uint32_t> result;
+    if (grams.empty()) {
+        // Too short to index: check every name.
+        for (const auto& entry : names) {
+            if (matches(entry.second)) result.push_back(entry.first);
+        }
+        std::sort(result.begin(), result.end());
+    } else {
+        for (uint32_t entry_idx : candidates(grams)) {
+            if (matches(names.at(entry_idx))) result.push_back(entry_idx);
+            if (result.size() >= limit) break;
+        }
+    }
+    
+    if (result.size() > limit) result.resize(limit);
+    return result;
+}
@@ -1,9 +1,27 @@
 #include "omni_storage.hpp"
+#include "crc32c.hpp"
+#include "logger.hpp"
 #include <cstring>
+#include <algorithm>
+#include <cstddef>
 #include <ctime>
+#include <cerrno>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 
-OmniStorage::OmniStorage() {
+OmniStorage::OmniStorage()
+    : fd(-1), locked_out(false), block_count(0), next_user_id(1), verify_reads(true), checksum_errors(0), blocks_verified(0),
+      bytes_copied(0), bytes_shared(0),
+      readahead_window(8), cache_capacity(256), prefetch_running(false),
+      durability(DurabilityMode::PERIODIC), flush_interval_ms(1000), dirty_limit(16 << 20),
+      dirty_bytes(0), flush_count(0), flusher_running(false), flush_requested(false),
+      preallocate(false), punch_holes(false), version_keep(10), version_max_age(0),
+      last_version_sweep(0), next_change_seq(1) {
     init_encryption_table();
 }
 
@@ -18,11 +36,21 @@ void OmniStorage::init_encryption_table() {
     }
 }
 
-bool OmniStorage::create(const std::string& path, uint64_t total_size) {
+void OmniStorage::set_stripe_dirs(const std::vector<std::string>& dirs) {
+    stripe_dirs = dirs;
+}
+
+bool OmniStorage::create(const std::string& path, uint64_t total_size, uint32_t stripe_count) {
     file_path = path;
     
-    file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
-    if (!file.is_open()) return false;
+    // Truncated only once locked, so a container in use is left alone.
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    if (!lock_container() || ftruncate(fd, 0) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
     
     std::memset(&header, 0, sizeof(header));
     std::memcpy(header.magic, "OMNIFS01", 8);
@@ -32,11 +60,34 @@ bool OmniStorage::create(const std::string& path, uint64_t total_size) {
     header.block_size = BLOCK_SIZE;
     header.max_users = 50;
     header.user_table_offset = 512;
+    header.stripe_count = std::max(stripe_count, 1u);
+    header.feature_flags = FEATURE_CHECKSUMS | FEATURE_USER_ACCOUNTING;
+    
+    header.change_log_offset = get_change_log_base();
+    header.file_state_storage_offset = get_change_log_base() + 2 * CHANGE_LOG_SIZE;
+    header.bitmap_offset = header.file_state_storage_offset + VERSION_TABLE_RECORDS * sizeof(VersionRecord);
+    if (total_size <= header.bitmap_offset + BLOCK_SIZE + 1) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    
+    uint32_t num_blocks = (total_size - header.bitmap_offset) / (BLOCK_SIZE + 1);
+    header.total_blocks = num_blocks;
+    header.block_area_offset = (header.stripe_count > 1) ? 0 : header.bitmap_offset + num_blocks;
     
-    uint32_t num_blocks = (total_size - 512 - 6400 - MAX_METADATA_ENTRIES * METADATA_ENTRY_SIZE) / BLOCK_SIZE;
+    if (header.stripe_count > 1 && !open_stripes(true)) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
     
-    file.write((char*)&header, sizeof(header));
-    file.flush();
+    if (!save_header()) {
+        close_stripes();
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
     
     metadata_cache.resize(MAX_METADATA_ENTRIES);
     for (auto& entry : metadata_cache) {
@@ -53,62 +104,255 @@ bool OmniStorage::create(const std::string& path, uint64_t total_size) {
     metadata_cache[0].created_time = time(nullptr);
     metadata_cache[0].modified_time = time(nullptr);
     
+    // Block 0 doubles as the "no block" marker in entries and chains.
     block_bitmap.resize(num_blocks, 0);
+    block_bitmap[0] = BLOCK_USED;
+    block_count = num_blocks;
     
-    if (!save_metadata()) {
-        file.close();
+    // Only the tables are written; the block area stays a hole until used.
+    if (!save_metadata() || !save_bitmap() || !save_users() || !size_files()) {
+        close_stripes();
+        ::close(fd);
+        fd = -1;
         return false;
     }
-    if (!save_bitmap()) {
-        file.close();
-        return false;
-    }
-    
-    for (int i = 0; i < header.max_users; i++) {
-        UserInfo empty_user;
-        memset(&empty_user, 0, sizeof(empty_user));
-        file.seekp(header.user_table_offset + (i * sizeof(UserInfo)));
-        file.write((char*)&empty_user, sizeof(UserInfo));
-    }
-    file.flush();
     
-    file.close();
+    close_stripes();
+    ::close(fd);
+    fd = -1;
     return open(path);
 }
 
 bool OmniStorage::open(const std::string& path) {
     file_path = path;
-    file.open(path, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file.is_open()) return false;
+    fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) return false;
+    if (!lock_container()) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    
+    if (!load_header() || !load_metadata() || !load_bitmap() || !load_users() || !load_change_log() ||
+        (get_stripe_count() > 1 && !open_stripes(false)) || !load_versions()) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    rebuild_usage();
     
-    if (!load_header()) return false;
-    if (!load_metadata()) return false;
-    if (!load_bitmap()) return false;
-    if (!load_users()) return false;
+    // Chains are mostly laid out in allocation order, so let the kernel read
+    // further ahead on the block area.
+    for (int stripe_fd : stripe_fds) {
+        posix_fadvise(stripe_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (stripe_fds.empty()) {
+        posix_fadvise(fd, header.block_area_offset, 0, POSIX_FADV_SEQUENTIAL);
+    }
     
+    block_cache.set_capacity(cache_capacity);
+    start_prefetcher();
+    start_stripe_readers();
+    start_flusher();
     return true;
 }
 
+// One process at a time may have the container open: the server and the
+// admin tool both rewrite the header, bitmap and tables in place. The lock
+// goes with the descriptor, so close() releases it.
+bool OmniStorage::lock_container() {
+    locked_out = false;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) return true;
+    locked_out = errno == EWOULDBLOCK;
+    return false;
+}
+
 void OmniStorage::close() {
-    if (file.is_open()) {
+    stop_prefetcher();
+    stop_stripe_readers();
+    stop_flusher();
+    block_cache.clear();
+    read_streams.clear();
+    
+    if (fd >= 0) {
+        flush_pending(false);
         save_metadata();
         save_bitmap();
         save_users();
-        file.close();
+        if (durability != DurabilityMode::RELAXED) sync_files();
+        close_stripes();
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool OmniStorage::sync() {
+    return flush_pending(true);
+}
+
+bool OmniStorage::sync_files() {
+    if (fd < 0 || fsync(fd) != 0) return false;
+    for (int stripe_fd : stripe_fds) {
+        if (fsync(stripe_fd) != 0) return false;
+    }
+    return true;
+}
+
+std::string OmniStorage::get_stripe_path(uint32_t stripe) {
+    size_t slash = file_path.find_last_of('/');
+    std::string dir = (slash == std::string::npos) ? "." : file_path.substr(0, slash);
+    std::string name = (slash == std::string::npos) ? file_path : file_path.substr(slash + 1);
+    
+    if (!stripe_dirs.empty()) {
+        dir = stripe_dirs[stripe % stripe_dirs.size()];
+    }
+    return dir + "/" + name + ".stripe" + std::to_string(stripe);
+}
+
+bool OmniStorage::open_stripes(bool truncate) {
+    int flags = O_RDWR | (truncate ? (O_CREAT | O_TRUNC) : 0);
+    
+    for (uint32_t i = 0; i < header.stripe_count; i++) {
+        int stripe_fd = ::open(get_stripe_path(i).c_str(), flags, 0644);
+        if (stripe_fd < 0) {
+            close_stripes();
+            return false;
+        }
+        stripe_fds.push_back(stripe_fd);
+    }
+    return true;
+}
+
+void OmniStorage::close_stripes() {
+    for (int stripe_fd : stripe_fds) {
+        ::close(stripe_fd);
+    }
+    stripe_fds.clear();
+}
+
+static bool extend_file(int target, uint64_t from, uint64_t to, bool preallocate) {
+    if (to <= from) return true;
+    if (preallocate) {
+        if (fallocate(target, 0, from, to - from) == 0) return true;
+        if (errno != EOPNOTSUPP) return false;
+    }
+    return ftruncate(target, to) == 0;
+}
+
+bool OmniStorage::size_files() {
+    if (stripe_fds.empty()) {
+        return extend_file(fd, 0, header.total_size, preallocate);
+    }
+    
+    uint32_t stripes = stripe_fds.size();
+    for (uint32_t i = 0; i < stripes; i++) {
+        uint64_t len = ((block_bitmap.size() + stripes - 1 - i) / stripes) * BLOCK_SIZE;
+        if (!extend_file(stripe_fds[i], 0, len, preallocate)) return false;
+    }
+    return true;
+}
+
+bool OmniStorage::read_at(int target, uint64_t offset, void* buffer, size_t size) {
+    uint8_t* ptr = (uint8_t*)buffer;
+    while (size > 0) {
+        ssize_t n = pread(target, ptr, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool OmniStorage::write_at(int target, uint64_t offset, const void* buffer, size_t size) {
+    const uint8_t* ptr = (const uint8_t*)buffer;
+    while (size > 0) {
+        ssize_t n = pwrite(target, ptr, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool OmniStorage::grow(uint64_t new_total_size) {
+    if (fd < 0 || new_total_size <= header.total_size) return false;
+    
+    // Staged bitmap pages are keyed by the current bitmap offset, which may
+    // become block area below, so drain them first and keep the flusher out.
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+    std::lock_guard<std::mutex> flush_lock(flush_mutex);
+    if (!write_pending(false)) return false;
+    
+    uint32_t stripes = get_stripe_count();
+    uint64_t base = (stripes > 1) ? header.bitmap_offset : header.block_area_offset;
+    
+    uint64_t new_blocks = (new_total_size - base) / (BLOCK_SIZE + 1);
+    if (new_blocks > MAX_BLOCKS) new_blocks = MAX_BLOCKS;
+    if (new_blocks <= block_bitmap.size()) return false;
+    
+    // A striped container keeps its bitmap last in the master file, so it
+    // can grow in place. Otherwise the enlarged bitmap goes past the end of
+    // the enlarged block area and the old copy stays valid until the header
+    // points elsewhere. A grow by fewer bytes than the old bitmap holds would
+    // put the new one on top of it, so it starts after the old one instead,
+    // and a size too small for that is refused.
+    uint64_t new_bitmap_offset;
+    if (stripes > 1) {
+        for (uint32_t i = 0; i < stripes; i++) {
+            uint64_t old_len = ((block_bitmap.size() + stripes - 1 - i) / stripes) * BLOCK_SIZE;
+            uint64_t new_len = ((new_blocks + stripes - 1 - i) / stripes) * BLOCK_SIZE;
+            if (!extend_file(stripe_fds[i], old_len, new_len, preallocate)) return false;
+        }
+        new_bitmap_offset = header.bitmap_offset;
+    } else {
+        new_bitmap_offset = std::max(header.block_area_offset + new_blocks * BLOCK_SIZE,
+                                     header.bitmap_offset + block_bitmap.size());
+        if (new_bitmap_offset + new_blocks > new_total_size) return false;
+        if (!extend_file(fd, header.total_size, new_total_size, preallocate)) return false;
     }
+    
+    std::vector<uint8_t> new_bitmap(block_bitmap);
+    new_bitmap.resize(new_blocks, 0);
+    if (!write_at(fd, new_bitmap_offset, new_bitmap.data(), new_bitmap.size()) || !sync_files()) {
+        return false;
+    }
+    
+    OMNIHeader updated = header;
+    updated.total_size = new_total_size;
+    updated.bitmap_offset = new_bitmap_offset;
+    updated.total_blocks = new_blocks;
+    if (!write_at(fd, 0, &updated, sizeof(updated)) || !sync_files()) {
+        return false;
+    }
+    
+    header = updated;
+    block_bitmap.swap(new_bitmap);
+    block_count = new_blocks;
+    return true;
 }
 
 bool OmniStorage::load_header() {
-    file.seekg(0);
-    file.read((char*)&header, sizeof(header));
-    return file.good() && memcmp(header.magic, "OMNIFS01", 8) == 0;
+    if (!read_at(fd, 0, &header, sizeof(header))) return false;
+    if (memcmp(header.magic, "OMNIFS01", 8) != 0) return false;
+    
+    if (header.bitmap_offset == 0) {
+        derive_legacy_geometry();
+    }
+    return true;
 }
 
 bool OmniStorage::save_header() {
-    file.seekp(0);
-    file.write((char*)&header, sizeof(header));
-    file.flush();
-    return file.good();
+    return write_at(fd, 0, &header, sizeof(header));
+}
+
+void OmniStorage::derive_legacy_geometry() {
+    header.bitmap_offset = get_metadata_offset() + (MAX_METADATA_ENTRIES * METADATA_ENTRY_SIZE);
+    header.total_blocks = (header.total_size - header.bitmap_offset) / BLOCK_SIZE;
+    header.block_area_offset = header.bitmap_offset + header.total_blocks;
 }
 
 uint64_t OmniStorage::get_metadata_offset() {
@@ -116,118 +360,420 @@ uint64_t OmniStorage::get_metadata_offset() {
 }
 
 uint64_t OmniStorage::get_bitmap_offset() {
-    return get_metadata_offset() + (MAX_METADATA_ENTRIES * METADATA_ENTRY_SIZE);
+    return header.bitmap_offset;
 }
 
 uint64_t OmniStorage::get_user_table_offset() {
     return header.user_table_offset;
 }
 
+uint64_t OmniStorage::get_change_log_base() {
+    return get_metadata_offset() + (MAX_METADATA_ENTRIES * METADATA_ENTRY_SIZE);
+}
+
+int OmniStorage::get_block_fd(uint32_t block_idx) {
+    return stripe_fds.empty() ? fd : stripe_fds[block_idx % stripe_fds.size()];
+}
+
 uint64_t OmniStorage::get_block_offset(uint32_t block_idx) {
-    return get_bitmap_offset() + block_bitmap.size() + (block_idx * BLOCK_SIZE);
+    if (!stripe_fds.empty()) {
+        return (uint64_t)(block_idx / stripe_fds.size()) * BLOCK_SIZE;
+    }
+    return header.block_area_offset + ((uint64_t)block_idx * BLOCK_SIZE);
 }
 
 bool OmniStorage::load_metadata() {
     metadata_cache.resize(MAX_METADATA_ENTRIES);
-    file.seekg(get_metadata_offset());
+    if (!read_at(fd, get_metadata_offset(), metadata_cache.data(),
+                 metadata_cache.size() * sizeof(MetadataEntry))) {
+        return false;
+    }
     
-    for (auto& entry : metadata_cache) {
-        file.read((char*)&entry, sizeof(MetadataEntry));
-        if (!file.good()) return false;
+    if (has_checksums()) {
+        for (uint32_t i = 0; i < metadata_cache.size(); i++) {
+            const MetadataEntry& entry = metadata_cache[i];
+            if (entry.valid && entry.checksum != entry_checksum(entry)) {
+                report_checksum_error("metadata entry " + std::to_string(i));
+            }
+        }
     }
+    
+    rebuild_namespace_index();
     return true;
 }
 
-bool OmniStorage::save_metadata() {
-    file.seekp(get_metadata_offset());
+void OmniStorage::rebuild_namespace_index() {
+    child_index.assign(metadata_cache.size(), std::set<uint32_t>());
+    name_index.clear();
+    for (uint32_t i = 0; i < metadata_cache.size(); i++) {
+        index_entry(i);
+    }
     
+    std::map<uint32_t, uint32_t> references;
     for (const auto& entry : metadata_cache) {
-        file.write((char*)&entry, sizeof(MetadataEntry));
+        if (entry.valid && entry.start_block != 0) references[entry.start_block]++;
+    }
+    
+    std::lock_guard<std::mutex> lock(alloc_mutex);
+    shared_chains.clear();
+    for (const auto& ref : references) {
+        if (ref.second > 1) shared_chains[ref.first] = ref.second - 1;
+    }
+}
+
+// Adds an entry to the child and name indexes. Caller holds meta_mutex.
+// The root is its own parent but not its own child, and has no name.
+void OmniStorage::index_entry(uint32_t entry_idx) {
+    const MetadataEntry& entry = metadata_cache[entry_idx];
+    if (entry.valid && entry.parent_index != entry_idx && entry.parent_index < child_index.size()) {
+        child_index[entry.parent_index].insert(entry_idx);
+        name_index.insert(entry_idx, entry.name);
+    }
+}
+
+void OmniStorage::unindex_entry(uint32_t entry_idx) {
+    const MetadataEntry& entry = metadata_cache[entry_idx];
+    if (entry.valid && entry.parent_index < child_index.size()) {
+        child_index[entry.parent_index].erase(entry_idx);
+        name_index.erase(entry_idx);
+    }
+}
+
+bool OmniStorage::save_metadata() {
+    if (has_checksums()) {
+        for (auto& entry : metadata_cache) {
+            if (entry.valid) entry.checksum = entry_checksum(entry);
+        }
     }
-    file.flush();
-    return file.good();
+    
+    return write_at(fd, get_metadata_offset(), metadata_cache.data(),
+                    metadata_cache.size() * sizeof(MetadataEntry));
 }
 
 bool OmniStorage::load_bitmap() {
-    uint32_t num_blocks = (header.total_size - get_bitmap_offset()) / BLOCK_SIZE;
-    block_bitmap.resize(num_blocks, 0);
+    block_bitmap.assign(header.total_blocks, 0);
+    if (!read_at(fd, get_bitmap_offset(), block_bitmap.data(), block_bitmap.size())) return false;
     
-    file.seekg(get_bitmap_offset());
-    file.read((char*)block_bitmap.data(), block_bitmap.size());
-    return file.good();
+    for (uint8_t& state : block_bitmap) {
+        if (state != BLOCK_VERSIONED) state = state ? BLOCK_USED : BLOCK_FREE;
+    }
+    if (!block_bitmap.empty()) block_bitmap[0] = BLOCK_USED;
+    block_count = block_bitmap.size();
+    return true;
 }
 
 bool OmniStorage::save_bitmap() {
-    file.seekp(get_bitmap_offset());
-    file.write((char*)block_bitmap.data(), block_bitmap.size());
-    file.flush();
-    return file.good();
+    return write_at(fd, get_bitmap_offset(), block_bitmap.data(), block_bitmap.size());
+}
+
+// The log ends at the first slot that is empty, torn, or left over from
+// before the last compaction; all of those fail the ascending seq check or
+// the checksum.
+bool OmniStorage::load_change_log() {
+    change_log.clear();
+    next_change_seq = 1;
+    if (header.change_log_offset == 0) return true;
+    
+    std::vector<ChangeRecord> slots(CHANGE_LOG_SIZE / sizeof(ChangeRecord));
+    if (!read_at(fd, header.change_log_offset, slots.data(), slots.size() * sizeof(ChangeRecord))) {
+        return false;
+    }
+    
+    change_log.reserve(slots.size());
+    for (const ChangeRecord& record : slots) {
+        if (record.seq < next_change_seq || record.checksum != record_checksum(record)) break;
+        change_log.push_back(record);
+        next_change_seq = record.seq + 1;
+    }
+    return true;
+}
+
+// Drops records that are torn or whose file is gone, then counts the
+// extents of the rest. Blocks left BLOCK_VERSIONED with nothing listing
+// them, as a crash between the two writes can leave them, are freed.
+bool OmniStorage::load_versions() {
+    version_table.clear();
+    entry_versions.clear();
+    version_refs.clear();
+    if (header.file_state_storage_offset == 0) return true;
+    
+    version_table.resize(VERSION_TABLE_RECORDS);
+    if (!read_at(fd, header.file_state_storage_offset, version_table.data(),
+                 version_table.size() * sizeof(VersionRecord))) {
+        return false;
+    }
+    
+    for (uint32_t slot = 0; slot < version_table.size(); slot++) {
+        VersionRecord& record = version_table[slot];
+        if (!record.valid) continue;
+        
+        bool intact = record.checksum == version_checksum(record);
+        bool live = intact && record.entry < metadata_cache.size() &&
+                    metadata_cache[record.entry].valid && metadata_cache[record.entry].type == 0 &&
+                    metadata_cache[record.entry].generation == record.generation;
+        
+        std::vector<VersionExtent> extents;
+        if (live && read_extents(record, &extents)) {
+            for (const VersionExtent& extent : extents) {
+                if (extent.block >= block_bitmap.size() || block_bitmap[extent.block] == BLOCK_FREE) live = false;
+            }
+        } else {
+            live = false;
+        }
+        
+        if (!live) {
+            if (intact) free_block_chain(record.list_block);
+            memset(&record, 0, sizeof(record));
+            stage_version_page(slot);
+            continue;
+        }
+        
+        for (const VersionExtent& extent : extents) {
+            version_refs[extent.block]++;
+        }
+        entry_versions[record.entry].push_back(slot);
+    }
+    
+    for (auto& pair : entry_versions) {
+        std::sort(pair.second.begin(), pair.second.end(), [this](uint32_t a, uint32_t b) {
+            return version_table[a].version < version_table[b].version;
+        });
+    }
+    
+    for (uint32_t i = 1; i < block_bitmap.size(); i++) {
+        if (block_bitmap[i] == BLOCK_VERSIONED && version_refs.count(i) == 0) {
+            block_bitmap[i] = BLOCK_FREE;
+            stage_bitmap(i);
+        }
+    }
+    return true;
 }
 
 bool OmniStorage::load_users() {
-    file.seekg(get_user_table_offset());
+    std::vector<UserInfo> table(header.max_users);
+    if (!read_at(fd, get_user_table_offset(), table.data(), table.size() * sizeof(UserInfo))) {
+        return true;
+    }
     
-    for (uint32_t i = 0; i < header.max_users; i++) {
-        UserInfo user;
-        file.read((char*)&user, sizeof(UserInfo));
-        if (file.good() && user.is_active) {
+    for (const auto& user : table) {
+        if (user.is_active) {
             user_cache[user.username] = user;
         }
     }
     return true;
 }
 
+// Recounts usage from the metadata, which is one pass at open and keeps
+// the counters right whatever a crash left in the user table. Containers
+// from before accounting have junk in those bytes; their users get ids in
+// creation order, so the first account (normally admin) becomes user 1 and
+// owns everything created while every entry was given owner 1.
+void OmniStorage::rebuild_usage() {
+    std::lock_guard<std::mutex> lock(user_mutex);
+    
+    if ((header.feature_flags & FEATURE_USER_ACCOUNTING) == 0) {
+        std::vector<UserInfo*> users;
+        for (auto& pair : user_cache) {
+            users.push_back(&pair.second);
+        }
+        std::sort(users.begin(), users.end(), [](const UserInfo* a, const UserInfo* b) {
+            if (a->created_time != b->created_time) return a->created_time < b->created_time;
+            return strcmp(a->username, b->username) < 0;
+        });
+        
+        for (size_t i = 0; i < users.size(); i++) {
+            users[i]->reserved[0] = 0;
+            users[i]->user_id = i + 1;
+            users[i]->file_quota = 0;
+            users[i]->byte_quota = 0;
+        }
+        header.feature_flags |= FEATURE_USER_ACCOUNTING;
+        save_header();
+    }
+    
+    user_names.clear();
+    uint32_t max_id = 0;
+    for (auto& pair : user_cache) {
+        pair.second.file_count = 0;
+        pair.second.bytes_used = 0;
+        user_names[pair.second.user_id] = pair.first;
+        max_id = std::max<uint32_t>(max_id, pair.second.user_id);
+    }
+    
+    for (const auto& entry : metadata_cache) {
+        if (!entry.valid) continue;
+        max_id = std::max(max_id, entry.owner_id);
+        
+        auto name = user_names.find(entry.owner_id);
+        if (name == user_names.end()) continue;
+        UserInfo& user = user_cache[name->second];
+        user.file_count++;
+        user.bytes_used += entry.total_size;
+    }
+    
+    // Ids still owning entries are never handed out again.
+    next_user_id = max_id + 1;
+    save_users();
+}
+
+// Moves usage from the entry as it was to the entry as it is. Caller holds
+// meta_mutex.
+void OmniStorage::account_change(const MetadataEntry& before, const MetadataEntry& after) {
+    if (before.valid == after.valid && before.owner_id == after.owner_id &&
+        before.total_size == after.total_size) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(user_mutex);
+    bool changed = false;
+    
+    if (before.valid) {
+        auto name = user_names.find(before.owner_id);
+        if (name != user_names.end()) {
+            UserInfo& user = user_cache[name->second];
+            if (user.file_count > 0) user.file_count--;
+            user.bytes_used -= std::min(user.bytes_used, before.total_size);
+            changed = true;
+        }
+    }
+    if (after.valid) {
+        auto name = user_names.find(after.owner_id);
+        if (name != user_names.end()) {
+            UserInfo& user = user_cache[name->second];
+            user.file_count++;
+            user.bytes_used += after.total_size;
+            changed = true;
+        }
+    }
+    
+    if (changed) save_users();
+}
+
 bool OmniStorage::save_users() {
-    file.seekp(get_user_table_offset());
+    std::vector<UserInfo> table(header.max_users);
+    memset(table.data(), 0, table.size() * sizeof(UserInfo));
     
     uint32_t i = 0;
     for (const auto& pair : user_cache) {
         if (i >= header.max_users) break;
-        file.write((char*)&pair.second, sizeof(UserInfo));
-        i++;
-    }
-    
-    UserInfo empty;
-    memset(&empty, 0, sizeof(UserInfo));
-    while (i < header.max_users) {
-        file.write((char*)&empty, sizeof(UserInfo));
-        i++;
+        table[i++] = pair.second;
     }
     
-    file.flush();
-    return file.good();
+    return stage_write(fd, get_user_table_offset(), table.data(), table.size() * sizeof(UserInfo));
 }
 
 uint32_t OmniStorage::allocate_entry(uint8_t type, uint32_t parent, const std::string& name, uint32_t owner_id) {
-    for (uint32_t i = 0; i < metadata_cache.size(); i++) {
-        if (metadata_cache[i].valid == 0) {
-            metadata_cache[i].valid = 1;
-            metadata_cache[i].type = type;
-            metadata_cache[i].parent_index = parent;
-            strncpy(metadata_cache[i].name, name.c_str(), 31);
-            metadata_cache[i].name[31] = '\0';
-            metadata_cache[i].start_block = 0;
-            metadata_cache[i].total_size = 0;
-            metadata_cache[i].owner_id = owner_id;
-            metadata_cache[i].permissions = (type == 1) ? 0755 : 0644;
-            metadata_cache[i].created_time = time(nullptr);
-            metadata_cache[i].modified_time = time(nullptr);
-            save_metadata();
-            return i;
+    uint32_t found = 0xFFFFFFFF;
+    {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        for (uint32_t i = 0; i < metadata_cache.size(); i++) {
+            if (metadata_cache[i].valid == 0) {
+                MetadataEntry before = metadata_cache[i];
+                metadata_cache[i].valid = 1;
+                metadata_cache[i].generation++;
+                metadata_cache[i].type = type;
+                metadata_cache[i].parent_index = parent;
+                strncpy(metadata_cache[i].name, name.c_str(), 31);
+                metadata_cache[i].name[31] = '\0';
+                metadata_cache[i].start_block = 0;
+                metadata_cache[i].total_size = 0;
+                metadata_cache[i].owner_id = owner_id;
+                metadata_cache[i].permissions = (type == 1) ? 0755 : 0644;
+                metadata_cache[i].created_time = time(nullptr);
+                metadata_cache[i].modified_time = time(nullptr);
+                account_change(before, metadata_cache[i]);
+                index_entry(i);
+                stage_entry(i);
+                found = i;
+                break;
+            }
         }
     }
-    return 0xFFFFFFFF;
+    
+    if (found != 0xFFFFFFFF) commit();
+    return found;
 }
 
 bool OmniStorage::free_entry(uint32_t entry_idx) {
     if (entry_idx >= metadata_cache.size()) return false;
     
-    if (metadata_cache[entry_idx].start_block != 0) {
-        free_block_chain(metadata_cache[entry_idx].start_block);
+    free_block_chain(detach_entry(entry_idx));
+    return commit();
+}
+
+uint32_t OmniStorage::detach_entry(uint32_t entry_idx) {
+    if (entry_idx >= metadata_cache.size()) return 0;
+    
+    uint32_t chain;
+    {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        MetadataEntry before = metadata_cache[entry_idx];
+        chain = before.start_block;
+        unindex_entry(entry_idx);
+        metadata_cache[entry_idx].valid = 0;
+        metadata_cache[entry_idx].start_block = 0;
+        metadata_cache[entry_idx].total_size = 0;
+        account_change(before, metadata_cache[entry_idx]);
+        stage_entry(entry_idx);
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        read_streams.erase(entry_idx);
+    }
+    notify_content(entry_idx);
+    commit();
+    return chain;
+}
+
+bool OmniStorage::restore_entry(uint32_t entry_idx, const MetadataEntry& saved) {
+    if (entry_idx >= metadata_cache.size()) return false;
+    
+    {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        account_change(metadata_cache[entry_idx], saved);
+        unindex_entry(entry_idx);
+        metadata_cache[entry_idx] = saved;
+        index_entry(entry_idx);
+        stage_entry(entry_idx);
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        read_streams.erase(entry_idx);
+    }
+    notify_content(entry_idx);
+    return commit();
+}
+
+bool OmniStorage::update_entry(uint32_t entry_idx, const std::function<void(MetadataEntry&)>& fn) {
+    if (entry_idx >= metadata_cache.size()) return false;
+    
+    {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        MetadataEntry& entry = metadata_cache[entry_idx];
+        if (entry.valid == 0) return false;
+        
+        // Only moves touch the child index, so attribute updates stay safe
+        // under a shared namespace lock.
+        MetadataEntry before = entry;
+        fn(entry);
+        account_change(before, entry);
+        if (entry.parent_index != before.parent_index) {
+            if (before.parent_index < child_index.size()) child_index[before.parent_index].erase(entry_idx);
+            index_entry(entry_idx);
+        } else if (strncmp(before.name, entry.name, sizeof(before.name)) != 0) {
+            index_entry(entry_idx);
+        }
+        stage_entry(entry_idx);
     }
+    return commit();
+}
+
+bool OmniStorage::snapshot_entry(uint32_t entry_idx, MetadataEntry* out) {
+    if (entry_idx >= metadata_cache.size()) return false;
     
-    metadata_cache[entry_idx].valid = 0;
-    save_metadata();
+    std::lock_guard<std::mutex> lock(meta_mutex);
+    if (metadata_cache[entry_idx].valid == 0) return false;
+    *out = metadata_cache[entry_idx];
     return true;
 }
 
@@ -239,22 +785,47 @@ MetadataEntry* OmniStorage::get_entry(uint32_t entry_idx) {
 }
 
 std::vector<uint32_t> OmniStorage::list_children(uint32_t parent_idx) {
-    std::vector<uint32_t> children;
+    if (parent_idx >= child_index.size()) return std::vector<uint32_t>();
     
-    for (uint32_t i = 0; i < metadata_cache.size(); i++) {
-        if (metadata_cache[i].valid && metadata_cache[i].parent_index == parent_idx) {
-            children.push_back(i);
+    const std::set<uint32_t>& children = child_index[parent_idx];
+    return std::vector<uint32_t>(children.begin(), children.end());
+}
+
+uint32_t OmniStorage::find_child(uint32_t parent_idx, std::string_view name) {
+    if (parent_idx >= child_index.size() || name.size() >= sizeof(MetadataEntry::name)) return 0xFFFFFFFF;
+    
+    for (uint32_t child_idx : child_index[parent_idx]) {
+        const MetadataEntry& entry = metadata_cache[child_idx];
+        if (entry.valid && entry.name[name.size()] == '\0' &&
+            memcmp(entry.name, name.data(), name.size()) == 0) {
+            return child_idx;
         }
     }
+    return 0xFFFFFFFF;
+}
+
+std::vector<uint32_t> OmniStorage::search_names(const std::string& pattern, size_t limit) {
+    return name_index.search(pattern, limit);
+}
+
+uint32_t OmniStorage::share_chain(uint32_t start_block) {
+    if (start_block == 0) return 0;
     
-    return children;
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+    shared_chains[start_block]++;
+    return start_block;
 }
 
 uint32_t OmniStorage::allocate_block() {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
     for (uint32_t i = 0; i < block_bitmap.size(); i++) {
-        if (block_bitmap[i] == 0) {
-            block_bitmap[i] = 1;
-            save_bitmap();
+        if (block_bitmap[i] == BLOCK_FREE) {
+            block_bitmap[i] = BLOCK_RESERVED;
+            stage_bitmap(i);
+            if (punch_holes) {
+                std::lock_guard<std::mutex> lock(wb_mutex);
+                punch_pending.erase(i);
+            }
             return i;
         }
     }
@@ -262,60 +833,125 @@ uint32_t OmniStorage::allocate_block() {
 }
 
 void OmniStorage::free_block(uint32_t block_idx) {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
     if (block_idx < block_bitmap.size()) {
-        block_bitmap[block_idx] = 0;
-        save_bitmap();
+        block_cache.invalidate(block_idx);
+        discard_staged(get_block_fd(block_idx), get_block_offset(block_idx));
+        block_bitmap[block_idx] = BLOCK_FREE;
+        stage_bitmap(block_idx);
+        if (punch_holes) {
+            std::lock_guard<std::mutex> lock(wb_mutex);
+            punch_pending.insert(block_idx);
+        }
     }
 }
 
 void OmniStorage::free_block_chain(uint32_t start_block) {
+    {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        auto shared = shared_chains.find(start_block);
+        if (shared != shared_chains.end()) {
+            if (--shared->second == 0) shared_chains.erase(shared);
+            return;
+        }
+    }
+    
     uint32_t current = start_block;
     
     while (current != 0 && current != 0xFFFFFFFF) {
-        uint32_t next;
+        uint32_t next = 0;
         read_block(current, nullptr, 0, &next);
-        free_block(current);
+        
+        // Blocks a version lists outlive the chain.
+        bool listed;
+        {
+            std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+            listed = version_refs.count(current) > 0;
+            if (listed) {
+                block_bitmap[current] = BLOCK_VERSIONED;
+                stage_bitmap(current);
+            }
+        }
+        if (!listed) free_block(current);
         current = next;
     }
+    commit();
 }
 
 bool OmniStorage::write_block(uint32_t block_idx, const void* data, size_t size, uint32_t next_block) {
-    if (block_idx >= block_bitmap.size()) return false;
+    if (block_idx >= block_count) return false;
+    if (size > BLOCK_SIZE - sizeof(BlockHeader)) return false;
     
-    uint64_t offset = get_block_offset(block_idx);
-    file.seekp(offset);
+    std::vector<uint8_t> raw(sizeof(BlockHeader) + size);
     
     BlockHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
     hdr.next_block = next_block;
     hdr.data_size = size;
-    file.write((char*)&hdr, sizeof(hdr));
     
     if (data && size > 0) {
-        std::vector<uint8_t> encoded(size);
-        memcpy(encoded.data(), data, size);
-        encode_data(encoded.data(), size);
-        file.write((char*)encoded.data(), size);
+        memcpy(raw.data() + sizeof(hdr), data, size);
+        encode_data(raw.data() + sizeof(hdr), size);
+    }
+    
+    if (has_checksums()) {
+        hdr.checksum = block_checksum(hdr, raw.data() + sizeof(hdr));
     }
+    memcpy(raw.data(), &hdr, sizeof(hdr));
     
-    file.flush();
-    return file.good();
+    {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        if (block_bitmap[block_idx] == BLOCK_RESERVED) block_bitmap[block_idx] = BLOCK_USED;
+    }
+    
+    // Invalidate after staging: a read that loads the old bytes before the
+    // new ones are visible then sees the epoch move and does not cache them.
+    bool staged = stage_write(get_block_fd(block_idx), get_block_offset(block_idx), raw.data(), raw.size());
+    block_cache.invalidate(block_idx);
+    if (!staged) return false;
+    throttle();
+    return true;
 }
 
 size_t OmniStorage::read_block(uint32_t block_idx, void* buffer, size_t buffer_size, uint32_t* next_block) {
-    if (block_idx >= block_bitmap.size()) return 0;
+    if (block_idx >= block_count) return 0;
+    
+    std::shared_ptr<const CachedBlock> cached = block_cache.get(block_idx);
+    if (!cached && buffer && buffer_size > 0 && block_cache.get_capacity() > 0) {
+        uint64_t epoch = block_cache.get_epoch();
+        cached = load_block(block_idx, true);
+        if (!cached) return 0;
+        block_cache.put(block_idx, cached, epoch);
+    }
     
-    uint64_t offset = get_block_offset(block_idx);
-    file.seekg(offset);
+    if (cached) {
+        if (next_block) *next_block = cached->next_block;
+        if (buffer && buffer_size > 0) {
+            size_t to_copy = std::min(cached->data.size(), buffer_size);
+            memcpy(buffer, cached->data.data(), to_copy);
+            bytes_copied += to_copy;
+            return to_copy;
+        }
+        return cached->data.size();
+    }
     
     BlockHeader hdr;
-    file.read((char*)&hdr, sizeof(hdr));
-    if (!file.good()) return 0;
+    if (!read_block_bytes(block_idx, 0, &hdr, sizeof(hdr))) return 0;
     
     if (next_block) *next_block = hdr.next_block;
     
     if (buffer && buffer_size > 0) {
         size_t to_read = std::min((size_t)hdr.data_size, buffer_size);
-        file.read((char*)buffer, to_read);
+        if (!read_block_bytes(block_idx, sizeof(hdr), buffer, to_read)) return 0;
+        
+        if (verify_reads && has_checksums() && to_read == hdr.data_size) {
+            if (hdr.checksum != block_checksum(hdr, buffer)) {
+                report_checksum_error("block " + std::to_string(block_idx));
+                return 0;
+            }
+            blocks_verified++;
+        }
+        
         decode_data(buffer, to_read);
         return to_read;
     }
@@ -323,71 +959,1038 @@ size_t OmniStorage::read_block(uint32_t block_idx, void* buffer, size_t buffer_s
     return hdr.data_size;
 }
 
-bool OmniStorage::write_file_data(uint32_t entry_idx, const void* data, size_t size) {
-    if (entry_idx >= metadata_cache.size()) return false;
+bool OmniStorage::read_block_view(uint32_t block_idx, SharedBuffer* out, uint32_t* next_block) {
+    if (block_idx >= block_count) return false;
     
-    MetadataEntry* entry = &metadata_cache[entry_idx];
-    
-    if (entry->start_block != 0) {
-        free_block_chain(entry->start_block);
+    std::shared_ptr<const CachedBlock> cached = block_cache.get(block_idx);
+    if (!cached) {
+        uint64_t epoch = block_cache.get_epoch();
+        cached = load_block(block_idx, true);
+        if (!cached) return false;
+        if (block_cache.get_capacity() > 0) block_cache.put(block_idx, cached, epoch);
     }
     
-    if (size == 0) {
-        entry->start_block = 0;
-        entry->total_size = 0;
-        save_metadata();
-        return true;
-    }
+    if (next_block) *next_block = cached->next_block;
+    *out = SharedBuffer(cached, cached->data.data(), cached->data.size());
+    bytes_shared += cached->data.size();
+    return true;
+}
+
+std::shared_ptr<const CachedBlock> OmniStorage::load_block(uint32_t block_idx, bool report_errors) {
+    BlockHeader hdr;
+    if (!read_block_bytes(block_idx, 0, &hdr, sizeof(hdr))) return nullptr;
+    if (hdr.data_size > BLOCK_SIZE - sizeof(BlockHeader)) return nullptr;
     
-    const uint8_t* ptr = (const uint8_t*)data;
-    size_t remaining = size;
-    uint32_t prev_block = 0;
-    uint32_t first_block = 0;
+    auto block = std::make_shared<CachedBlock>();
+    block->next_block = hdr.next_block;
+    block->data.resize(hdr.data_size);
+    if (!read_block_bytes(block_idx, sizeof(hdr), block->data.data(), hdr.data_size)) return nullptr;
     
-    while (remaining > 0) {
-        uint32_t block_idx = allocate_block();
-        if (block_idx == 0xFFFFFFFF) return false;
-        
-        if (first_block == 0) first_block = block_idx;
-        
-        size_t chunk_size = std::min(remaining, (size_t)(BLOCK_SIZE - sizeof(BlockHeader)));
-        uint32_t next = (remaining > chunk_size) ? 0 : 0;
-        
-        write_block(block_idx, ptr, chunk_size, next);
-        
-        if (prev_block != 0) {
-            uint8_t temp[BLOCK_SIZE];
-            uint32_t dummy;
-            size_t prev_size = read_block(prev_block, temp, sizeof(temp), &dummy);
-            write_block(prev_block, temp, prev_size, block_idx);
+    if (verify_reads && has_checksums()) {
+        if (hdr.checksum != block_checksum(hdr, block->data.data())) {
+            if (report_errors) report_checksum_error("block " + std::to_string(block_idx));
+            return nullptr;
         }
-        
-        prev_block = block_idx;
-        ptr += chunk_size;
-        remaining -= chunk_size;
+        blocks_verified++;
     }
     
-    entry->start_block = first_block;
-    entry->total_size = size;
-    entry->modified_time = time(nullptr);
-    save_metadata();
-    
-    return true;
+    decode_data(block->data.data(), block->data.size());
+    return block;
 }
 
-size_t OmniStorage::read_file_data(uint32_t entry_idx, void* buffer, size_t buffer_size) {
-    if (entry_idx >= metadata_cache.size()) return 0;
-    
-    MetadataEntry* entry = &metadata_cache[entry_idx];
-    if (entry->start_block == 0) return 0;
-    
-    uint8_t* ptr = (uint8_t*)buffer;
-    size_t total_read = 0;
-    uint32_t current_block = entry->start_block;
-    
-    while (current_block != 0 && current_block != 0xFFFFFFFF && total_read < buffer_size) {
-        uint32_t next_block;
+void OmniStorage::set_readahead(uint32_t window_blocks, uint32_t cache_blocks) {
+    readahead_window = window_blocks;
+    cache_capacity = cache_blocks;
+}
+
+uint64_t OmniStorage::get_cache_hits() {
+    return block_cache.get_hits();
+}
+
+uint64_t OmniStorage::get_cache_misses() {
+    return block_cache.get_misses();
+}
+
+uint64_t OmniStorage::get_bytes_copied() {
+    return bytes_copied;
+}
+
+uint64_t OmniStorage::get_bytes_shared() {
+    return bytes_shared;
+}
+
+void OmniStorage::note_sequential_read(uint32_t entry_idx, uint32_t start_block,
+                                       uint32_t block_idx, uint32_t next_block) {
+    std::lock_guard<std::mutex> stream_lock(stream_mutex);
+    if (!prefetch_running || next_block == 0 || next_block == 0xFFFFFFFF) {
+        read_streams.erase(entry_idx);
+        return;
+    }
+    
+    if (read_streams.size() > 256) read_streams.clear();
+    
+    // A walk that starts at the head of a file or continues where the last
+    // one left off counts as sequential.
+    auto it = read_streams.find(entry_idx);
+    bool sequential = (block_idx == start_block) ||
+                      (it != read_streams.end() && it->second.expected_block == block_idx);
+    
+    ReadStream& stream = read_streams[entry_idx];
+    stream.expected_block = next_block;
+    if (!sequential) {
+        stream.prefetched_ahead = 0;
+        return;
+    }
+    
+    // Refill once half the window has been consumed.
+    if (stream.prefetched_ahead > readahead_window / 2) {
+        stream.prefetched_ahead--;
+        return;
+    }
+    
+    ::readahead(get_block_fd(next_block), get_block_offset(next_block),
+                (size_t)readahead_window * BLOCK_SIZE);
+    
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        prefetch_queue.push_back({next_block, readahead_window, block_count});
+    }
+    prefetch_cv.notify_one();
+    stream.prefetched_ahead = readahead_window;
+}
+
+void OmniStorage::start_prefetcher() {
+    if (readahead_window == 0 || cache_capacity == 0 || prefetch_running) return;
+    
+    prefetch_running = true;
+    prefetch_thread = std::thread(&OmniStorage::prefetch_loop, this);
+}
+
+void OmniStorage::stop_prefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        if (!prefetch_running) return;
+        prefetch_running = false;
+        prefetch_queue.clear();
+    }
+    prefetch_cv.notify_all();
+    prefetch_thread.join();
+}
+
+void OmniStorage::prefetch_loop() {
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    
+    while (true) {
+        prefetch_cv.wait(lock, [this] { return !prefetch_running || !prefetch_queue.empty(); });
+        if (!prefetch_running) break;
+        
+        PrefetchRequest request = prefetch_queue.front();
+        prefetch_queue.pop_front();
+        lock.unlock();
+        
+        uint32_t current = request.start_block;
+        for (uint32_t i = 0; i < request.count; i++) {
+            if (current == 0 || current >= request.block_limit) break;
+            
+            std::shared_ptr<const CachedBlock> cached = block_cache.peek(current);
+            if (!cached) {
+                // Errors are left for the foreground read to report; a
+                // prefetch may race with a rewrite of the same block.
+                uint64_t epoch = block_cache.get_epoch();
+                cached = load_block(current, false);
+                if (!cached) break;
+                block_cache.put(current, cached, epoch);
+            }
+            current = cached->next_block;
+        }
+        
+        lock.lock();
+    }
+}
+
+void OmniStorage::set_space_policy(bool prealloc, bool punch) {
+    preallocate = prealloc;
+    punch_holes = punch;
+}
+
+void OmniStorage::set_write_back(DurabilityMode mode, uint32_t interval_ms, uint64_t limit) {
+    durability = mode;
+    flush_interval_ms = std::max(interval_ms, 1u);
+    dirty_limit = std::max(limit, (uint64_t)BLOCK_SIZE);
+}
+
+uint64_t OmniStorage::get_dirty_bytes() {
+    std::lock_guard<std::mutex> lock(wb_mutex);
+    return dirty_bytes;
+}
+
+uint64_t OmniStorage::get_flush_count() {
+    return flush_count;
+}
+
+bool OmniStorage::stage_write(int target, uint64_t offset, const void* data, size_t size) {
+    if (!flusher_running) return write_at(target, offset, data, size);
+    
+    {
+        std::lock_guard<std::mutex> lock(wb_mutex);
+        if (dirty_pages.empty()) oldest_dirty = std::chrono::steady_clock::now();
+        
+        std::vector<uint8_t>& page = dirty_pages[{target, offset}];
+        dirty_bytes -= page.size();
+        page.assign((const uint8_t*)data, (const uint8_t*)data + size);
+        dirty_bytes += size;
+        
+        if (dirty_bytes >= dirty_limit && !flush_requested) {
+            flush_requested = true;
+            wb_cv.notify_one();
+        }
+    }
+    return true;
+}
+
+// Called with no locks held.
+void OmniStorage::throttle() {
+    bool behind;
+    {
+        std::lock_guard<std::mutex> lock(wb_mutex);
+        behind = dirty_bytes >= 2 * dirty_limit;
+    }
+    
+    // The flusher has fallen behind; make the writer pay for it.
+    if (behind) flush_pending(false);
+}
+
+void OmniStorage::discard_staged(int target, uint64_t offset) {
+    std::lock_guard<std::mutex> lock(wb_mutex);
+    auto it = dirty_pages.find({target, offset});
+    if (it != dirty_pages.end()) {
+        dirty_bytes -= it->second.size();
+        dirty_pages.erase(it);
+    }
+}
+
+bool OmniStorage::read_block_bytes(uint32_t block_idx, uint64_t offset, void* buffer, size_t size) {
+    int target = get_block_fd(block_idx);
+    uint64_t base = get_block_offset(block_idx);
+    
+    {
+        std::lock_guard<std::mutex> lock(wb_mutex);
+        auto it = dirty_pages.find({target, base});
+        if (it == dirty_pages.end()) {
+            it = flushing_pages.find({target, base});
+            if (it == flushing_pages.end()) it = dirty_pages.end();
+        }
+        
+        if (it != dirty_pages.end()) {
+            const std::vector<uint8_t>& page = it->second;
+            size_t avail = (page.size() > offset) ? std::min(size, (size_t)(page.size() - offset)) : 0;
+            memcpy(buffer, page.data() + offset, avail);
+            memset((uint8_t*)buffer + avail, 0, size - avail);
+            return true;
+        }
+    }
+    
+    return read_at(target, base + offset, buffer, size);
+}
+
+void OmniStorage::stage_entry(uint32_t entry_idx) {
+    uint32_t first = entry_idx - entry_idx % METADATA_PAGE_ENTRIES;
+    uint32_t count = std::min((uint32_t)METADATA_PAGE_ENTRIES, (uint32_t)metadata_cache.size() - first);
+    
+    if (has_checksums()) {
+        for (uint32_t i = first; i < first + count; i++) {
+            if (metadata_cache[i].valid) metadata_cache[i].checksum = entry_checksum(metadata_cache[i]);
+        }
+    }
+    
+    stage_write(fd, get_metadata_offset() + (uint64_t)first * sizeof(MetadataEntry),
+                &metadata_cache[first], count * sizeof(MetadataEntry));
+}
+
+void OmniStorage::stage_bitmap(uint32_t block_idx) {
+    uint32_t first = block_idx - block_idx % BITMAP_PAGE_SIZE;
+    uint32_t count = std::min((uint32_t)BITMAP_PAGE_SIZE, (uint32_t)block_bitmap.size() - first);
+    
+    stage_write(fd, get_bitmap_offset() + first, &block_bitmap[first], count);
+}
+
+// Caller holds log_mutex.
+void OmniStorage::stage_change_page(size_t slot) {
+    size_t first = slot - slot % CHANGE_LOG_PAGE_RECORDS;
+    size_t count = std::min((size_t)CHANGE_LOG_PAGE_RECORDS, change_log.size() - first);
+    
+    stage_write(fd, header.change_log_offset + first * sizeof(ChangeRecord),
+                &change_log[first], count * sizeof(ChangeRecord));
+}
+
+// Caller holds version_mutex, or is open() before anything else runs.
+void OmniStorage::stage_version_page(uint32_t slot) {
+    uint32_t first = slot - slot % VERSION_PAGE_RECORDS;
+    uint32_t count = std::min((uint32_t)VERSION_PAGE_RECORDS, (uint32_t)version_table.size() - first);
+    
+    stage_write(fd, header.file_state_storage_offset + (uint64_t)first * sizeof(VersionRecord),
+                &version_table[first], count * sizeof(VersionRecord));
+}
+
+// Rewrites the latest record of each entry into the idle copy, then points
+// the header at it. Like grow(), the old copy stays valid until the header
+// write; its staged pages are drained first so none of them can land on the
+// copy once it is reused. Caller holds log_mutex.
+bool OmniStorage::compact_change_log() {
+    std::unordered_map<uint32_t, size_t> latest;
+    for (size_t i = 0; i < change_log.size(); i++) {
+        latest[change_log[i].entry] = i;
+    }
+    
+    std::vector<ChangeRecord> kept;
+    kept.reserve(change_log.capacity());
+    for (size_t i = 0; i < change_log.size(); i++) {
+        if (latest[change_log[i].entry] == i) kept.push_back(change_log[i]);
+    }
+    
+    uint64_t base = get_change_log_base();
+    uint64_t target = header.change_log_offset == base ? base + CHANGE_LOG_SIZE : base;
+    
+    std::lock_guard<std::mutex> flush_lock(flush_mutex);
+    if (!write_pending(false)) return false;
+    if (!write_at(fd, target, kept.data(), kept.size() * sizeof(ChangeRecord)) || !sync_files()) {
+        return false;
+    }
+    
+    OMNIHeader updated = header;
+    updated.change_log_offset = target;
+    if (!write_at(fd, 0, &updated, sizeof(updated)) || !sync_files()) {
+        return false;
+    }
+    
+    header.change_log_offset = target;
+    change_log.swap(kept);
+    return true;
+}
+
+bool OmniStorage::has_change_log() {
+    return header.change_log_offset != 0;
+}
+
+uint64_t OmniStorage::log_change(ChangeRecord record) {
+    if (!has_change_log()) return 0;
+    
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        
+        // At most one record per entry survives compaction, so this only
+        // fails on an I/O error.
+        if (change_log.size() == CHANGE_LOG_SIZE / sizeof(ChangeRecord) && !compact_change_log()) {
+            Logger::error("Change log compaction failed for " + file_path);
+            return 0;
+        }
+        
+        record.seq = next_change_seq++;
+        record.checksum = record_checksum(record);
+        change_log.push_back(record);
+        stage_change_page(change_log.size() - 1);
+    }
+    
+    commit();
+    return record.seq;
+}
+
+std::vector<ChangeRecord> OmniStorage::read_changes(uint64_t since, size_t limit, uint64_t* out_last_seq) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (out_last_seq) *out_last_seq = next_change_seq - 1;
+    
+    auto first = std::upper_bound(change_log.begin(), change_log.end(), since,
+                                  [](uint64_t seq, const ChangeRecord& record) { return seq < record.seq; });
+    size_t count = std::min(limit, (size_t)(change_log.end() - first));
+    return std::vector<ChangeRecord>(first, first + count);
+}
+
+bool OmniStorage::has_versions() {
+    return header.file_state_storage_offset != 0;
+}
+
+void OmniStorage::set_version_retention(uint32_t keep, uint64_t max_age) {
+    std::lock_guard<std::mutex> lock(version_mutex);
+    version_keep = keep;
+    version_max_age = max_age;
+}
+
+void OmniStorage::retire_chain(uint32_t entry_idx, const MetadataEntry& before) {
+    MetadataEntry current;
+    bool exists = snapshot_entry(entry_idx, &current) && current.generation == before.generation;
+    
+    // Versions of a deleted file, or of whatever held the slot before it,
+    // go with it.
+    uint32_t keep;
+    {
+        std::lock_guard<std::mutex> lock(version_mutex);
+        keep = version_keep;
+        
+        auto slots = entry_versions.find(entry_idx);
+        std::vector<uint32_t> stale;
+        if (slots != entry_versions.end()) {
+            for (uint32_t slot : slots->second) {
+                if (!exists || version_table[slot].generation != current.generation) stale.push_back(slot);
+            }
+        }
+        for (uint32_t slot : stale) {
+            drop_version(slot);
+        }
+    }
+    
+    if (!exists || !has_versions() || keep == 0 || before.type != 0 ||
+        before.start_block == current.start_block) {
+        free_block_chain(before.start_block);
+        return;
+    }
+    
+    // Pair each old block with the block in the same place in the new
+    // content. Chains are never rewritten in place, so a new block that
+    // starts with the old block's bytes can stand in for it.
+    std::vector<VersionExtent> extents;
+    std::unordered_map<uint32_t, uint32_t> moved;
+    std::vector<uint8_t> old_data(BLOCK_SIZE);
+    std::vector<uint8_t> new_data(BLOCK_SIZE);
+    uint32_t old_block = before.start_block;
+    uint32_t new_block = current.start_block;
+    uint64_t remaining = before.total_size;
+    bool readable = true;
+    
+    while (old_block != 0 && remaining > 0) {
+        uint32_t old_next = 0;
+        uint32_t new_next = 0;
+        size_t old_size = read_block(old_block, old_data.data(), old_data.size(), &old_next);
+        if (old_size == 0) {
+            readable = false;
+            break;
+        }
+        
+        VersionExtent extent = {old_block, (uint32_t)old_size};
+        if (new_block != 0) {
+            size_t new_size = read_block(new_block, new_data.data(), new_data.size(), &new_next);
+            if (new_size >= old_size && memcmp(old_data.data(), new_data.data(), old_size) == 0) {
+                extent.block = new_block;
+                moved[old_block] = new_block;
+            }
+        }
+        extents.push_back(extent);
+        
+        remaining -= std::min<uint64_t>(remaining, old_size);
+        old_block = old_next;
+        new_block = new_next;
+    }
+    
+    uint32_t list_block = readable ? write_chain(extents.data(), extents.size() * sizeof(VersionExtent)) : 0xFFFFFFFF;
+    if (list_block == 0xFFFFFFFF) {
+        Logger::warn("Could not keep a version of entry " + std::to_string(entry_idx) + " in " + file_path);
+        free_block_chain(before.start_block);
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(version_mutex);
+        
+        uint32_t slot = 0;
+        while (slot < version_table.size() && version_table[slot].valid) slot++;
+        if (slot == version_table.size()) {
+            slot = 0;
+            for (uint32_t i = 1; i < version_table.size(); i++) {
+                if (version_table[i].retired_time < version_table[slot].retired_time) slot = i;
+            }
+            drop_version(slot);
+        }
+        
+        // Earlier versions listing an old block that the new content
+        // repeats follow it there, so the old block can be freed.
+        if (!moved.empty()) move_extents(entry_idx, moved);
+        
+        std::vector<uint32_t>& slots = entry_versions[entry_idx];
+        VersionRecord& record = version_table[slot];
+        memset(&record, 0, sizeof(record));
+        record.size = before.total_size;
+        record.modified_time = before.modified_time;
+        record.retired_time = time(nullptr);
+        record.entry = entry_idx;
+        record.generation = before.generation;
+        record.list_block = list_block;
+        record.block_count = extents.size();
+        record.version = slots.empty() ? 1 : version_table[slots.back()].version + 1;
+        record.owner_id = before.owner_id;
+        record.valid = 1;
+        record.checksum = version_checksum(record);
+        
+        // Listed before the old chain is freed, so its listed blocks stay.
+        reference_extents(extents);
+        slots.push_back(slot);
+        stage_version_page(slot);
+        
+        while (entry_versions[entry_idx].size() > keep) {
+            drop_version(entry_versions[entry_idx].front());
+        }
+        drop_expired_versions(entry_idx);
+        
+        // Other files' versions expire too, whether or not they are written.
+        if (version_max_age > 0 && record.retired_time - last_version_sweep >= 60) {
+            last_version_sweep = record.retired_time;
+            std::vector<uint32_t> entries;
+            for (const auto& pair : entry_versions) {
+                entries.push_back(pair.first);
+            }
+            for (uint32_t entry : entries) {
+                drop_expired_versions(entry);
+            }
+        }
+    }
+    
+    free_block_chain(before.start_block);
+    commit();
+}
+
+std::vector<VersionRecord> OmniStorage::list_versions(uint32_t entry_idx) {
+    std::vector<VersionRecord> versions;
+    MetadataEntry entry;
+    if (!snapshot_entry(entry_idx, &entry)) return versions;
+    
+    std::lock_guard<std::mutex> lock(version_mutex);
+    drop_expired_versions(entry_idx);
+    
+    auto slots = entry_versions.find(entry_idx);
+    if (slots == entry_versions.end()) return versions;
+    for (uint32_t slot : slots->second) {
+        if (version_table[slot].generation == entry.generation) versions.push_back(version_table[slot]);
+    }
+    return versions;
+}
+
+bool OmniStorage::get_version(uint32_t entry_idx, uint32_t version, VersionRecord* out) {
+    for (const VersionRecord& record : list_versions(entry_idx)) {
+        if (record.version == version) {
+            *out = record;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t OmniStorage::stream_version(const VersionRecord& record,
+                                     const std::function<bool(const SharedBuffer&)>& sink) {
+    std::vector<VersionExtent> extents;
+    {
+        std::lock_guard<std::mutex> lock(version_mutex);
+        auto slots = entry_versions.find(record.entry);
+        if (slots == entry_versions.end()) return 0;
+        
+        auto slot = std::find_if(slots->second.begin(), slots->second.end(), [&](uint32_t slot) {
+            return version_table[slot].generation == record.generation &&
+                   version_table[slot].version == record.version;
+        });
+        if (slot == slots->second.end() || !read_extents(version_table[*slot], &extents)) return 0;
+        reference_extents(extents);
+    }
+    
+    uint64_t delivered = 0;
+    for (const VersionExtent& extent : extents) {
+        SharedBuffer view;
+        if (!read_block_view(extent.block, &view, nullptr) || view.size() < extent.size) break;
+        if (!sink(view.slice(0, extent.size))) break;
+        delivered += extent.size;
+    }
+    
+    release_extents(extents);
+    return delivered;
+}
+
+bool OmniStorage::read_extents(const VersionRecord& record, std::vector<VersionExtent>* out) {
+    out->assign(record.block_count, VersionExtent());
+    uint8_t* ptr = (uint8_t*)out->data();
+    size_t size = out->size() * sizeof(VersionExtent);
+    size_t done = 0;
+    uint32_t current = record.list_block;
+    
+    while (done < size && current != 0 && current < block_count) {
+        uint32_t next = 0;
+        size_t read = read_block(current, ptr + done, size - done, &next);
+        if (read == 0) break;
+        done += read;
+        current = next;
+    }
+    return done == size;
+}
+
+void OmniStorage::reference_extents(const std::vector<VersionExtent>& extents) {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+    for (const VersionExtent& extent : extents) {
+        version_refs[extent.block]++;
+    }
+}
+
+// A block whose last reference goes is freed if no chain holds it either.
+void OmniStorage::release_extents(const std::vector<VersionExtent>& extents) {
+    std::vector<uint32_t> unused;
+    {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        for (const VersionExtent& extent : extents) {
+            auto ref = version_refs.find(extent.block);
+            if (ref == version_refs.end() || --ref->second > 0) continue;
+            
+            version_refs.erase(ref);
+            if (block_bitmap[extent.block] == BLOCK_VERSIONED) unused.push_back(extent.block);
+        }
+    }
+    
+    for (uint32_t block : unused) {
+        free_block(block);
+    }
+}
+
+// Rewrites the lists of entry_idx's versions that name a block in moved to
+// name its replacement instead. A list that cannot be rewritten keeps the
+// old block. Caller holds version_mutex.
+void OmniStorage::move_extents(uint32_t entry_idx, const std::unordered_map<uint32_t, uint32_t>& moved) {
+    auto slots = entry_versions.find(entry_idx);
+    if (slots == entry_versions.end()) return;
+    
+    for (uint32_t slot : slots->second) {
+        VersionRecord& record = version_table[slot];
+        std::vector<VersionExtent> before;
+        if (!read_extents(record, &before)) continue;
+        
+        std::vector<VersionExtent> after = before;
+        bool changed = false;
+        for (VersionExtent& extent : after) {
+            auto target = moved.find(extent.block);
+            if (target == moved.end()) continue;
+            extent.block = target->second;
+            changed = true;
+        }
+        if (!changed) continue;
+        
+        uint32_t list_block = write_chain(after.data(), after.size() * sizeof(VersionExtent));
+        if (list_block == 0xFFFFFFFF) continue;
+        
+        reference_extents(after);
+        release_extents(before);
+        free_block_chain(record.list_block);
+        record.list_block = list_block;
+        record.checksum = version_checksum(record);
+        stage_version_page(slot);
+    }
+}
+
+// Caller holds version_mutex.
+void OmniStorage::drop_version(uint32_t slot) {
+    VersionRecord record = version_table[slot];
+    
+    std::vector<VersionExtent> extents;
+    if (read_extents(record, &extents)) {
+        release_extents(extents);
+    } else {
+        Logger::error("Unreadable version list in " + file_path + "; its blocks stay allocated");
+    }
+    free_block_chain(record.list_block);
+    
+    auto slots = entry_versions.find(record.entry);
+    if (slots != entry_versions.end()) {
+        slots->second.erase(std::remove(slots->second.begin(), slots->second.end(), slot), slots->second.end());
+        if (slots->second.empty()) entry_versions.erase(slots);
+    }
+    memset(&version_table[slot], 0, sizeof(VersionRecord));
+    stage_version_page(slot);
+}
+
+// Caller holds version_mutex.
+void OmniStorage::drop_expired_versions(uint32_t entry_idx) {
+    if (version_max_age == 0) return;
+    
+    uint64_t now = time(nullptr);
+    auto slots = entry_versions.find(entry_idx);
+    while (slots != entry_versions.end() &&
+           version_table[slots->second.front()].retired_time + version_max_age < now) {
+        drop_version(slots->second.front());
+        slots = entry_versions.find(entry_idx);
+    }
+}
+
+void OmniStorage::punch_blocks(std::vector<uint32_t>& blocks) {
+    // Sort by location and coalesce neighbours into one call per run.
+    std::sort(blocks.begin(), blocks.end(), [this](uint32_t a, uint32_t b) {
+        return std::make_pair(get_block_fd(a), get_block_offset(a)) <
+               std::make_pair(get_block_fd(b), get_block_offset(b));
+    });
+    
+    size_t i = 0;
+    while (i < blocks.size()) {
+        int target = get_block_fd(blocks[i]);
+        uint64_t start = get_block_offset(blocks[i]);
+        uint64_t end = start + BLOCK_SIZE;
+        
+        for (i++; i < blocks.size(); i++) {
+            if (get_block_fd(blocks[i]) != target || get_block_offset(blocks[i]) != end) break;
+            end += BLOCK_SIZE;
+        }
+        
+        if (fallocate(target, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) != 0 &&
+            errno == EOPNOTSUPP) {
+            punch_holes = false;
+            Logger::warn("Hole punching not supported for " + file_path + "; disabled");
+            return;
+        }
+    }
+}
+
+// Depth of begin_group() nesting on this thread.
+static thread_local int t_group_depth = 0;
+
+void OmniStorage::begin_group() {
+    t_group_depth++;
+}
+
+bool OmniStorage::end_group() {
+    if (t_group_depth == 0 || --t_group_depth > 0) return true;
+    return commit();
+}
+
+bool OmniStorage::commit() {
+    if (t_group_depth > 0) return true;
+    if (durability != DurabilityMode::SYNC || !flusher_running) {
+        throttle();
+        return true;
+    }
+    return flush_pending(true);
+}
+
+bool OmniStorage::flush_pending(bool durable) {
+    std::lock_guard<std::mutex> flush_lock(flush_mutex);
+    return write_pending(durable);
+}
+
+// Caller holds flush_mutex.
+bool OmniStorage::write_pending(bool durable) {
+    std::set<uint32_t> punching;
+    {
+        std::lock_guard<std::mutex> lock(wb_mutex);
+        flushing_pages.swap(dirty_pages);
+        punching.swap(punch_pending);
+        dirty_bytes = 0;
+        flush_requested = false;
+    }
+    
+    // PageMap is ordered by fd then offset, so this is one ascending sweep
+    // per backing file.
+    bool ok = true;
+    for (const auto& page : flushing_pages) {
+        if (!write_at(page.first.first, page.first.second, page.second.data(), page.second.size())) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok && durable) ok = sync_files();
+    
+    // Holes are punched only once the bitmap and metadata that free the
+    // blocks are written. A block reallocated since its free is dropped from
+    // punch_pending, and if it is reallocated while this batch is in flight
+    // its new contents are still staged and land after the punch.
+    if (ok && !punching.empty()) {
+        std::vector<uint32_t> blocks(punching.begin(), punching.end());
+        punch_blocks(blocks);
+        punching.clear();
+    }
+    
+    std::lock_guard<std::mutex> lock(wb_mutex);
+    punch_pending.insert(punching.begin(), punching.end());
+    if (!flushing_pages.empty()) flush_count++;
+    
+    if (!ok) {
+        // Requeue whatever has not been superseded by a newer write.
+        for (auto& page : flushing_pages) {
+            size_t size = page.second.size();
+            if (dirty_pages.emplace(page.first, std::move(page.second)).second) dirty_bytes += size;
+        }
+        oldest_dirty = std::chrono::steady_clock::now();
+        Logger::error("Write-back flush failed for " + file_path);
+    }
+    flushing_pages.clear();
+    return ok;
+}
+
+void OmniStorage::start_flusher() {
+    if (flusher_running) return;
+    
+    flusher_running = true;
+    flusher_thread = std::thread(&OmniStorage::flusher_loop, this);
+}
+
+void OmniStorage::stop_flusher() {
+    {
+        std::lock_guard<std::mutex> lock(wb_mutex);
+        if (!flusher_running) return;
+        flusher_running = false;
+    }
+    wb_cv.notify_all();
+    flusher_thread.join();
+}
+
+void OmniStorage::flusher_loop() {
+    std::chrono::milliseconds interval(flush_interval_ms);
+    std::unique_lock<std::mutex> lock(wb_mutex);
+    
+    while (flusher_running) {
+        auto wake = [this] { return !flusher_running || flush_requested; };
+        if (dirty_pages.empty()) {
+            wb_cv.wait_for(lock, interval, wake);
+        } else {
+            wb_cv.wait_until(lock, oldest_dirty + interval, wake);
+        }
+        if (!flusher_running || dirty_pages.empty()) continue;
+        
+        bool aged = std::chrono::steady_clock::now() - oldest_dirty >= interval;
+        if (!aged && !flush_requested) continue;
+        
+        lock.unlock();
+        flush_pending(durability == DurabilityMode::PERIODIC);
+        lock.lock();
+    }
+}
+
+void OmniStorage::set_verify_reads(bool enabled) {
+    verify_reads = enabled;
+}
+
+bool OmniStorage::verify_block(uint32_t block_idx) {
+    // Block 0 is reserved and never written.
+    if (block_idx == 0 || block_idx >= block_count || !has_checksums()) return true;
+    
+    // Only verify blocks that hold a completed write; a concurrent free or
+    // reallocation while reading also voids the result.
+    auto written = [this, block_idx] {
+        std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+        return block_bitmap[block_idx] == BLOCK_USED || block_bitmap[block_idx] == BLOCK_VERSIONED;
+    };
+    if (!written()) return true;
+    
+    std::vector<uint8_t> raw(BLOCK_SIZE);
+    
+    BlockHeader hdr;
+    bool ok = read_block_bytes(block_idx, 0, &hdr, sizeof(hdr)) &&
+              hdr.data_size <= BLOCK_SIZE - sizeof(BlockHeader) &&
+              read_block_bytes(block_idx, sizeof(hdr), raw.data(), hdr.data_size) &&
+              hdr.checksum == block_checksum(hdr, raw.data());
+    
+    if (!ok && !written()) return true;
+    if (!ok) {
+        report_checksum_error("block " + std::to_string(block_idx));
+        return false;
+    }
+    
+    blocks_verified++;
+    return true;
+}
+
+bool OmniStorage::is_block_used(uint32_t block_idx) {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
+    return block_idx < block_bitmap.size() && block_bitmap[block_idx] != BLOCK_FREE;
+}
+
+uint64_t OmniStorage::get_checksum_errors() {
+    return checksum_errors;
+}
+
+uint64_t OmniStorage::get_blocks_verified() {
+    return blocks_verified;
+}
+
+bool OmniStorage::has_checksums() {
+    return (header.feature_flags & FEATURE_CHECKSUMS) != 0;
+}
+
+uint32_t OmniStorage::block_checksum(const BlockHeader& hdr, const void* payload) {
+    uint32_t crc = CRC32C::compute(&hdr.next_block, sizeof(hdr.next_block));
+    crc = CRC32C::compute(&hdr.data_size, sizeof(hdr.data_size), crc);
+    return CRC32C::compute(payload, hdr.data_size, crc);
+}
+
+uint32_t OmniStorage::entry_checksum(const MetadataEntry& entry) {
+    uint8_t raw[sizeof(MetadataEntry)];
+    memcpy(raw, &entry, sizeof(entry));
+    memset(raw + offsetof(MetadataEntry, checksum), 0, sizeof(entry.checksum));
+    return CRC32C::compute(raw, sizeof(raw));
+}
+
+uint32_t OmniStorage::record_checksum(const ChangeRecord& record) {
+    uint8_t raw[sizeof(ChangeRecord)];
+    memcpy(raw, &record, sizeof(record));
+    memset(raw + offsetof(ChangeRecord, checksum), 0, sizeof(record.checksum));
+    return CRC32C::compute(raw, sizeof(raw));
+}
+
+uint32_t OmniStorage::version_checksum(const VersionRecord& record) {
+    uint8_t raw[sizeof(VersionRecord)];
+    memcpy(raw, &record, sizeof(record));
+    memset(raw + offsetof(VersionRecord, checksum), 0, sizeof(record.checksum));
+    return CRC32C::compute(raw, sizeof(raw));
+}
+
+void OmniStorage::report_checksum_error(const std::string& what) {
+    checksum_errors++;
+    Logger::error("Checksum mismatch in " + what + " of " + file_path);
+}
+
+bool OmniStorage::write_file_data(uint32_t entry_idx, const void* data, size_t size) {
+    if (entry_idx >= metadata_cache.size()) return false;
+    
+    uint32_t first_block = write_chain(data, size);
+    if (first_block == 0xFFFFFFFF) return false;
+    
+    free_block_chain(attach_chain(entry_idx, first_block, size));
+    return commit();
+}
+
+uint32_t OmniStorage::write_chain(const void* data, size_t size) {
+    if (size == 0) return 0;
+    
+    const uint8_t* ptr = (const uint8_t*)data;
+    size_t remaining = size;
+    std::vector<uint32_t> allocated;
+    
+    uint32_t current = allocate_block();
+    if (current == 0xFFFFFFFF) return 0xFFFFFFFF;
+    allocated.push_back(current);
+    
+    // Each block's successor is allocated before it is written, so every
+    // block is written exactly once with its final link.
+    while (current != 0) {
+        size_t chunk_size = std::min(remaining, (size_t)(BLOCK_SIZE - sizeof(BlockHeader)));
+        uint32_t next = 0;
+        
+        if (remaining > chunk_size) {
+            next = allocate_block();
+            if (next != 0xFFFFFFFF) allocated.push_back(next);
+        }
+        
+        if (next == 0xFFFFFFFF || !write_block(current, ptr, chunk_size, next)) {
+            for (uint32_t block : allocated) {
+                free_block(block);
+            }
+            return 0xFFFFFFFF;
+        }
+        
+        ptr += chunk_size;
+        remaining -= chunk_size;
+        current = next;
+    }
+    
+    return allocated.front();
+}
+
+bool OmniStorage::append_chain(ChainBuilder& chain, const void* data, size_t size) {
+    const size_t payload = BLOCK_SIZE - sizeof(BlockHeader);
+    const uint8_t* ptr = (const uint8_t*)data;
+    
+    while (size > 0) {
+        if (chain.tail_block == 0) {
+            chain.tail_block = allocate_block();
+            if (chain.tail_block == 0xFFFFFFFF) {
+                chain.tail_block = 0;
+                return false;
+            }
+            chain.blocks.push_back(chain.tail_block);
+            chain.first_block = chain.tail_block;
+            chain.tail.reserve(payload);
+        } else if (chain.tail.size() == payload) {
+            // More data follows a full tail, so it can be written now.
+            uint32_t next = allocate_block();
+            if (next == 0xFFFFFFFF) return false;
+            chain.blocks.push_back(next);
+            
+            if (!write_block(chain.tail_block, chain.tail.data(), payload, next)) return false;
+            chain.tail_block = next;
+            chain.tail.clear();
+        }
+        
+        size_t take = std::min(size, payload - chain.tail.size());
+        chain.tail.insert(chain.tail.end(), ptr, ptr + take);
+        chain.size += take;
+        ptr += take;
+        size -= take;
+    }
+    
+    return true;
+}
+
+uint32_t OmniStorage::finish_chain(ChainBuilder& chain) {
+    if (chain.tail_block == 0) return 0;
+    
+    if (!write_block(chain.tail_block, chain.tail.data(), chain.tail.size(), 0)) {
+        abandon_chain(chain);
+        return 0xFFFFFFFF;
+    }
+    
+    uint32_t first = chain.first_block;
+    chain = ChainBuilder();
+    return first;
+}
+
+void OmniStorage::abandon_chain(ChainBuilder& chain) {
+    for (uint32_t block : chain.blocks) {
+        free_block(block);
+    }
+    chain = ChainBuilder();
+    commit();
+}
+
+uint32_t OmniStorage::attach_chain(uint32_t entry_idx, uint32_t first_block, uint64_t size) {
+    uint32_t old_chain;
+    {
+        std::lock_guard<std::mutex> lock(meta_mutex);
+        MetadataEntry& entry = metadata_cache[entry_idx];
+        MetadataEntry before = entry;
+        
+        old_chain = entry.start_block;
+        entry.start_block = first_block;
+        entry.total_size = size;
+        entry.modified_time = time(nullptr);
+        account_change(before, entry);
+        stage_entry(entry_idx);
+    }
+    notify_content(entry_idx);
+    commit();
+    return old_chain;
+}
+
+void OmniStorage::set_content_listener(const std::function<void(uint32_t)>& listener) {
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    content_listener = listener;
+}
+
+void OmniStorage::notify_content(uint32_t entry_idx) {
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    if (content_listener) content_listener(entry_idx);
+}
+
+size_t OmniStorage::read_file_data(uint32_t entry_idx, void* buffer, size_t buffer_size) {
+    MetadataEntry entry;
+    if (!snapshot_entry(entry_idx, &entry)) return 0;
+    
+    return read_chain(entry_idx, entry.start_block, buffer, buffer_size);
+}
+
+size_t OmniStorage::read_chain(uint32_t entry_idx, uint32_t start_block, void* buffer, size_t buffer_size) {
+    if (start_block == 0) return 0;
+    
+    if (stripe_fds.size() > 1) {
+        return read_striped_chain(start_block, (uint8_t*)buffer, buffer_size);
+    }
+    
+    uint8_t* ptr = (uint8_t*)buffer;
+    size_t total_read = 0;
+    uint32_t current_block = start_block;
+    
+    while (current_block != 0 && current_block != 0xFFFFFFFF && total_read < buffer_size) {
+        uint32_t next_block = 0;
         size_t read = read_block(current_block, ptr, buffer_size - total_read, &next_block);
+        if (read == 0) break;
+        
+        note_sequential_read(entry_idx, start_block, current_block, next_block);
         
         ptr += read;
         total_read += read;
@@ -397,6 +2000,133 @@ size_t OmniStorage::read_file_data(uint32_t entry_idx, void* buffer, size_t buff
     return total_read;
 }
 
+uint64_t OmniStorage::read_chain_views(uint32_t entry_idx, uint32_t start_block, uint32_t* block, uint64_t size,
+                                       uint32_t max_blocks, std::vector<SharedBuffer>* out) {
+    uint64_t appended = 0;
+    
+    for (uint32_t i = 0; i < max_blocks && *block != 0 && *block != 0xFFFFFFFF && appended < size; i++) {
+        uint32_t next_block = 0;
+        SharedBuffer view;
+        if (!read_block_view(*block, &view, &next_block) || view.empty()) break;
+        
+        note_sequential_read(entry_idx, start_block, *block, next_block);
+        
+        out->push_back(view.slice(0, size - appended));
+        appended += out->back().size();
+        *block = next_block;
+    }
+    
+    return appended;
+}
+
+size_t OmniStorage::read_striped_chain(uint32_t start_block, uint8_t* buffer, size_t buffer_size) {
+    // Walk the chain through the block headers alone, then fetch the payloads
+    // in parallel, one reader per backing file.
+    std::vector<std::vector<StripeExtent>> per_stripe(stripe_fds.size());
+    size_t total = 0;
+    uint32_t current = start_block;
+    
+    while (current != 0 && current != 0xFFFFFFFF && total < buffer_size) {
+        if (current >= block_count) return 0;
+        
+        BlockHeader hdr;
+        if (!read_block_bytes(current, 0, &hdr, sizeof(hdr))) return 0;
+        
+        size_t size = std::min((size_t)hdr.data_size, buffer_size - total);
+        per_stripe[current % stripe_fds.size()].push_back({current, hdr, total, size});
+        total += size;
+        current = hdr.next_block;
+    }
+    
+    StripeRead read;
+    read.buffer = buffer;
+    read.outstanding = 0;
+    read.failed = false;
+    
+    // Counted before anything is queued, so no reader can finish the read
+    // while later stripes are still being handed out.
+    for (size_t i = 1; i < per_stripe.size(); i++) {
+        if (!per_stripe[i].empty()) read.outstanding++;
+    }
+    for (size_t i = 1; i < per_stripe.size(); i++) {
+        if (per_stripe[i].empty()) continue;
+        
+        StripeReader* reader = stripe_readers[i - 1].get();
+        {
+            std::lock_guard<std::mutex> lock(reader->mutex);
+            reader->jobs.push_back({&read, &per_stripe[i]});
+        }
+        reader->cv.notify_one();
+    }
+    
+    bool ok = read_stripe_extents(per_stripe[0], buffer);
+    
+    std::unique_lock<std::mutex> lock(read.mutex);
+    read.done_cv.wait(lock, [&read] { return read.outstanding == 0; });
+    return (!ok || read.failed) ? 0 : total;
+}
+
+bool OmniStorage::read_stripe_extents(const std::vector<StripeExtent>& extents, uint8_t* buffer) {
+    for (const auto& ext : extents) {
+        if (!read_block_bytes(ext.block, sizeof(BlockHeader), buffer + ext.dest, ext.size)) return false;
+        if (verify_reads && has_checksums() && ext.size == ext.hdr.data_size) {
+            if (ext.hdr.checksum != block_checksum(ext.hdr, buffer + ext.dest)) {
+                report_checksum_error("block " + std::to_string(ext.block));
+                return false;
+            }
+            blocks_verified++;
+        }
+        decode_data(buffer + ext.dest, ext.size);
+    }
+    return true;
+}
+
+void OmniStorage::start_stripe_readers() {
+    for (size_t i = 1; i < stripe_fds.size(); i++) {
+        std::unique_ptr<StripeReader> reader(new StripeReader());
+        reader->running = true;
+        reader->thread = std::thread(&OmniStorage::stripe_reader_loop, this, reader.get());
+        stripe_readers.push_back(std::move(reader));
+    }
+}
+
+void OmniStorage::stop_stripe_readers() {
+    for (auto& reader : stripe_readers) {
+        {
+            std::lock_guard<std::mutex> lock(reader->mutex);
+            reader->running = false;
+        }
+        reader->cv.notify_all();
+        reader->thread.join();
+    }
+    stripe_readers.clear();
+}
+
+// Queued jobs are finished even after stop, since a caller waits on each.
+void OmniStorage::stripe_reader_loop(StripeReader* reader) {
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    
+    while (true) {
+        reader->cv.wait(lock, [reader] { return !reader->running || !reader->jobs.empty(); });
+        if (reader->jobs.empty()) break;
+        
+        StripeJob job = reader->jobs.front();
+        reader->jobs.pop_front();
+        lock.unlock();
+        
+        bool ok = read_stripe_extents(*job.extents, job.read->buffer);
+        
+        // Notified under the lock: once outstanding reaches zero the caller
+        // may return and destroy the read.
+        {
+            std::lock_guard<std::mutex> done(job.read->mutex);
+            if (!ok) job.read->failed = true;
+            if (--job.read->outstanding == 0) job.read->done_cv.notify_one();
+        }
+        lock.lock();
+    }
+}
+
 void OmniStorage::encode_data(void* data, size_t size) {
     uint8_t* bytes = (uint8_t*)data;
     for (size_t i = 0; i < size; i++) {
@@ -412,11 +2142,37 @@ void OmniStorage::decode_data(void* data, size_t size) {
 }
 
 bool OmniStorage::add_user(const UserInfo& user) {
-    user_cache[user.username] = user;
-    return save_users();
+    bool saved;
+    {
+        std::lock_guard<std::mutex> lock(user_mutex);
+        UserInfo stored = user;
+        
+        auto existing = user_cache.find(user.username);
+        if (existing != user_cache.end()) {
+            stored.user_id = existing->second.user_id;
+            stored.file_count = existing->second.file_count;
+            stored.file_quota = existing->second.file_quota;
+            stored.bytes_used = existing->second.bytes_used;
+            stored.byte_quota = existing->second.byte_quota;
+        } else {
+            if (next_user_id > 0xFFFF) return false;
+            stored.user_id = next_user_id++;
+            stored.file_count = 0;
+            stored.file_quota = 0;
+            stored.bytes_used = 0;
+            stored.byte_quota = 0;
+            user_names[stored.user_id] = stored.username;
+        }
+        stored.reserved[0] = 0;
+        
+        user_cache[stored.username] = stored;
+        saved = save_users();
+    }
+    return saved && commit();
 }
 
 bool OmniStorage::get_user(const std::string& username, UserInfo* user) {
+    std::lock_guard<std::mutex> lock(user_mutex);
     auto it = user_cache.find(username);
     if (it != user_cache.end()) {
         *user = it->second;
@@ -429,7 +2185,41 @@ bool OmniStorage::update_user(const UserInfo& user) {
     return add_user(user);
 }
 
+bool OmniStorage::get_user_by_id(uint32_t user_id, UserInfo* user) {
+    std::lock_guard<std::mutex> lock(user_mutex);
+    auto name = user_names.find(user_id);
+    if (name == user_names.end()) return false;
+    
+    *user = user_cache[name->second];
+    return true;
+}
+
+bool OmniStorage::set_user_quota(const std::string& username, uint64_t byte_quota, uint32_t file_quota) {
+    {
+        std::lock_guard<std::mutex> lock(user_mutex);
+        auto it = user_cache.find(username);
+        if (it == user_cache.end()) return false;
+        
+        it->second.byte_quota = byte_quota;
+        it->second.file_quota = std::min<uint32_t>(file_quota, 0xFFFF);
+        if (!save_users()) return false;
+    }
+    return commit();
+}
+
+bool OmniStorage::within_quota(uint32_t owner_id, uint32_t files, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(user_mutex);
+    auto name = user_names.find(owner_id);
+    if (name == user_names.end()) return true;
+    
+    const UserInfo& user = user_cache[name->second];
+    if (user.file_quota != 0 && user.file_count + files > user.file_quota) return false;
+    if (user.byte_quota != 0 && user.bytes_used + bytes > user.byte_quota) return false;
+    return true;
+}
+
 std::vector<UserInfo> OmniStorage::list_users() {
+    std::lock_guard<std::mutex> lock(user_mutex);
     std::vector<UserInfo> users;
     for (const auto& pair : user_cache) {
         if (pair.second.is_active) {
@@ -439,22 +2229,33 @@ std::vector<UserInfo> OmniStorage::list_users() {
     return users;
 }
 
+uint64_t OmniStorage::get_total_size() {
+    return header.total_size;
+}
+
 uint64_t OmniStorage::get_free_space() {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
     uint32_t free_blocks = 0;
     for (uint8_t b : block_bitmap) {
-        if (b == 0) free_blocks++;
+        if (b == BLOCK_FREE) free_blocks++;
     }
-    return free_blocks * BLOCK_SIZE;
+    return (uint64_t)free_blocks * BLOCK_SIZE;
+}
+
+uint32_t OmniStorage::get_stripe_count() {
+    return std::max(header.stripe_count, 1u);
 }
 
 uint32_t OmniStorage::get_total_blocks() {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
     return block_bitmap.size();
 }
 
 uint32_t OmniStorage::get_used_blocks() {
+    std::lock_guard<std::mutex> alloc_lock(alloc_mutex);
     uint32_t used = 0;
     for (uint8_t b : block_bitmap) {
-        if (b == 1) used++;
+        if (b != BLOCK_FREE) used++;
     }
     return used;
 }
\ No newline at end of file
@@ -1,8 +1,8 @@
 #include "path_resolver.hpp"
 #include <algorithm>
-#include <sstream>
+#include <cctype>
 
-int PathResolver::validate_path(const std::string& path) {
+int PathResolver::validate_path(std::string_view path) {
     if (path.empty() || path[0] != '/') {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
     }
@@ -19,88 +19,113 @@ int PathResolver::validate_path(const std::string& path) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
     }
     
-    if (path.find("//") != std::string::npos) {
+    if (path.find("//") != std::string_view::npos) {
         return static_cast<int>(OFSErrorCodes::ERROR_INVALID_PATH);
     }
     
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-std::string PathResolver::normalize(const std::string& path) {
+std::string PathResolver::normalize(std::string_view path) {
     if (path.empty() || path[0] != '/') {
         return "/";
     }
     
-    std::vector<std::string> parts = split(path);
-    std::string result = "/";
+    PathComponents parts;
+    tokenize(path, &parts);
+    if (parts.empty()) return "/";
     
-    for (const auto& part : parts) {
-        if (!part.empty() && part != ".") {
-            result += part + "/";
-        }
-    }
-    
-    if (result.length() > 1 && result.back() == '/') {
-        result.pop_back();
+    std::string result;
+    result.reserve(path.size());
+    for (size_t i = 0; i < parts.size(); i++) {
+        result += '/';
+        result += parts[i];
     }
-    
     return result;
 }
 
-std::vector<std::string> PathResolver::split(const std::string& path) {
+void PathResolver::tokenize(std::string_view path, PathComponents* out) {
+    out->clear();
+    
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string_view::npos) end = path.size();
+        
+        std::string_view part = path.substr(start, end - start);
+        if (!part.empty() && part != ".") out->push_back(part);
+        start = end + 1;
+    }
+}
+
+// Unlike tokenize(), keeps "." components.
+std::vector<std::string> PathResolver::split(std::string_view path) {
     std::vector<std::string> parts;
-    std::stringstream ss(path);
-    std::string item;
     
-    while (std::getline(ss, item, '/')) {
-        if (!item.empty()) {
-            parts.push_back(item);
-        }
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string_view::npos) end = path.size();
+        
+        if (end > start) parts.emplace_back(path.substr(start, end - start));
+        start = end + 1;
     }
-    
     return parts;
 }
 
-std::string PathResolver::get_parent(const std::string& path) {
-    if (is_root(path)) {
-        return "/";
+std::string PathResolver::get_parent(std::string_view path) {
+    if (!is_canonical(path)) {
+        std::string normalized = normalize(path);
+        return normalized == "/" ? normalized : get_parent(normalized);
     }
     
-    std::string normalized = normalize(path);
-    size_t last_slash = normalized.find_last_of('/');
-    
+    size_t last_slash = path.find_last_of('/');
     if (last_slash == 0) {
         return "/";
     }
     
-    return normalized.substr(0, last_slash);
+    return std::string(path.substr(0, last_slash));
 }
 
-std::string PathResolver::get_filename(const std::string& path) {
-    if (is_root(path)) {
-        return "";
+std::string PathResolver::get_filename(std::string_view path) {
+    if (!is_canonical(path)) {
+        std::string normalized = normalize(path);
+        return normalized == "/" ? "" : get_filename(normalized);
     }
     
-    std::string normalized = normalize(path);
-    size_t last_slash = normalized.find_last_of('/');
-    
-    if (last_slash == std::string::npos) {
-        return normalized;
-    }
-    
-    return normalized.substr(last_slash + 1);
+    return std::string(path.substr(path.find_last_of('/') + 1));
 }
 
-std::string PathResolver::get_directory(const std::string& path) {
+std::string PathResolver::get_directory(std::string_view path) {
     return get_parent(path);
 }
 
-bool PathResolver::is_root(const std::string& path) {
-    std::string normalized = normalize(path);
-    return normalized == "/";
+bool PathResolver::is_root(std::string_view path) {
+    if (path.empty() || path[0] != '/') return true;
+    
+    PathComponents parts;
+    tokenize(path, &parts);
+    return parts.empty();
+}
+
+// "/" or "/a/b" with no empty or "." components and no trailing slash.
+bool PathResolver::is_canonical(std::string_view path) {
+    if (path.empty() || path[0] != '/') return false;
+    if (path.size() == 1) return true;
+    
+    size_t start = 1;
+    while (true) {
+        size_t end = path.find('/', start);
+        if (end == std::string_view::npos) end = path.size();
+        
+        std::string_view part = path.substr(start, end - start);
+        if (part.empty() || part == ".") return false;
+        if (end == path.size()) return true;
+        start = end + 1;
+    }
 }
 
-bool PathResolver::is_valid_filename(const std::string& filename) {
+bool PathResolver::is_valid_filename(std::string_view filename) {
     if (filename.empty() || filename.length() > MAX_FILENAME_LENGTH) {
         return false;
     }
@@ -111,7 +136,7 @@ bool PathResolver::is_valid_filename(const std::string& filename) {
     
     bool has_alnum = false;
     for (char c : filename) {
-        if (std::isalnum(c)) {
+        if (std::isalnum((unsigned char)c)) {
             has_alnum = true;
             break;
         }
@@ -120,22 +145,20 @@ bool PathResolver::is_valid_filename(const std::string& filename) {
     return has_alnum;
 }
 
-std::string PathResolver::combine(const std::string& dir, const std::string& file) {
-    std::string normalized_dir = normalize(dir);
+std::string PathResolver::combine(std::string_view dir, std::string_view file) {
+    std::string result = is_canonical(dir) ? std::string(dir) : normalize(dir);
     
-    if (is_root(normalized_dir)) {
-        return "/" + file;
-    }
-    
-    return normalized_dir + "/" + file;
+    if (result != "/") result += '/';
+    result += file;
+    return result;
 }
 
-bool PathResolver::contains_null_bytes(const std::string& path) {
-    return path.find('\0') != std::string::npos;
+bool PathResolver::contains_null_bytes(std::string_view path) {
+    return path.find('\0') != std::string_view::npos;
 }
 
-bool PathResolver::contains_path_traversal(const std::string& path) {
-    if (path.find("..") != std::string::npos) {
+bool PathResolver::contains_path_traversal(std::string_view path) {
+    if (path.find("..") != std::string_view::npos) {
         return true;
     }
     
@@ -117,6 +117,51 @@ int user_list(OFS_Session admin_session, UserInfo** out_users, int* out_count) {
     return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
+int user_usage(OFS_Session session, const std::string& username, std::vector<UserInfo>* out_users) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::string caller;
+    UserRole role;
+    int result = verify_session(session, caller, role);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) return result;
+    if (role != UserRole::ADMIN && username != caller) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    out_users->clear();
+    if (username.empty()) {
+        *out_users = g_storage->list_users();
+        return static_cast<int>(OFSErrorCodes::SUCCESS);
+    }
+    
+    UserInfo user;
+    if (!g_storage->get_user(username, &user)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    out_users->push_back(user);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+int user_set_quota(OFS_Session admin_session, const std::string& username, uint64_t byte_quota, uint32_t file_quota) {
+    if (!g_storage) return static_cast<int>(OFSErrorCodes::ERROR_IO_ERROR);
+    
+    std::string caller;
+    UserRole role;
+    int result = verify_session(admin_session, caller, role);
+    if (result != static_cast<int>(OFSErrorCodes::SUCCESS)) return result;
+    if (role != UserRole::ADMIN) {
+        return static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    }
+    
+    if (!g_storage->set_user_quota(username, byte_quota, file_quota)) {
+        return static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND);
+    }
+    
+    Logger::info("Quota set for " + username + ": " + std::to_string(byte_quota) + " bytes, " +
+                 std::to_string(file_quota) + " files", caller);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
 int get_session_info(OFS_Session session, SessionInfo* info) {
     std::lock_guard<std::mutex> lock(sessions_mutex);
     
@@ -0,0 +1,205 @@
+#include "executor.hpp"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+// The worker the current thread is, if it belongs to an executor.
+static thread_local Executor* current_executor = nullptr;
+static thread_local size_t current_worker = 0;
+
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point since,
+                           std::chrono::steady_clock::time_point until) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(until - since).count();
+}
+
+Executor::Executor()
+    : started(false), stopping(false), sleepers(0), pending(0), next_worker(0),
+      submitted(0), executed(0), steals(0) {
+    config = {0, 0, false};
+    for (auto& count : queued_by_priority) count = 0;
+}
+
+Executor::~Executor() {
+    stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    sleep_cv.notify_all();
+    
+    // Workers drain the queues before they exit, stealing from each other,
+    // so none is freed until all have stopped.
+    for (Worker* worker : workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+    for (Worker* worker : workers) delete worker;
+}
+
+// The CPUs this process may run on, at most `cores` of them.
+std::vector<int> Executor::pick_cpus(uint32_t cores) {
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < count; cpu++) cpus.push_back(cpu);
+    }
+    
+    if (cores > 0 && cores < cpus.size()) cpus.resize(cores);
+    return cpus;
+}
+
+void Executor::start(const ExecutorConfig& cfg) {
+    if (started) return;
+    started = true;
+    config = cfg;
+    
+    std::vector<int> cpus = pick_cpus(config.cores);
+    if (config.threads == 0) config.threads = 2 * cpus.size();
+    
+    // All deques exist before any worker starts stealing from them.
+    for (uint32_t i = 0; i < config.threads; i++) {
+        Worker* worker = new Worker();
+        worker->depth = 0;
+        worker->rng = 2654435761u * (i + 1);
+        worker->cpu = config.pin ? cpus[i % cpus.size()] : -1;
+        workers.push_back(worker);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread(&Executor::worker_main, this, i);
+    }
+}
+
+void Executor::submit(std::function<void()> run, TaskPriority priority) {
+    if (workers.empty()) {
+        run();
+        return;
+    }
+    
+    size_t index = current_executor == this ? current_worker : next_worker++ % workers.size();
+    Worker* worker = workers[index];
+    size_t level = static_cast<size_t>(priority);
+    
+    // The counts go up under the worker's mutex, which take() holds while
+    // bringing them down, so a task taken the moment it is queued cannot
+    // be counted out before it is counted in and wrap them below zero.
+    //
+    // A worker going to sleep registers before it looks at pending, and we
+    // look at sleepers after raising pending, so one of us sees the other.
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->queues[level].push_back({std::move(run), std::chrono::steady_clock::now()});
+        worker->depth++;
+        queued_by_priority[level]++;
+        pending++;
+    }
+    submitted++;
+    
+    if (sleepers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        sleep_cv.notify_one();
+    }
+}
+
+// Oldest task of the highest priority on the worker's deques.
+bool Executor::take(Worker* worker, Task* task) {
+    if (worker->depth == 0) return false;
+    
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (size_t level = 0; level < PRIORITIES; level++) {
+        std::deque<Task>& queue = worker->queues[level];
+        if (queue.empty()) continue;
+        
+        *task = std::move(queue.front());
+        queue.pop_front();
+        worker->depth--;
+        queued_by_priority[level]--;
+        pending--;
+        return true;
+    }
+    return false;
+}
+
+bool Executor::steal(size_t thief, Task* task) {
+    size_t count = workers.size();
+    if (count < 2) return false;
+    
+    uint32_t& rng = workers[thief]->rng;
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    
+    size_t start = rng % count;
+    for (size_t i = 0; i < count; i++) {
+        size_t victim = (start + i) % count;
+        if (victim == thief) continue;
+        if (take(workers[victim], task)) {
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::execute(Task& task) {
+    auto started_at = std::chrono::steady_clock::now();
+    wait_latency.record(elapsed_us(task.queued, started_at));
+    
+    task.run();
+    
+    run_latency.record(elapsed_us(started_at, std::chrono::steady_clock::now()));
+    executed++;
+}
+
+void Executor::worker_main(size_t index) {
+    Worker* self = workers[index];
+    current_executor = this;
+    current_worker = index;
+    
+    if (self->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(self->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    
+    while (true) {
+        Task task;
+        if (take(self, &task) || steal(index, &task)) {
+            execute(task);
+            continue;
+        }
+        if (stopping) return;
+        
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleepers++;
+        sleep_cv.wait(lock, [this] { return pending > 0 || stopping; });
+        sleepers--;
+    }
+}
+
+ExecutorStats Executor::get_stats() {
+    ExecutorStats stats;
+    stats.threads = workers.size();
+    stats.submitted = submitted;
+    stats.executed = executed;
+    stats.steals = steals;
+    stats.queued = 0;
+    for (size_t level = 0; level < PRIORITIES; level++) {
+        stats.queued_by_priority[level] = queued_by_priority[level];
+    }
+    for (Worker* worker : workers) {
+        uint64_t depth = worker->depth;
+        stats.queued_by_worker.push_back(depth);
+        stats.queued += depth;
+    }
+    stats.wait = wait_latency.summary();
+    stats.run = run_latency.summary();
+    return stats;
+}
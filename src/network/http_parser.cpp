@@ -0,0 +1,220 @@
+#include "http_parser.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+const std::string& HttpRequest::header(const std::string& name) const {
+    static const std::string none;
+    for (const auto& field : headers) {
+        if (field.first == name) return field.second;
+    }
+    return none;
+}
+
+static std::string to_lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+static std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos) return "";
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+HttpParser::HttpParser(uint64_t max_body) : max_body(max_body) {
+    reset();
+}
+
+void HttpParser::reset() {
+    state = REQUEST_LINE;
+    status = 0;
+    length_left = 0;
+    header_bytes = 0;
+    line.clear();
+    current = HttpRequest();
+    current.version_minor = 1;
+    current.body_remaining = 0;
+    current.keep_alive = false;
+}
+
+void HttpParser::fail(int error) {
+    state = FAILED;
+    status = error;
+}
+
+// Moves bytes up to and including the next '\n' into line. True once the
+// line is complete, without its line ending ("\r\n" or a bare "\n").
+bool HttpParser::take_line(const char* data, size_t size, size_t* pos) {
+    const char* start = data + *pos;
+    const char* newline = (const char*)memchr(start, '\n', size - *pos);
+    size_t length = newline ? newline - start : size - *pos;
+    
+    header_bytes += length + (newline ? 1 : 0);
+    if (header_bytes > MAX_HEADER_BYTES) {
+        fail(431);
+        return false;
+    }
+    
+    line.append(start, length);
+    *pos += length + (newline ? 1 : 0);
+    if (!newline) return false;
+    
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    return true;
+}
+
+bool HttpParser::parse_request_line() {
+    size_t method_end = line.find(' ');
+    size_t target_end = method_end == std::string::npos ? std::string::npos : line.find(' ', method_end + 1);
+    if (target_end == std::string::npos || target_end == method_end + 1) {
+        fail(400);
+        return false;
+    }
+    
+    std::string version = line.substr(target_end + 1);
+    if (version.size() != 8 || version.compare(0, 7, "HTTP/1.") != 0 || !isdigit((unsigned char)version[7])) {
+        fail(400);
+        return false;
+    }
+    
+    current.method = line.substr(0, method_end);
+    current.target = line.substr(method_end + 1, target_end - method_end - 1);
+    current.version_minor = version[7] - '0';
+    return true;
+}
+
+bool HttpParser::parse_header_line() {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0) {
+        fail(400);
+        return false;
+    }
+    current.headers.emplace_back(to_lower(line.substr(0, colon)), trim(line.substr(colon + 1)));
+    return true;
+}
+
+// At the end of the headers: decides persistence and how the body is
+// framed. A request with both Content-Length and Transfer-Encoding, or an
+// unparseable length, is refused, as a proxy might frame it differently.
+// Content-Length is not held to max_body here: the caller may leave a large
+// body for its handler to read off the socket (see body_pending()).
+bool HttpParser::start_body() {
+    std::string connection = to_lower(current.header("connection"));
+    current.keep_alive = current.version_minor >= 1 && connection.find("close") == std::string::npos;
+    
+    const std::string& encoding = current.header("transfer-encoding");
+    const std::string& length = current.header("content-length");
+    
+    if (!encoding.empty()) {
+        if (!length.empty()) {
+            fail(400);
+            return false;
+        }
+        if (to_lower(encoding) != "chunked") {
+            fail(501);
+            return false;
+        }
+        state = CHUNK_SIZE;
+        header_bytes = 0;
+        return true;
+    }
+    
+    if (length.empty()) {
+        state = DONE;
+        return true;
+    }
+    if (length.find_first_not_of("0123456789") != std::string::npos || length.size() > 18) {
+        fail(400);
+        return false;
+    }
+    
+    length_left = std::stoull(length);
+    state = length_left > 0 ? BODY : DONE;
+    return true;
+}
+
+bool HttpParser::parse_chunk_size() {
+    // Chunk extensions after ';' are ignored.
+    std::string size = trim(line.substr(0, line.find(';')));
+    if (size.empty() || size.size() > 15 || size.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        fail(400);
+        return false;
+    }
+    
+    length_left = std::stoull(size, nullptr, 16);
+    if (current.body.size() + length_left > max_body) {
+        fail(413);
+        return false;
+    }
+    state = length_left > 0 ? CHUNK_DATA : TRAILERS;
+    return true;
+}
+
+size_t HttpParser::feed(const char* data, size_t size) {
+    size_t pos = 0;
+    
+    while (pos < size && state != DONE && state != FAILED) {
+        switch (state) {
+        case REQUEST_LINE:
+            if (!take_line(data, size, &pos)) break;
+            // Blank lines before a request are tolerated (RFC 9112 2.2).
+            if (!line.empty() && parse_request_line()) state = HEADERS;
+            line.clear();
+            break;
+        
+        case HEADERS:
+            if (!take_line(data, size, &pos)) break;
+            if (line.empty()) start_body();
+            else parse_header_line();
+            line.clear();
+            break;
+        
+        case BODY: {
+            size_t part = std::min<uint64_t>(length_left, size - pos);
+            current.body.append(data + pos, part);
+            pos += part;
+            length_left -= part;
+            if (length_left == 0) state = DONE;
+            break;
+        }
+        
+        case CHUNK_SIZE:
+            if (!take_line(data, size, &pos)) break;
+            parse_chunk_size();
+            line.clear();
+            break;
+        
+        case CHUNK_DATA: {
+            size_t part = std::min<uint64_t>(length_left, size - pos);
+            current.body.append(data + pos, part);
+            pos += part;
+            length_left -= part;
+            if (length_left == 0) state = CHUNK_END;
+            break;
+        }
+        
+        case CHUNK_END:
+            if (!take_line(data, size, &pos)) break;
+            if (!line.empty()) {
+                fail(400);
+                break;
+            }
+            // Chunk size lines get the header budget afresh.
+            state = CHUNK_SIZE;
+            header_bytes = 0;
+            line.clear();
+            break;
+        
+        case TRAILERS:
+            if (!take_line(data, size, &pos)) break;
+            if (line.empty()) state = DONE;
+            line.clear();
+            break;
+        
+        default:
+            break;
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,558 @@
+#include "reactor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <strings.h>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define EPOLL_BATCH 256
+#define ACCEPT_BATCH 64
+#define READ_CHUNK 65536
+#define TIMER_TICK_MS 1000
+
+static const RequestClass DEFAULT_CLASS = {RequestKind::NORMAL, TaskPriority::NORMAL};
+
+struct Reactor::Connection {
+    explicit Connection(uint64_t max_body)
+        : fd(-1), loop(nullptr), parser(max_body), out_sent(0), request_class(DEFAULT_CLASS),
+          classified(false), continue_sent(false), busy(false), keep_alive(false),
+          eof(false), peer_closed(false), closed(false), idle(false) {}
+    
+    int fd;
+    Loop* loop;
+    HttpParser parser;
+    std::string in;                 // read but not yet parsed: pipelined requests
+    std::string out;
+    size_t out_sent;
+    
+    RequestClass request_class;     // of the request being parsed, once classified
+    bool classified;
+    bool continue_sent;
+    bool busy;                      // a handler has its request
+    bool keep_alive;                // after the response being written
+    bool eof;                       // the client has shut down its side
+    bool peer_closed;               // hung up or reset: nobody to answer
+    bool closed;
+    
+    std::chrono::steady_clock::time_point dispatched;
+    std::chrono::steady_clock::time_point deadline;
+    bool idle;                      // on the loop's idle list, i.e. not busy
+    std::list<Connection*>::iterator idle_pos;
+};
+
+struct Reactor::Completion {
+    Connection* conn;
+    std::string response;
+    bool keep_alive;
+};
+
+struct Reactor::Loop {
+    int epoll_fd;
+    int wake_fd;
+    std::thread thread;
+    
+    // Handed back by handlers, finished by the loop.
+    std::mutex done_mutex;
+    std::vector<Completion> done;
+    
+    // Connections not held by a handler, oldest deadline first.
+    std::list<Connection*> idle;
+    
+    // Closed during the current batch of events, which may still name them.
+    std::vector<Connection*> closed;
+};
+
+static uint64_t now_seconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Reactor::Reactor(Executor* executor)
+    : listen_fd(-1), executor(executor), loops_started(false), stopping(false), connections(0),
+      accepted(0), rejected(0), timeouts(0), long_lived(0), long_lived_rejected(0), requests(0) {
+    memset(&config, 0, sizeof(config));
+    for (auto& slot : rate_slots) {
+        slot.second = 0;
+        slot.count = 0;
+    }
+}
+
+bool Reactor::listen_on(const ReactorConfig& cfg) {
+    config = cfg;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    if (config.loop_threads == 0) config.loop_threads = cores;
+    if (config.backlog == 0) config.backlog = SOMAXCONN;
+    if (config.idle_timeout_ms == 0) config.idle_timeout_ms = 60000;
+    if (config.max_long_lived == 0) config.max_long_lived = 256;
+    
+    // Every connection is a descriptor; idle clients should not run into
+    // the default soft limit of 1024.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) return false;
+    
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(config.port);
+    
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, config.backlog) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void Reactor::run(Handler request_handler, Classifier request_classifier) {
+    handler = std::move(request_handler);
+    classify = std::move(request_classifier);
+    
+    // The listening socket is in every loop's epoll set. EPOLLEXCLUSIVE
+    // wakes one loop per connection burst rather than all of them.
+    for (uint32_t i = 0; i < config.loop_threads; i++) {
+        Loop* loop = new Loop();
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = nullptr;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+        
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = loop;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event);
+        
+        loops.push_back(loop);
+    }
+    loops_started = true;
+    
+    for (size_t i = 1; i < loops.size(); i++) {
+        loops[i]->thread = std::thread(&Reactor::loop_main, this, loops[i]);
+    }
+    loop_main(loops[0]);
+    
+    for (size_t i = 1; i < loops.size(); i++) loops[i]->thread.join();
+    close(listen_fd);
+    listen_fd = -1;
+    
+    // Loops and connections are left in place: handlers still running
+    // complete into them.
+}
+
+// Only touches atomics and write(). A stop before the loops exist is seen
+// when they first check the flag.
+void Reactor::stop() {
+    stopping = true;
+    if (!loops_started) return;
+    uint64_t one = 1;
+    for (Loop* loop : loops) {
+        ssize_t written = write(loop->wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void Reactor::loop_main(Loop* loop) {
+    struct epoll_event events[EPOLL_BATCH];
+    
+    while (!stopping) {
+        int count = epoll_wait(loop->epoll_fd, events, EPOLL_BATCH, TIMER_TICK_MS);
+        if (count < 0 && errno == EINTR) continue;
+        
+        for (int i = 0; i < count; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == nullptr) {
+                accept_ready(loop);
+                continue;
+            }
+            if (tag == loop) {
+                uint64_t value;
+                while (read(loop->wake_fd, &value, sizeof(value)) > 0) {}
+                finish_completed(loop);
+                continue;
+            }
+            
+            Connection* conn = (Connection*)tag;
+            uint32_t ready = events[i].events;
+            if (conn->closed) continue;
+            
+            if (ready & (EPOLLHUP | EPOLLERR)) {
+                conn->peer_closed = true;
+                if (!conn->busy) {
+                    close_connection(conn);
+                    continue;
+                }
+            }
+            if (ready & EPOLLIN) read_ready(conn);
+            if ((ready & EPOLLOUT) && !conn->closed) write_ready(conn);
+        }
+        
+        expire_idle(loop);
+        for (Connection* conn : loop->closed) delete conn;
+        loop->closed.clear();
+    }
+}
+
+void Reactor::accept_ready(Loop* loop) {
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        
+        if (connections >= config.max_connections) {
+            close(fd);
+            rejected++;
+            continue;
+        }
+        
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        
+        Connection* conn = new Connection(config.max_body);
+        conn->fd = fd;
+        conn->loop = loop;
+        
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            delete conn;
+            continue;
+        }
+        connections++;
+        accepted++;
+        touch(conn);
+    }
+}
+
+// Restarts the connection's idle timeout and moves it to the back of its
+// loop's idle list, which therefore stays in deadline order.
+void Reactor::touch(Connection* conn) {
+    Loop* loop = conn->loop;
+    conn->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.idle_timeout_ms);
+    
+    if (conn->idle) loop->idle.erase(conn->idle_pos);
+    conn->idle_pos = loop->idle.insert(loop->idle.end(), conn);
+    conn->idle = true;
+}
+
+void Reactor::untrack(Connection* conn) {
+    if (!conn->idle) return;
+    conn->loop->idle.erase(conn->idle_pos);
+    conn->idle = false;
+}
+
+// Closes connections that have sat idle, or taken too long to send their
+// request headers, for idle_timeout_ms.
+void Reactor::expire_idle(Loop* loop) {
+    auto now = std::chrono::steady_clock::now();
+    while (!loop->idle.empty() && loop->idle.front()->deadline <= now) {
+        close_connection(loop->idle.front());
+        timeouts++;
+    }
+}
+
+void Reactor::read_ready(Connection* conn) {
+    char buffer[READ_CHUNK];
+    
+    // Edge-triggered: read until EAGAIN, unless a request is dispatched
+    // first; the loop comes back for the rest when its response is out.
+    while (!conn->busy && !conn->closed && !conn->eof) {
+        ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) {
+            close_connection(conn);
+            return;
+        }
+        if (n == 0) {
+            conn->eof = true;
+            break;
+        }
+        
+        conn->in.append(buffer, n);
+        parse_input(conn);
+    }
+    
+    // A client may send a request and shut down writing while it waits for
+    // the response; one that has done so with no request pending is gone.
+    if (conn->eof && !conn->busy && !conn->closed && conn->out_sent >= conn->out.size()) {
+        close_connection(conn);
+    }
+}
+
+// Feeds buffered input to the connection's parser, dispatching the
+// request once it is complete.
+void Reactor::parse_input(Connection* conn) {
+    HttpParser& parser = conn->parser;
+    size_t used = parser.feed(conn->in.data(), conn->in.size());
+    conn->in.erase(0, used);
+    
+    if (parser.failed()) {
+        reply_error(conn, parser.error_status());
+        return;
+    }
+    if (!parser.headers_done()) return;
+    
+    // The body is arriving, which counts as activity; headers do not, so a
+    // client cannot hold a connection by trickling them.
+    touch(conn);
+    
+    if (parser.done()) {
+        dispatch(conn);
+        return;
+    }
+    
+    HttpRequest& request = parser.request();
+    if (!conn->classified) {
+        conn->request_class = classify ? classify(request) : DEFAULT_CLASS;
+        conn->classified = true;
+    }
+    
+    // A streamed body is left on the socket for the handler, unless it is
+    // chunked and has to be decoded here.
+    if (conn->request_class.kind == RequestKind::STREAMED && parser.body_pending() > 0) {
+        request.body_remaining = parser.body_pending();
+        request.keep_alive = false;
+        dispatch(conn);
+        return;
+    }
+    
+    if (request.body.size() + parser.body_pending() > config.max_body) {
+        reply_error(conn, 413);
+        return;
+    }
+    
+    if (!conn->continue_sent && request.body.empty() &&
+        strcasecmp(request.header("expect").c_str(), "100-continue") == 0) {
+        // Nothing else is queued on an idle connection, so this short write
+        // goes out whole or the connection is broken anyway.
+        static const char go_ahead[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        ssize_t sent = send(conn->fd, go_ahead, sizeof(go_ahead) - 1, MSG_NOSIGNAL);
+        (void)sent;
+        conn->continue_sent = true;
+    }
+}
+
+void Reactor::reply_error(Connection* conn, int status) {
+    const char* reason = status == 413 ? "Payload Too Large"
+                       : status == 431 ? "Request Header Fields Too Large"
+                       : status == 501 ? "Not Implemented"
+                       : "Bad Request";
+    
+    conn->out = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n"
+                "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    conn->out_sent = 0;
+    conn->keep_alive = false;
+    flush(conn);
+}
+
+void Reactor::write_ready(Connection* conn) {
+    if (conn->busy || conn->out_sent >= conn->out.size()) return;
+    flush(conn);
+}
+
+// Writes what the socket takes of the pending response; EPOLLOUT resumes
+// it. Once it is all out, the connection either closes or goes on to the
+// next request.
+void Reactor::flush(Connection* conn) {
+    size_t before = conn->out_sent;
+    while (conn->out_sent < conn->out.size()) {
+        ssize_t sent = send(conn->fd, conn->out.data() + conn->out_sent,
+                            conn->out.size() - conn->out_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (conn->out_sent > before) touch(conn);
+            return;
+        }
+        if (sent <= 0) {
+            close_connection(conn);
+            return;
+        }
+        conn->out_sent += sent;
+    }
+    
+    conn->out.clear();
+    conn->out_sent = 0;
+    response_done(conn);
+}
+
+void Reactor::response_done(Connection* conn) {
+    if (!conn->keep_alive || conn->peer_closed) {
+        close_connection(conn);
+        return;
+    }
+    
+    conn->classified = false;
+    conn->continue_sent = false;
+    touch(conn);
+    
+    // Pipelined requests already read come first.
+    if (!conn->in.empty()) parse_input(conn);
+    if (!conn->busy && !conn->closed) read_ready(conn);
+}
+
+void Reactor::dispatch(Connection* conn) {
+    HttpParser& parser = conn->parser;
+    RequestClass request_class = conn->classified ? conn->request_class
+                               : classify ? classify(parser.request()) : DEFAULT_CLASS;
+    
+    auto request = std::make_shared<HttpRequest>(std::move(parser.request()));
+    parser.reset();
+    
+    conn->busy = true;
+    conn->dispatched = std::chrono::steady_clock::now();
+    untrack(conn);
+    
+    auto task = [this, conn, request]() {
+        std::string response = handler(*request, conn->fd);
+        complete(conn, std::move(response), request->keep_alive);
+    };
+    
+    if (request_class.kind == RequestKind::LONG_LIVED) {
+        // A thread each, so their number is capped. Clients past it are
+        // told to retry rather than queued behind requests that may park
+        // for a long time.
+        if (long_lived.fetch_add(1) >= config.max_long_lived) {
+            long_lived--;
+            long_lived_rejected++;
+            std::string response = "HTTP/1.1 503 Service Unavailable\r\n"
+                                   "Content-Length: 0\r\nRetry-After: 1\r\n";
+            if (!request->keep_alive) response += "Connection: close\r\n";
+            complete(conn, response + "\r\n", request->keep_alive);
+            return;
+        }
+        std::thread([this, task] {
+            task();
+            long_lived--;
+        }).detach();
+    } else {
+        executor->submit(std::move(task), request_class.priority);
+    }
+}
+
+// Runs on the handler's thread. The connection stays busy, and its socket open,
+// until its loop has taken it back.
+void Reactor::complete(Connection* conn, std::string response, bool keep_alive) {
+    auto elapsed = std::chrono::steady_clock::now() - conn->dispatched;
+    record_request(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    
+    Loop* loop = conn->loop;
+    {
+        std::lock_guard<std::mutex> lock(loop->done_mutex);
+        loop->done.push_back({conn, std::move(response), keep_alive});
+    }
+    uint64_t one = 1;
+    ssize_t written = write(loop->wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+void Reactor::finish_completed(Loop* loop) {
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(loop->done_mutex);
+        done.swap(loop->done);
+    }
+    
+    for (Completion& item : done) {
+        Connection* conn = item.conn;
+        conn->busy = false;
+        conn->keep_alive = item.keep_alive;
+        conn->out = std::move(item.response);
+        conn->out_sent = 0;
+        
+        if (conn->peer_closed) {
+            close_connection(conn);
+            continue;
+        }
+        touch(conn);
+        flush(conn);
+    }
+}
+
+void Reactor::close_connection(Connection* conn) {
+    untrack(conn);
+    close(conn->fd);
+    conn->closed = true;
+    conn->loop->closed.push_back(conn);
+    connections--;
+}
+
+bool Reactor::wait_ready(int fd, short events) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    
+    while (true) {
+        int ready = poll(&pfd, 1, IO_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR) continue;
+        return ready > 0 && !(pfd.revents & (POLLERR | POLLNVAL));
+    }
+}
+
+void Reactor::record_request(uint64_t latency_us) {
+    requests++;
+    latency.record(latency_us);
+    
+    // Per-second counts for the request rate. A slot is reset by the first
+    // request of its second; a count racing that reset may be lost, which
+    // is fine for a rate.
+    uint64_t second = now_seconds();
+    RateSlot& slot = rate_slots[second % RATE_SLOTS];
+    uint64_t stamp = slot.second;
+    if (stamp != second && slot.second.compare_exchange_strong(stamp, second)) {
+        slot.count = 0;
+    }
+    slot.count++;
+}
+
+ReactorStats Reactor::get_stats() {
+    ReactorStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.requests = requests;
+    stats.connections = connections;
+    stats.accepted = accepted;
+    stats.rejected = rejected;
+    stats.timeouts = timeouts;
+    stats.long_lived = long_lived;
+    stats.long_lived_rejected = long_lived_rejected;
+    
+    // Completed seconds only; the current one is still filling.
+    uint64_t second = now_seconds();
+    uint64_t recent = 0;
+    for (const RateSlot& slot : rate_slots) {
+        uint64_t stamp = slot.second;
+        if (stamp < second && stamp + RATE_WINDOW >= second) recent += slot.count;
+    }
+    stats.requests_per_sec = recent / RATE_WINDOW;
+    
+    LatencySummary summary = latency.summary();
+    stats.latency_p50_us = summary.p50_us;
+    stats.latency_p99_us = summary.p99_us;
+    stats.latency_max_us = summary.max_us;
+    return stats;
+}
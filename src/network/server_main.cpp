@@ -3,23 +3,42 @@
 #include <sstream>
 #include <fstream>
 #include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <map>
 #include <set>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <ctime>
 #include "omni_storage.hpp"
 #include "file_ops.hpp"
 #include "user_manager.hpp"
 #include "logger.hpp"
+#include "config_parser.hpp"
+#include "json_reader.hpp"
+#include "executor.hpp"
+#include "reactor.hpp"
+
+#define WATCH_POLL_MAX_MS 25000
+#define CHANGES_PAGE_MAX 1000
 
 OmniStorage* g_storage = nullptr;
+Executor* g_executor = nullptr;
+Reactor* g_reactor = nullptr;
 
 struct SessionData {
     std::string username;
+    OFS_Session ofs_session;
     uint64_t login_time;
     uint64_t last_activity;
 };
@@ -39,10 +58,11 @@ bool is_user_logged_in(const std::string& username) {
     return logged_in;
 }
 
-void add_session(const std::string& session_id, const std::string& username) {
+void add_session(const std::string& session_id, const std::string& username, OFS_Session ofs_session) {
     pthread_mutex_lock(&session_mutex);
     SessionData data;
     data.username = username;
+    data.ofs_session = ofs_session;
     data.login_time = time(nullptr);
     data.last_activity = time(nullptr);
     active_sessions[session_id] = data;
@@ -54,6 +74,7 @@ void remove_session(const std::string& session_id) {
     pthread_mutex_lock(&session_mutex);
     auto it = active_sessions.find(session_id);
     if (it != active_sessions.end()) {
+        user_logout(it->second.ofs_session);
         logged_in_users.erase(it->second.username);
         active_sessions.erase(it);
     }
@@ -68,28 +89,62 @@ std::string get_username_from_session(const std::string& session_id) {
     return username;
 }
 
-std::string extract_json_string(const std::string& json_str, const std::string& key) {
-    size_t pos = json_str.find("\"" + key + "\"");
-    if (pos == std::string::npos) return "";
-    pos = json_str.find(":", pos);
-    pos = json_str.find("\"", pos);
-    size_t end_pos = json_str.find("\"", pos + 1);
-    if (pos != std::string::npos && end_pos != std::string::npos) {
-        return json_str.substr(pos + 1, end_pos - pos - 1);
+// The storage session behind session_id, which decides who owns and is
+// charged for what the request creates. Null if it is not logged in.
+OFS_Session get_ofs_session(const std::string& session_id) {
+    pthread_mutex_lock(&session_mutex);
+    auto it = active_sessions.find(session_id);
+    OFS_Session session = (it != active_sessions.end()) ? it->second.ofs_session : nullptr;
+    pthread_mutex_unlock(&session_mutex);
+    return session;
+}
+
+std::string get_query_param(const std::string& query, const std::string& key) {
+    std::stringstream ss(query);
+    std::string pair;
+    while (std::getline(ss, pair, '&')) {
+        size_t eq = pair.find('=');
+        if (eq == std::string::npos || pair.compare(0, eq, key) != 0) continue;
+        
+        // Percent-decoded, so paths can be passed with encodeURIComponent.
+        std::string value;
+        for (size_t i = eq + 1; i < pair.size(); i++) {
+            if (pair[i] == '%' && i + 2 < pair.size() && isxdigit((unsigned char)pair[i + 1]) &&
+                isxdigit((unsigned char)pair[i + 2])) {
+                value += (char)std::stoi(pair.substr(i + 1, 2), nullptr, 16);
+                i += 2;
+            } else {
+                value += pair[i] == '+' ? ' ' : pair[i];
+            }
+        }
+        return value;
     }
     return "";
 }
 
+uint64_t parse_u64(const std::string& str) {
+    try {
+        return std::stoull(str);
+    } catch (...) {
+        return 0;
+    }
+}
+
+void append_json_escaped(std::string& out, const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+        if (c == '"') out += "\\\"";
+        else if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\t') out += "\\t";
+        else out += c;
+    }
+}
+
 std::string escape_json_string(const std::string& str) {
     std::string result;
-    for (char c : str) {
-        if (c == '"') result += "\\\"";
-        else if (c == '\\') result += "\\\\";
-        else if (c == '\n') result += "\\n";
-        else if (c == '\r') result += "\\r";
-        else if (c == '\t') result += "\\t";
-        else result += c;
-    }
+    append_json_escaped(result, str.data(), str.size());
     return result;
 }
 
@@ -98,6 +153,129 @@ std::string json_response(bool success, const std::string& message) {
            ",\"message\":\"" + escape_json_string(message) + "\"}";
 }
 
+// keep_alive false announces that the connection closes after this
+// response; otherwise HTTP/1.1 persistence applies.
+std::string http_json_response(const std::string& json, bool keep_alive = true,
+                               const char* status = "200 OK") {
+    std::string http_response = std::string("HTTP/1.1 ") + status + "\r\n";
+    http_response += "Content-Type: application/json\r\n";
+    http_response += "Content-Length: " + std::to_string(json.length()) + "\r\n";
+    http_response += "Access-Control-Allow-Origin: *\r\n";
+    if (!keep_alive) http_response += "Connection: close\r\n";
+    http_response += "\r\n";
+    http_response += json;
+    return http_response;
+}
+
+bool send_all(int client_socket, const char* data, size_t size, int flags = 0) {
+    while (size > 0) {
+        ssize_t sent = send(client_socket, data, size, flags | MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && errno == EAGAIN && Reactor::wait_ready(client_socket, POLLOUT)) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// writev() through sendmsg(), for MSG_NOSIGNAL. Resumes after partial
+// writes, advancing iov as it goes.
+bool send_iov(int client_socket, std::vector<struct iovec>& iov) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        if (iov[first].iov_len == 0) {
+            first++;
+            continue;
+        }
+        
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov[first];
+        msg.msg_iovlen = std::min(iov.size() - first, (size_t)IOV_MAX);
+        
+        ssize_t sent = sendmsg(client_socket, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && errno == EAGAIN && Reactor::wait_ready(client_socket, POLLOUT)) continue;
+        if (sent <= 0) return false;
+        
+        while (sent > 0) {
+            size_t part = std::min((size_t)sent, iov[first].iov_len);
+            iov[first].iov_base = (char*)iov[first].iov_base + part;
+            iov[first].iov_len -= part;
+            sent -= part;
+            if (iov[first].iov_len == 0) first++;
+        }
+    }
+    return true;
+}
+
+// One chunk of a Transfer-Encoding: chunked body, framing and data in a
+// single write.
+bool send_chunk(int client_socket, const char* data, size_t size) {
+    if (size == 0) return true;
+    
+    char head[24];
+    int head_len = snprintf(head, sizeof(head), "%zx\r\n", size);
+    std::vector<struct iovec> iov = {
+        {head, (size_t)head_len}, {(void*)data, size}, {(void*)"\r\n", 2}
+    };
+    return send_iov(client_socket, iov);
+}
+
+// Payload bytes copied while escaping file content for JSON responses.
+static std::atomic<uint64_t> g_escape_bytes_copied(0);
+
+// Sends chunk as a JSON string fragment. Runs that need no escaping go out
+// straight from the chunk, interleaved with the two-byte escapes, unless
+// escapes are dense enough that one escaped copy is cheaper to send.
+bool send_json_chunk(int client_socket, const SharedBuffer& chunk) {
+    const char* data = (const char*)chunk.data();
+    size_t size = chunk.size();
+    if (size == 0) return true;
+    
+    auto escape = [](char c) -> const char* {
+        switch (c) {
+        case '"': return "\\\"";
+        case '\\': return "\\\\";
+        case '\n': return "\\n";
+        case '\r': return "\\r";
+        case '\t': return "\\t";
+        default: return nullptr;
+        }
+    };
+    
+    size_t escapes = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (escape(data[i])) escapes++;
+    }
+    
+    if (escapes * 64 > size) {
+        std::string escaped;
+        append_json_escaped(escaped, data, size);
+        g_escape_bytes_copied += size;
+        return send_chunk(client_socket, escaped.data(), escaped.size());
+    }
+    
+    char head[24];
+    std::vector<struct iovec> iov(1);
+    size_t run = 0;
+    for (size_t i = 0; i < size; i++) {
+        const char* sequence = escape(data[i]);
+        if (!sequence) continue;
+        
+        if (i > run) iov.push_back({(void*)(data + run), i - run});
+        iov.push_back({(void*)sequence, 2});
+        run = i + 1;
+    }
+    if (size > run) iov.push_back({(void*)(data + run), size - run});
+    
+    int head_len = snprintf(head, sizeof(head), "%zx\r\n", size + escapes);
+    iov[0] = {head, (size_t)head_len};
+    iov.push_back({(void*)"\r\n", 2});
+    return send_iov(client_socket, iov);
+}
+
 std::string get_mime_type(const std::string& filename) {
     if (filename.find(".html") != std::string::npos) return "text/html";
     if (filename.find(".css") != std::string::npos) return "text/css";
@@ -117,12 +295,12 @@ std::string serve_static_file(const std::string& path) {
     std::string filename = "." + path;
     
     if (filename.find("..") != std::string::npos) {
-        return "HTTP/1.1 403 Forbidden\r\n\r\n403 Forbidden";
+        return "HTTP/1.1 403 Forbidden\r\nContent-Length: 13\r\n\r\n403 Forbidden";
     }
     
     struct stat buffer;
     if (stat(filename.c_str(), &buffer) != 0) {
-        return "HTTP/1.1 404 Not Found\r\n\r\n404 Not Found";
+        return "HTTP/1.1 404 Not Found\r\nContent-Length: 13\r\n\r\n404 Not Found";
     }
     
     std::string content = read_file(filename);
@@ -139,9 +317,9 @@ std::string serve_static_file(const std::string& path) {
     return response;
 }
 
-std::string handle_login(const std::string& body) {
-    std::string username = extract_json_string(body, "username");
-    std::string password = extract_json_string(body, "password");
+std::string handle_login(const JsonObject& body) {
+    std::string username = body.get_string("username");
+    std::string password = body.get_string("password");
     
     if (username.empty() || password.empty()) {
         return json_response(false, "Missing credentials");
@@ -156,7 +334,7 @@ std::string handle_login(const std::string& body) {
     
     if (result == 0) {
         std::string sid = generate_session_id(username);
-        add_session(sid, username);
+        add_session(sid, username, session);
         Logger::info("[LOGIN] " + username);
         return "{\"success\":true,\"message\":\"Login successful\",\"session_id\":\"" + sid + "\",\"username\":\"" + username + "\"}";
     }
@@ -164,8 +342,8 @@ std::string handle_login(const std::string& body) {
     return json_response(false, "Invalid username or password");
 }
 
-std::string handle_logout(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
+std::string handle_logout(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
     
     if (session_id.empty()) {
         return json_response(false, "No session");
@@ -181,9 +359,9 @@ std::string handle_logout(const std::string& body) {
     return json_response(false, "Invalid session");
 }
 
-std::string handle_signup(const std::string& body) {
-    std::string username = extract_json_string(body, "username");
-    std::string password = extract_json_string(body, "password");
+std::string handle_signup(const JsonObject& body) {
+    std::string username = body.get_string("username");
+    std::string password = body.get_string("password");
     
     if (username.length() < 3 || username.length() > 31) {
         return json_response(false, "Username must be 3-31 characters");
@@ -203,10 +381,10 @@ std::string handle_signup(const std::string& body) {
     return json_response(false, "Username already exists");
 }
 
-std::string handle_file_create(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
-    std::string path = extract_json_string(body, "path");
-    std::string content = extract_json_string(body, "content");
+std::string handle_file_create(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    std::string content = body.get_string("content");
     
     if (path.empty()) return json_response(false, "No path specified");
     
@@ -215,7 +393,7 @@ std::string handle_file_create(const std::string& body) {
         return json_response(false, "Invalid session");
     }
     
-    int result = file_create(nullptr, path, content.c_str(), content.length());
+    int result = file_create(get_ofs_session(session_id), path, content.c_str(), content.length());
     
     if (result == 0) {
         Logger::info("[FILE] Create: " + path, username);
@@ -225,9 +403,73 @@ std::string handle_file_create(const std::string& body) {
     return json_response(false, get_error_message(result));
 }
 
-std::string handle_file_read(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
-    std::string path = extract_json_string(body, "path");
+// Streams the file as a chunked response, one block at a time, so memory
+// stays bounded whatever the file size. The JSON envelope matches the other
+// endpoints; "format":"raw" sends the bytes as application/octet-stream.
+void stream_file_read(int client_socket, HttpRequest& request) {
+    JsonObject body(request.body);
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    bool raw = body.get_string("format") == "raw";
+    
+    std::string error;
+    if (!body.valid()) {
+        error = json_response(false, "Malformed JSON body");
+    } else if (path.empty()) {
+        error = json_response(false, "No path specified");
+    } else if (get_username_from_session(session_id).empty()) {
+        error = json_response(false, "Invalid session");
+    }
+    if (!error.empty()) {
+        std::string response = http_json_response(error);
+        send_all(client_socket, response.data(), response.size());
+        return;
+    }
+    std::string username = get_username_from_session(session_id);
+    
+    bool started = false;
+    
+    auto on_open = [&](uint64_t size) {
+        std::string head = "HTTP/1.1 200 OK\r\n";
+        head += std::string("Content-Type: ") + (raw ? "application/octet-stream" : "application/json") + "\r\n";
+        head += "Transfer-Encoding: chunked\r\n";
+        if (!request.keep_alive) head += "Connection: close\r\n";
+        head += "Access-Control-Allow-Origin: *\r\n\r\n";
+        started = true;
+        
+        static const char prefix[] = "{\"success\":true,\"content\":\"";
+        return send_all(client_socket, head.data(), head.size(), MSG_MORE) &&
+               (raw || send_chunk(client_socket, prefix, sizeof(prefix) - 1));
+    };
+    
+    auto on_chunk = [&](const SharedBuffer& chunk) {
+        if (raw) return send_chunk(client_socket, (const char*)chunk.data(), chunk.size());
+        return send_json_chunk(client_socket, chunk);
+    };
+    
+    int result = file_read_stream(nullptr, path, on_open, on_chunk);
+    
+    if (!started) {
+        std::string response = http_json_response(json_response(false, get_error_message(result)));
+        send_all(client_socket, response.data(), response.size());
+        return;
+    }
+    
+    // On a mid-stream failure the body is left unterminated and the
+    // connection closed, so the client sees a truncated transfer rather
+    // than a short file.
+    if (result == 0) {
+        if (!raw) send_chunk(client_socket, "\"}", 2);
+        send_all(client_socket, "0\r\n\r\n", 5);
+        Logger::info("[FILE] Read: " + path, username);
+    } else {
+        request.keep_alive = false;
+    }
+}
+
+std::string handle_upload_begin(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
     
     if (path.empty()) return json_response(false, "No path specified");
     
@@ -236,24 +478,339 @@ std::string handle_file_read(const std::string& body) {
         return json_response(false, "Invalid session");
     }
     
-    void* buffer;
-    size_t size;
-    int result = file_read(nullptr, path, &buffer, &size);
+    uint64_t upload_id = 0;
+    int result = upload_begin(get_ofs_session(session_id), path, &upload_id);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    return "{\"success\":true,\"upload_id\":\"" + std::to_string(upload_id) + "\"}";
+}
+
+// Raw-body endpoint: POST /file/upload/chunk?session_id=..&upload_id=..
+// The request is dispatched as soon as its headers are in. What body
+// arrived with them is in request.body; the rest is read off the socket in
+// block-sized pieces and appended to the upload as it arrives, so it can
+// be any length. A chunked body is decoded in full before dispatch.
+void stream_upload_chunk(int client_socket, HttpRequest& request, const std::string& query) {
+    const std::string& body = request.body;
+    auto reply = [&](const std::string& json) {
+        std::string response = http_json_response(json, request.keep_alive);
+        send_all(client_socket, response.data(), response.size());
+    };
+    
+    std::string session_id = get_query_param(query, "session_id");
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        reply(json_response(false, "Invalid session"));
+        return;
+    }
+    OFS_Session session = get_ofs_session(session_id);
+    
+    uint64_t upload_id = parse_u64(get_query_param(query, "upload_id"));
+    if (request.header("content-length").empty() && request.header("transfer-encoding").empty()) {
+        reply(json_response(false, "Content-Length required"));
+        return;
+    }
+    uint64_t length = body.size() + request.body_remaining;
+    
+    if (body.empty() && length > 0 && request.header("expect") == "100-continue") {
+        send_all(client_socket, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    }
+    
+    int result = 0;
+    uint64_t received = body.size();
+    if (received > 0) {
+        result = upload_write(session, upload_id, body.data(), received);
+    }
+    
+    std::vector<char> buffer(BLOCK_SIZE);
+    while (result == 0 && received < length) {
+        ssize_t n = recv(client_socket, buffer.data(), std::min((uint64_t)buffer.size(), length - received), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN && Reactor::wait_ready(client_socket, POLLIN)) continue;
+        if (n <= 0) {
+            // The client went away mid-body; what arrived is unusable.
+            upload_abort(session, upload_id);
+            Logger::warn("[FILE] Upload aborted: connection closed", username);
+            return;
+        }
+        
+        result = upload_write(session, upload_id, buffer.data(), n);
+        received += n;
+    }
+    
+    if (result != 0) {
+        // The rest of the body is not read, so the connection cannot carry
+        // another request.
+        if (received < length) request.keep_alive = false;
+        reply(json_response(false, get_error_message(result)));
+        return;
+    }
+    
+    reply("{\"success\":true,\"received\":" + std::to_string(received) + "}");
+}
+
+std::string change_event_json(const ChangeEvent& event) {
+    static const char* const types[] = {"create", "write", "delete", "rename", "attrib"};
     
+    std::stringstream json;
+    json << "{\"seq\":" << event.seq;
+    json << ",\"type\":\"" << types[static_cast<int>(event.type)] << "\"";
+    json << ",\"path\":\"" << escape_json_string(event.path) << "\"";
+    if (event.type == ChangeType::RENAME) {
+        json << ",\"old_path\":\"" << escape_json_string(event.old_path) << "\"";
+    }
+    json << ",\"entry_type\":\"" << (event.entry_type == 1 ? "directory" : "file") << "\"";
+    json << ",\"size\":" << event.size;
+    json << ",\"modified\":" << event.modified_time << "}";
+    return json.str();
+}
+
+std::string handle_watch_open(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    if (path.empty()) path = "/";
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    uint64_t watch_id = 0;
+    int result = watch_open(nullptr, path, body.get_bool("recursive"), &watch_id);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    return "{\"success\":true,\"watch_id\":\"" + std::to_string(watch_id) + "\"}";
+}
+
+// Long poll: answers as soon as the watch has events, or with none after
+// timeout_ms (at most WATCH_POLL_MAX_MS).
+std::string handle_watch_poll(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    uint64_t watch_id = body.get_uint("watch_id");
+    uint32_t timeout_ms = std::min<uint64_t>(body.get_uint("timeout_ms", WATCH_POLL_MAX_MS),
+                                             WATCH_POLL_MAX_MS);
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    std::vector<ChangeEvent> events;
+    bool overflow = false;
+    int result = watch_poll(watch_id, timeout_ms, &events, &overflow);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,\"overflow\":" << (overflow ? "true" : "false") << ",\"events\":[";
+    for (size_t i = 0; i < events.size(); i++) {
+        if (i > 0) json << ",";
+        json << change_event_json(events[i]);
+    }
+    json << "]}";
+    return json.str();
+}
+
+std::string handle_watch_close(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    uint64_t watch_id = body.get_uint("watch_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    int result = watch_close(watch_id);
+    return result == 0 ? json_response(true, "Watch closed") : json_response(false, get_error_message(result));
+}
+
+// Server-sent events for GET /watch/events?session_id=&path=&recursive=1.
+// The watch lives as long as the connection; a comment line every
+// WATCH_POLL_MAX_MS keeps proxies from timing it out and notices a client
+// that has gone away.
+void stream_watch_events(int client_socket, HttpRequest& request, const std::string& query) {
+    std::string username = get_username_from_session(get_query_param(query, "session_id"));
+    if (username.empty()) {
+        std::string response = http_json_response(json_response(false, "Invalid session"));
+        send_all(client_socket, response.data(), response.size());
+        return;
+    }
+    
+    std::string path = get_query_param(query, "path");
+    if (path.empty()) path = "/";
+    
+    uint64_t watch_id = 0;
+    int result = watch_open(nullptr, path, get_query_param(query, "recursive") == "1", &watch_id);
+    if (result != 0) {
+        std::string response = http_json_response(json_response(false, get_error_message(result)));
+        send_all(client_socket, response.data(), response.size());
+        return;
+    }
+    
+    std::string head = "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Access-Control-Allow-Origin: *\r\n"
+                       "Connection: close\r\n\r\n"
+                       "retry: 2000\n\n";
+    request.keep_alive = false;
+    bool open = send_all(client_socket, head.data(), head.size());
+    
+    std::vector<ChangeEvent> events;
+    while (open) {
+        bool overflow = false;
+        if (watch_poll(watch_id, WATCH_POLL_MAX_MS, &events, &overflow) != 0) break;
+        
+        std::string out;
+        if (overflow) out += "event: overflow\ndata: {}\n\n";
+        for (const ChangeEvent& event : events) {
+            out += "id: " + std::to_string(event.seq) + "\nevent: change\ndata: " + change_event_json(event) + "\n\n";
+        }
+        if (out.empty()) out = ": keepalive\n\n";
+        open = send_all(client_socket, out.data(), out.size());
+    }
+    
+    watch_close(watch_id);
+}
+
+// GET /changes?session_id=&since=N&limit=M: change log records after N.
+// "more" tells the client to ask again from the last seq it received.
+std::string handle_changes(const std::string& query) {
+    std::string username = get_username_from_session(get_query_param(query, "session_id"));
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    static const char* const ops[] = {"create", "write", "delete", "rename", "attrib"};
+    
+    uint64_t since = parse_u64(get_query_param(query, "since"));
+    std::string limit_param = get_query_param(query, "limit");
+    size_t limit = limit_param.empty() ? CHANGES_PAGE_MAX
+                                       : std::min<uint64_t>(parse_u64(limit_param), CHANGES_PAGE_MAX);
+    
+    std::vector<ChangeRecord> records;
+    uint64_t last_seq = 0;
+    int result = changes_since(nullptr, since, limit + 1, &records, &last_seq);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    bool more = records.size() > limit;
+    if (more) records.pop_back();
+    
+    std::stringstream json;
+    json << "{\"success\":true,\"last_seq\":" << last_seq << ",\"more\":" << (more ? "true" : "false");
+    json << ",\"changes\":[";
+    for (size_t i = 0; i < records.size(); i++) {
+        const ChangeRecord& record = records[i];
+        if (i > 0) json << ",";
+        json << "{\"seq\":" << record.seq;
+        json << ",\"op\":\"" << (record.op < 5 ? ops[record.op] : "unknown") << "\"";
+        json << ",\"entry\":" << record.entry;
+        json << ",\"parent\":" << record.parent;
+        json << ",\"name\":\"" << escape_json_string(std::string(record.name, strnlen(record.name, sizeof(record.name)))) << "\"";
+        json << ",\"entry_type\":\"" << (record.type == 1 ? "directory" : "file") << "\"";
+        json << ",\"size\":" << record.size;
+        json << ",\"modified\":" << record.modified_time << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+std::string handle_upload_commit(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    uint64_t upload_id = body.get_uint("upload_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    uint64_t size = 0;
+    int result = upload_commit(get_ofs_session(session_id), upload_id, &size);
     if (result == 0) {
-        std::string content((char*)buffer, size);
-        free_buffer(buffer);
-        Logger::info("[FILE] Read: " + path, username);
-        return "{\"success\":true,\"content\":\"" + escape_json_string(content) + "\"}";
+        Logger::info("[FILE] Upload committed: " + std::to_string(size) + " bytes", username);
+        return json_response(true, "Upload committed");
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+std::string handle_upload_abort(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    uint64_t upload_id = body.get_uint("upload_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    int result = upload_abort(get_ofs_session(session_id), upload_id);
+    if (result == 0) {
+        return json_response(true, "Upload aborted");
     }
     
     return json_response(false, get_error_message(result));
 }
 
-std::string handle_file_edit(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
-    std::string path = extract_json_string(body, "path");
-    std::string content = extract_json_string(body, "content");
+std::string handle_batch(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    static const std::map<std::string, BatchOpType> op_types = {
+        {"create", BatchOpType::CREATE}, {"write", BatchOpType::WRITE},
+        {"delete", BatchOpType::DELETE}, {"mkdir", BatchOpType::MKDIR},
+        {"rename", BatchOpType::RENAME}
+    };
+    
+    std::vector<BatchOp> ops;
+    for (const JsonObject& object : body.get_objects("ops")) {
+        auto type = op_types.find(object.get_string("op"));
+        if (type == op_types.end()) {
+            return json_response(false, "Unknown op in batch: " + object.get_string("op"));
+        }
+        
+        BatchOp op;
+        op.type = type->second;
+        op.path = object.get_string("path");
+        op.new_path = object.get_string("new_path");
+        op.data = object.get_string("content");
+        ops.push_back(std::move(op));
+    }
+    if (ops.empty()) return json_response(false, "No ops specified");
+    
+    bool atomic = body.get_bool("atomic");
+    std::vector<int> results;
+    int result = file_batch(get_ofs_session(session_id), ops, atomic, &results);
+    
+    Logger::info("[FILE] Batch: " + std::to_string(ops.size()) + " ops", username);
+    
+    std::stringstream json;
+    json << "{\"success\":" << (result == 0 ? "true" : "false");
+    json << ",\"rolled_back\":" << (atomic && result != 0 ? "true" : "false");
+    json << ",\"results\":[";
+    for (size_t i = 0; i < results.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"path\":\"" << escape_json_string(ops[i].path) << "\",";
+        json << "\"success\":" << (results[i] == 0 ? "true" : "false") << ",";
+        json << "\"message\":\"" << (results[i] == 0 ? "OK" : get_error_message(results[i])) << "\"}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+std::string handle_file_edit(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    std::string content = body.get_string("content");
     
     if (path.empty()) return json_response(false, "No path specified");
     
@@ -262,8 +819,7 @@ std::string handle_file_edit(const std::string& body) {
         return json_response(false, "Invalid session");
     }
     
-    file_delete(nullptr, path);
-    int result = file_create(nullptr, path, content.c_str(), content.length());
+    int result = file_edit(get_ofs_session(session_id), path, content.c_str(), content.length(), 0);
     
     if (result == 0) {
         Logger::info("[FILE] Edit: " + path, username);
@@ -273,9 +829,9 @@ std::string handle_file_edit(const std::string& body) {
     return json_response(false, get_error_message(result));
 }
 
-std::string handle_file_delete(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
-    std::string path = extract_json_string(body, "path");
+std::string handle_file_delete(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
     
     if (path.empty()) return json_response(false, "No path specified");
     
@@ -294,9 +850,60 @@ std::string handle_file_delete(const std::string& body) {
     return json_response(false, get_error_message(result));
 }
 
-std::string handle_file_list(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
-    std::string path = extract_json_string(body, "path");
+std::string handle_file_versions(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    
+    if (path.empty()) return json_response(false, "No path specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    std::vector<VersionRecord> versions;
+    int result = file_versions(get_ofs_session(session_id), path, &versions);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,\"versions\":[";
+    for (size_t i = 0; i < versions.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"version\":" << versions[i].version;
+        json << ",\"size\":" << versions[i].size;
+        json << ",\"modified\":" << versions[i].modified_time;
+        json << ",\"retired\":" << versions[i].retired_time << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+std::string handle_file_version_restore(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    uint32_t version = body.get_uint("version", 0);
+    
+    if (path.empty()) return json_response(false, "No path specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    int result = file_version_restore(get_ofs_session(session_id), path, version);
+    if (result == 0) {
+        Logger::info("[FILE] Restore: " + path + " v" + std::to_string(version), username);
+        return json_response(true, "Version restored");
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+std::string handle_file_list(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
     if (path.empty()) path = "/";
     
     std::string username = get_username_from_session(session_id);
@@ -304,37 +911,64 @@ std::string handle_file_list(const std::string& body) {
         return json_response(false, "Invalid session");
     }
     
-    FileEntry* entries;
-    int count;
-    int result = dir_list(nullptr, path, &entries, &count);
+    // Without a limit the whole directory is listed, as before.
+    DirListOptions options;
+    options.limit = body.get_uint("limit", 0xFFFFFFFF);
+    options.cursor = body.get_string("cursor");
+    options.name_filter = body.get_string("filter");
+    options.descending = body.get_string("order") == "desc";
+    
+    std::string sort = body.get_string("sort");
+    if (sort == "size") options.sort = DirSortKey::SIZE;
+    else if (sort == "modified") options.sort = DirSortKey::MODIFIED;
+    
+    std::string type = body.get_string("type");
+    if (type == "file") options.type_filter = static_cast<int>(EntryType::FILE);
+    else if (type == "directory") options.type_filter = static_cast<int>(EntryType::DIRECTORY);
+    
+    bool plus = body.get_bool("plus");
+    
+    DirPage page;
+    int result = dir_list_page(nullptr, path, options, &page);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
     
     std::stringstream json;
     json << "{\"success\":true,\"files\":[";
     
-    if (result == 0 && count > 0) {
-        for (int i = 0; i < count; i++) {
-            if (i > 0) json << ",";
-            json << "{";
-            json << "\"name\":\"" << escape_json_string(entries[i].name) << "\",";
-            json << "\"type\":\"" << (entries[i].type == 1 ? "directory" : "file") << "\",";
-            json << "\"size\":" << entries[i].size << ",";
-            
-            std::string full_path = (path == "/") ? "/" + std::string(entries[i].name) : path + "/" + entries[i].name;
-            json << "\"path\":\"" << escape_json_string(full_path) << "\"";
-            json << "}";
-        }
+    for (size_t i = 0; i < page.entries.size(); i++) {
+        const FileEntry& entry = page.entries[i];
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"name\":\"" << escape_json_string(entry.name) << "\",";
+        json << "\"type\":\"" << (entry.type == 1 ? "directory" : "file") << "\",";
+        json << "\"size\":" << entry.size << ",";
+        
+        std::string full_path = (path == "/") ? "/" + std::string(entry.name) : path + "/" + entry.name;
+        json << "\"path\":\"" << escape_json_string(full_path) << "\"";
         
-        free_buffer(entries);
+        if (plus) {
+            char mode[8];
+            snprintf(mode, sizeof(mode), "%04o", entry.permissions);
+            json << ",\"permissions\":\"" << mode << "\"";
+            json << ",\"owner\":\"" << escape_json_string(entry.owner) << "\"";
+            json << ",\"created\":" << entry.created_time;
+            json << ",\"modified\":" << entry.modified_time;
+            json << ",\"inode\":" << entry.inode;
+        }
+        json << "}";
     }
     
-    json << "]}";
+    json << "],\"next_cursor\":\"" << page.next_cursor << "\"";
+    json << ",\"has_more\":" << (page.next_cursor.empty() ? "false" : "true") << "}";
     Logger::info("[DIR] List: " + path, username);
     return json.str();
 }
 
-std::string handle_directory_create(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
-    std::string path = extract_json_string(body, "path");
+std::string handle_directory_create(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
     
     if (path.empty()) return json_response(false, "No path specified");
     
@@ -343,7 +977,7 @@ std::string handle_directory_create(const std::string& body) {
         return json_response(false, "Invalid session");
     }
     
-    int result = dir_create(nullptr, path);
+    int result = dir_create(get_ofs_session(session_id), path);
     
     if (result == 0) {
         Logger::info("[DIR] Create: " + path, username);
@@ -353,8 +987,174 @@ std::string handle_directory_create(const std::string& body) {
     return json_response(false, get_error_message(result));
 }
 
-std::string handle_session_info(const std::string& body) {
-    std::string session_id = extract_json_string(body, "session_id");
+std::string handle_directory_delete(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    
+    if (path.empty()) return json_response(false, "No path specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    uint32_t removed = 1;
+    int result = body.get_bool("recursive") ? dir_delete_tree(nullptr, path, &removed)
+                                                      : dir_delete(nullptr, path);
+    
+    if (result == 0) {
+        Logger::info("[DIR] Delete: " + path + " (" + std::to_string(removed) + " entries)", username);
+        return "{\"success\":true,\"removed\":" + std::to_string(removed) + "}";
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+std::string handle_file_rename(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    std::string new_path = body.get_string("new_path");
+    
+    if (path.empty() || new_path.empty()) return json_response(false, "No path specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    int result = file_rename(nullptr, path, new_path);
+    
+    if (result == 0) {
+        Logger::info("[FILE] Rename: " + path + " -> " + new_path, username);
+        return json_response(true, "Renamed");
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+std::string handle_file_copy(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    std::string new_path = body.get_string("new_path");
+    
+    if (path.empty() || new_path.empty()) return json_response(false, "No path specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    uint32_t copied = 0;
+    int result = dir_copy_tree(get_ofs_session(session_id), path, new_path, &copied);
+    
+    if (result == 0) {
+        Logger::info("[FILE] Copy: " + path + " -> " + new_path, username);
+        return "{\"success\":true,\"copied\":" + std::to_string(copied) + "}";
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+std::string handle_directory_usage(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string path = body.get_string("path");
+    
+    if (path.empty()) return json_response(false, "No path specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    TreeUsage usage;
+    int result = dir_usage(nullptr, path, &usage);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,";
+    json << "\"files\":" << usage.files << ",";
+    json << "\"directories\":" << usage.directories << ",";
+    json << "\"bytes\":" << usage.bytes << ",";
+    json << "\"blocks\":" << usage.blocks << ",";
+    json << "\"disk_bytes\":" << usage.blocks * BLOCK_SIZE << "}";
+    return json.str();
+}
+
+std::string handle_file_search(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string query = body.get_string("query");
+    std::string path = body.get_string("path");
+    if (path.empty()) path = "/";
+    
+    if (query.empty()) return json_response(false, "No query specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    std::vector<SearchHit> hits;
+    int result = file_search(nullptr, query, path, body.get_uint("limit", 100), &hits);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,\"results\":[";
+    for (size_t i = 0; i < hits.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"name\":\"" << escape_json_string(hits[i].entry.name) << "\",";
+        json << "\"type\":\"" << (hits[i].entry.type == 1 ? "directory" : "file") << "\",";
+        json << "\"size\":" << hits[i].entry.size << ",";
+        json << "\"modified\":" << hits[i].entry.modified_time << ",";
+        json << "\"path\":\"" << escape_json_string(hits[i].path) << "\"";
+        json << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+std::string handle_content_search(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    std::string query = body.get_string("query");
+    std::string path = body.get_string("path");
+    if (path.empty()) path = "/";
+    
+    if (query.empty()) return json_response(false, "No query specified");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    std::vector<SearchHit> hits;
+    int result = content_search(nullptr, query, path, body.get_uint("limit", 20), &hits);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,\"results\":[";
+    for (size_t i = 0; i < hits.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"name\":\"" << escape_json_string(hits[i].entry.name) << "\",";
+        json << "\"path\":\"" << escape_json_string(hits[i].path) << "\",";
+        json << "\"size\":" << hits[i].entry.size << ",";
+        json << "\"modified\":" << hits[i].entry.modified_time << ",";
+        json << "\"score\":" << hits[i].score;
+        json << "}";
+    }
+    json << "]}";
+    Logger::info("[SEARCH] " + query, username);
+    return json.str();
+}
+
+std::string handle_session_info(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
     
     std::string username = get_username_from_session(session_id);
     if (username.empty()) {
@@ -364,17 +1164,207 @@ std::string handle_session_info(const std::string& body) {
     return "{\"success\":true,\"username\":\"" + username + "\"}";
 }
 
-std::string handle_http_request(const std::string& http_request) {
-    std::stringstream ss(http_request);
-    std::string method, path, protocol;
-    ss >> method >> path >> protocol;
+// Usage of the caller, of "username", or with "all" of every user. Only
+// admins may look past themselves.
+std::string handle_user_usage(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
     
-    size_t header_end = http_request.find("\r\n\r\n");
-    if (header_end == std::string::npos) header_end = http_request.find("\n\n");
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    std::string target = body.get_string("username");
+    if (target.empty()) target = username;
+    if (body.get_bool("all")) target.clear();
+    
+    std::vector<UserInfo> users;
+    int result = user_usage(get_ofs_session(session_id), target, &users);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,\"users\":[";
+    for (size_t i = 0; i < users.size(); i++) {
+        if (i > 0) json << ",";
+        json << "{\"username\":\"" << escape_json_string(users[i].username) << "\",";
+        json << "\"user_id\":" << users[i].user_id << ",";
+        json << "\"files\":" << users[i].file_count << ",";
+        json << "\"file_quota\":" << users[i].file_quota << ",";
+        json << "\"bytes\":" << users[i].bytes_used << ",";
+        json << "\"byte_quota\":" << users[i].byte_quota << "}";
+    }
+    json << "]}";
+    return json.str();
+}
+
+// UserInfo holds the file quota in 16 bits, so a larger one sets *status to
+// 400 rather than being capped, as admin_cli quota refuses it.
+std::string handle_user_quota(const JsonObject& body, const char** status) {
+    std::string session_id = body.get_string("session_id");
+    std::string target = body.get_string("username");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    if (target.empty()) return json_response(false, "No username specified");
+    
+    uint64_t file_quota = body.get_uint("file_quota", 0);
+    if (file_quota > 0xFFFF) {
+        *status = "400 Bad Request";
+        return json_response(false, "file_quota cannot exceed 65535");
+    }
+    
+    int result = user_set_quota(get_ofs_session(session_id), target,
+                                body.get_uint("byte_quota", 0), file_quota);
+    if (result == 0) {
+        Logger::info("[USER] Quota: " + target, username);
+        return json_response(true, "Quota set");
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+// A size that is not a whole number of bytes, or that the container cannot
+// grow to, sets *status to 400 rather than reaching grow_storage().
+std::string handle_system_grow(const JsonObject& body, const char** status) {
+    std::string session_id = body.get_string("session_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    UserInfo user;
+    if (!g_storage->get_user(username, &user) || user.role != UserRole::ADMIN) {
+        return json_response(false, get_error_message(static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED)));
+    }
+    
+    // get_uint() stops at the first non-digit, so the text is checked whole.
+    JsonValue value = body.get("new_size");
+    uint64_t size = body.get_uint("new_size", 0);
+    if (size == 0 || value.text.find_first_not_of("0123456789") != std::string_view::npos) {
+        *status = "400 Bad Request";
+        return json_response(false, "new_size must be a positive integer");
+    }
+    if (size <= g_storage->get_total_size() || size > (uint64_t)MAX_BLOCKS * (BLOCK_SIZE + 1)) {
+        *status = "400 Bad Request";
+        return json_response(false, "new_size out of range");
+    }
+    
+    int result = grow_storage(nullptr, size);
+    
+    if (result == 0) {
+        Logger::info("[SYSTEM] Grow: " + std::to_string(size), username);
+        return json_response(true, "Storage grown");
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+std::string handle_system_stats(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
     
-    std::string body = header_end != std::string::npos ? http_request.substr(header_end + 4) : "";
+    FSStats stats;
+    memset(&stats, 0, sizeof(stats));
+    int result = get_stats(nullptr, &stats);
+    if (result != 0) {
+        return json_response(false, get_error_message(result));
+    }
+    
+    std::stringstream json;
+    json << "{\"success\":true,";
+    json << "\"total_size\":" << stats.total_size << ",";
+    json << "\"used_space\":" << stats.used_space << ",";
+    json << "\"free_space\":" << stats.free_space << ",";
+    json << "\"checksum_errors\":" << stats.checksum_errors << ",";
+    json << "\"blocks_verified\":" << stats.blocks_verified << ",";
+    json << "\"cache_hits\":" << stats.cache_hits << ",";
+    json << "\"cache_misses\":" << stats.cache_misses << ",";
+    json << "\"dirty_bytes\":" << stats.dirty_bytes << ",";
+    json << "\"flushes\":" << stats.flushes << ",";
+    json << "\"bytes_copied\":" << stats.bytes_copied << ",";
+    json << "\"bytes_shared\":" << stats.bytes_shared << ",";
+    json << "\"escape_bytes_copied\":" << g_escape_bytes_copied << ",";
+    
+    ReactorStats server = g_reactor->get_stats();
+    json << "\"requests\":" << server.requests << ",";
+    json << "\"requests_per_sec\":" << server.requests_per_sec << ",";
+    json << "\"latency_p50_us\":" << server.latency_p50_us << ",";
+    json << "\"latency_p99_us\":" << server.latency_p99_us << ",";
+    json << "\"latency_max_us\":" << server.latency_max_us << ",";
+    json << "\"connections\":" << server.connections << ",";
+    json << "\"connections_accepted\":" << server.accepted << ",";
+    json << "\"connections_rejected\":" << server.rejected << ",";
+    json << "\"connections_timed_out\":" << server.timeouts << ",";
+    json << "\"long_lived\":" << server.long_lived << ",";
+    json << "\"long_lived_rejected\":" << server.long_lived_rejected << ",";
+    
+    ExecutorStats pool = g_executor->get_stats();
+    json << "\"executor_threads\":" << pool.threads << ",";
+    json << "\"executor_tasks\":" << pool.executed << ",";
+    json << "\"executor_steals\":" << pool.steals << ",";
+    json << "\"executor_queued\":" << pool.queued << ",";
+    json << "\"executor_queued_high\":" << pool.queued_by_priority[0] << ",";
+    json << "\"executor_queued_normal\":" << pool.queued_by_priority[1] << ",";
+    json << "\"executor_queued_low\":" << pool.queued_by_priority[2] << ",";
+    json << "\"executor_worker_queues\":[";
+    for (size_t i = 0; i < pool.queued_by_worker.size(); i++) {
+        json << (i ? "," : "") << pool.queued_by_worker[i];
+    }
+    json << "],";
+    json << "\"executor_wait_p50_us\":" << pool.wait.p50_us << ",";
+    json << "\"executor_wait_p99_us\":" << pool.wait.p99_us << ",";
+    json << "\"executor_run_p50_us\":" << pool.run.p50_us << ",";
+    json << "\"executor_run_p99_us\":" << pool.run.p99_us;
+    json << "}";
+    return json.str();
+}
+
+std::string handle_system_sync(const JsonObject& body) {
+    std::string session_id = body.get_string("session_id");
+    
+    std::string username = get_username_from_session(session_id);
+    if (username.empty()) {
+        return json_response(false, "Invalid session");
+    }
+    
+    int result = sync_storage(nullptr);
+    if (result == 0) {
+        return json_response(true, "Storage synced");
+    }
+    
+    return json_response(false, get_error_message(result));
+}
+
+// Returns the full response, or an empty string if the handler has already
+// written its response to client_socket itself.
+std::string handle_http_request(HttpRequest& request, int client_socket) {
+    const std::string& method = request.method;
+    
+    std::string path = request.target;
+    std::string query;
+    size_t query_start = path.find('?');
+    if (query_start != std::string::npos) {
+        query = path.substr(query_start + 1);
+        path.erase(query_start);
+    }
     
     if (method == "GET") {
+        if (path == "/watch/events") {
+            stream_watch_events(client_socket, request, query);
+            return "";
+        }
+        if (path == "/changes") {
+            return http_json_response(handle_changes(query));
+        }
         if (path == "/" || path == "/index.html") {
             return serve_static_file("/web/index.html");
         } else if (path.find("/web/") == 0) {
@@ -384,52 +1374,117 @@ std::string handle_http_request(const std::string& http_request) {
     }
     
     if (method == "POST") {
+        if (path == "/file/read") {
+            stream_file_read(client_socket, request);
+            return "";
+        }
+        if (path == "/file/upload/chunk") {
+            stream_upload_chunk(client_socket, request, query);
+            return "";
+        }
+        
+        // Parsed once; handlers read typed fields from views into the body.
+        JsonObject body(request.body);
+        if (!body.valid()) {
+            return http_json_response(json_response(false, "Malformed JSON body"));
+        }
+        
         std::string response;
         
         if (path == "/user/login") response = handle_login(body);
         else if (path == "/user/logout") response = handle_logout(body);
         else if (path == "/user/signup") response = handle_signup(body);
         else if (path == "/user/session") response = handle_session_info(body);
+        else if (path == "/user/usage") response = handle_user_usage(body);
+        else if (path == "/user/quota") {
+            const char* status = "200 OK";
+            response = handle_user_quota(body, &status);
+            return http_json_response(response, true, status);
+        }
         else if (path == "/file/list") response = handle_file_list(body);
         else if (path == "/file/create") response = handle_file_create(body);
-        else if (path == "/file/read") response = handle_file_read(body);
         else if (path == "/file/edit") response = handle_file_edit(body);
         else if (path == "/file/delete") response = handle_file_delete(body);
+        else if (path == "/file/versions") response = handle_file_versions(body);
+        else if (path == "/file/versions/restore") response = handle_file_version_restore(body);
+        else if (path == "/batch") response = handle_batch(body);
+        else if (path == "/file/upload/begin") response = handle_upload_begin(body);
+        else if (path == "/file/upload/commit") response = handle_upload_commit(body);
+        else if (path == "/file/upload/abort") response = handle_upload_abort(body);
         else if (path == "/directory/create") response = handle_directory_create(body);
+        else if (path == "/directory/delete") response = handle_directory_delete(body);
+        else if (path == "/directory/usage") response = handle_directory_usage(body);
+        else if (path == "/file/search") response = handle_file_search(body);
+        else if (path == "/search") response = handle_content_search(body);
+        else if (path == "/watch/open") response = handle_watch_open(body);
+        else if (path == "/watch/poll") response = handle_watch_poll(body);
+        else if (path == "/watch/close") response = handle_watch_close(body);
+        else if (path == "/file/copy") response = handle_file_copy(body);
+        else if (path == "/file/rename") response = handle_file_rename(body);
+        else if (path == "/system/grow") {
+            const char* status = "200 OK";
+            response = handle_system_grow(body, &status);
+            return http_json_response(response, true, status);
+        }
+        else if (path == "/system/stats") response = handle_system_stats(body);
+        else if (path == "/system/sync") response = handle_system_sync(body);
         else response = json_response(false, "Unknown endpoint");
         
-        std::string http_response = "HTTP/1.1 200 OK\r\n";
-        http_response += "Content-Type: application/json\r\n";
-        http_response += "Content-Length: " + std::to_string(response.length()) + "\r\n";
-        http_response += "Access-Control-Allow-Origin: *\r\n";
-        http_response += "Connection: close\r\n\r\n";
-        http_response += response;
-        
-        return http_response;
+        return http_json_response(response);
     }
     
     if (method == "OPTIONS") {
         return "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: GET, POST, OPTIONS\r\nAccess-Control-Allow-Headers: Content-Type\r\nContent-Length: 0\r\n\r\n";
     }
     
-    return "HTTP/1.1 405 Method Not Allowed\r\n\r\n";
+    return "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n";
 }
 
-void* handle_client(void* arg) {
-    int client_socket = *(int*)arg;
-    delete (int*)arg;
-    
-    char buffer[65536];
-    int bytes_received = recv(client_socket, buffer, 65535, 0);
-    
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        std::string response = handle_http_request(std::string(buffer));
-        send(client_socket, response.c_str(), response.length(), 0);
+// Uploads take their bodies off the socket; watches wait on events rather
+// than storage. Session and stats calls are cheap and someone is waiting on
+// them, so they go ahead of bulk transfers and whole-tree scans.
+RequestClass classify_request(const HttpRequest& request) {
+    const std::string& target = request.target;
+    auto is = [&](const char* path) {
+        size_t length = strlen(path);
+        return target.compare(0, length, path) == 0 &&
+               (target.size() == length || target[length] == '?');
+    };
+    
+    if (request.method == "POST" && is("/file/upload/chunk")) return {RequestKind::STREAMED, TaskPriority::LOW};
+    if (request.method == "GET" && is("/watch/events")) return {RequestKind::LONG_LIVED, TaskPriority::NORMAL};
+    if (request.method == "POST" && is("/watch/poll")) return {RequestKind::LONG_LIVED, TaskPriority::NORMAL};
+    
+    if (is("/user/login") || is("/user/logout") || is("/user/session") || is("/system/stats")) {
+        return {RequestKind::NORMAL, TaskPriority::HIGH};
     }
-    
-    close(client_socket);
-    return nullptr;
+    if (is("/batch") || is("/search") || is("/file/search") || is("/directory/usage") ||
+        is("/system/grow") || is("/system/sync")) {
+        return {RequestKind::NORMAL, TaskPriority::LOW};
+    }
+    return {RequestKind::NORMAL, TaskPriority::NORMAL};
+}
+
+static DurabilityMode parse_durability(const std::string& mode) {
+    if (mode == "sync") return DurabilityMode::SYNC;
+    if (mode == "relaxed") return DurabilityMode::RELAXED;
+    return DurabilityMode::PERIODIC;
+}
+
+// Ctrl+C or a kill ends run() so main can shut down cleanly. The handler
+// is reset once it fires: a second signal kills the server outright.
+static void handle_shutdown_signal(int) {
+    if (g_reactor) g_reactor->stop();
+}
+
+static void install_shutdown_handler() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_shutdown_signal;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
 }
 
 int main() {
@@ -441,70 +1496,91 @@ int main() {
     
     Logger::init();
     
+    ConfigParser::load("default.uconf");
+    uint64_t total_size = ConfigParser::get_uint("filesystem", "total_size", 104857600);
+    uint32_t stripe_count = ConfigParser::get_uint("filesystem", "stripe_count", 1);
+    
     std::cout << "[*] Initializing storage..." << std::endl;
     g_storage = new OmniStorage();
+    g_storage->set_stripe_dirs(ConfigParser::get_list("filesystem", "stripe_dirs"));
+    g_storage->set_readahead(ConfigParser::get_uint("filesystem", "readahead_blocks", 8),
+                             ConfigParser::get_uint("filesystem", "block_cache_blocks", 256));
+    g_storage->set_space_policy(ConfigParser::get_bool("filesystem", "preallocate", false),
+                                ConfigParser::get_bool("filesystem", "punch_holes", false));
+    g_storage->set_write_back(parse_durability(ConfigParser::get_string("filesystem", "durability", "periodic")),
+                              ConfigParser::get_uint("filesystem", "flush_interval_ms", 1000),
+                              ConfigParser::get_uint("filesystem", "dirty_limit", 16777216));
     
     struct stat st;
     if (stat("data/system.omni", &st) != 0) {
         std::cout << "[*] Creating new filesystem..." << std::endl;
-        if (!g_storage->create("data/system.omni", 104857600)) {
-            std::cerr << "[ERROR] Failed to create filesystem" << std::endl;
+        if (!g_storage->create("data/system.omni", total_size, stripe_count)) {
+            std::cerr << "[ERROR] Failed to create filesystem"
+                      << (g_storage->in_use() ? " (in use by another process)" : "") << std::endl;
             return 1;
         }
     } else {
         std::cout << "[*] Opening existing filesystem..." << std::endl;
         if (!g_storage->open("data/system.omni")) {
-            std::cerr << "[ERROR] Failed to open filesystem" << std::endl;
+            std::cerr << "[ERROR] Failed to open filesystem"
+                      << (g_storage->in_use() ? " (in use by another process)" : "") << std::endl;
             return 1;
         }
     }
     
+    g_storage->set_verify_reads(ConfigParser::get_bool("filesystem", "verify_checksums", true));
+    g_storage->set_version_retention(ConfigParser::get_uint("filesystem", "version_keep", 10),
+                                     ConfigParser::get_uint("filesystem", "version_max_age", 0));
     set_storage_instance(g_storage);
+    start_scrubber(ConfigParser::get_uint("filesystem", "scrub_interval_ms", 200),
+                   ConfigParser::get_uint("filesystem", "scrub_batch", 16));
+    if (ConfigParser::get_bool("filesystem", "content_index", true)) {
+        start_content_index("data/system.omni.idx",
+                            ConfigParser::get_uint("filesystem", "content_index_max_bytes", 4194304));
+    }
     
     std::cout << "[*] Loading users..." << std::endl;
     load_users();
     
-    std::cout << "[*] Creating socket..." << std::endl;
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        std::cerr << "[ERROR] Socket creation failed" << std::endl;
-        return 1;
-    }
-    
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(8080);
-    
-    std::cout << "[*] Binding to port 8080..." << std::endl;
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    ReactorConfig reactor_config;
+    reactor_config.port = ConfigParser::get_uint("server", "port", 8080);
+    reactor_config.loop_threads = ConfigParser::get_uint("server", "event_threads", 0);
+    reactor_config.backlog = ConfigParser::get_uint("server", "backlog", 1024);
+    reactor_config.max_connections = ConfigParser::get_uint("server", "max_connections", 10240);
+    reactor_config.idle_timeout_ms = ConfigParser::get_uint("server", "idle_timeout_ms", 60000);
+    reactor_config.max_body = ConfigParser::get_uint("server", "max_body_bytes", 67108864);
+    reactor_config.max_long_lived = ConfigParser::get_uint("server", "max_long_lived", 256);
+    std::string port = std::to_string(reactor_config.port);
+    
+    ExecutorConfig executor_config;
+    executor_config.threads = ConfigParser::get_uint("server", "worker_threads", 0);
+    executor_config.cores = ConfigParser::get_uint("server", "worker_cores", 0);
+    executor_config.pin = ConfigParser::get_bool("server", "pin_workers", false);
+    g_executor = new Executor();
+    g_executor->start(executor_config);
+    
+    std::cout << "[*] Binding to port " << port << "..." << std::endl;
+    g_reactor = new Reactor(g_executor);
+    if (!g_reactor->listen_on(reactor_config)) {
         std::cerr << "[!] Bind failed" << std::endl;
         return 1;
     }
     
-    listen(server_socket, 20);
-    std::cout << "[✓] Server running on http://localhost:8080" << std::endl;
-    std::cout << "[✓] Open http://localhost:8080 in your browser" << std::endl;
+    std::cout << "[✓] Server running on http://localhost:" << port << std::endl;
+    std::cout << "[✓] Open http://localhost:" << port << " in your browser" << std::endl;
     std::cout << "[INFO] Press Ctrl+C to shutdown" << std::endl;
     std::cout << std::endl;
     
-    while (true) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) continue;
-        
-        pthread_t thread_id;
-        int* socket_ptr = new int(client_socket);
-        pthread_create(&thread_id, nullptr, handle_client, socket_ptr);
-        pthread_detach(thread_id);
-    }
+    install_shutdown_handler();
+    g_reactor->run(handle_http_request, classify_request);
+    
+    // Requests already queued finish before storage goes away.
+    std::cout << "[*] Shutting down..." << std::endl;
+    delete g_executor;
+    g_executor = nullptr;
     
-    close(server_socket);
+    stop_content_index();
+    stop_scrubber();
     g_storage->close();
     delete g_storage;
     
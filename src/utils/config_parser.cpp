@@ -118,6 +118,21 @@ bool ConfigParser::get_bool(const std::string& section, const std::string& key,
     return default_val;
 }
 
+std::vector<std::string> ConfigParser::get_list(const std::string& section, const std::string& key) {
+    std::vector<std::string> items;
+    std::stringstream ss(get_string(section, key, ""));
+    std::string item;
+    
+    while (std::getline(ss, item, ',')) {
+        item = trim(item);
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    
+    return items;
+}
+
 void ConfigParser::print_config() {
     std::cout << "=== Configuration ===" << std::endl;
     for (const auto& section : config) {
@@ -0,0 +1,104 @@
+#include "crc32c.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+namespace {
+
+struct SliceTables {
+    uint32_t table[8][256];
+    
+    SliceTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int slice = 1; slice < 8; slice++) {
+                uint32_t prev = table[slice - 1][i];
+                table[slice][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+            }
+        }
+    }
+};
+
+const SliceTables tables;
+
+bool detect_hardware() {
+#ifdef CRC32C_HAVE_SSE42
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+const bool use_hardware = detect_hardware();
+
+}
+
+uint32_t CRC32C::compute(const void* data, size_t size, uint32_t crc) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    return use_hardware ? compute_hw(bytes, size, crc) : compute_sw(bytes, size, crc);
+}
+
+bool CRC32C::hardware_accelerated() {
+    return use_hardware;
+}
+
+uint32_t CRC32C::compute_sw(const uint8_t* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+    
+    while (size >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, data, 4);
+        std::memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = tables.table[7][lo & 0xFF] ^ tables.table[6][(lo >> 8) & 0xFF] ^
+              tables.table[5][(lo >> 16) & 0xFF] ^ tables.table[4][lo >> 24] ^
+              tables.table[3][hi & 0xFF] ^ tables.table[2][(hi >> 8) & 0xFF] ^
+              tables.table[1][(hi >> 16) & 0xFF] ^ tables.table[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ tables.table[0][(crc ^ *data++) & 0xFF];
+    }
+    
+    return ~crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+uint32_t CRC32C::compute_hw(const uint8_t* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+    
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    
+    return ~crc;
+}
+#else
+uint32_t CRC32C::compute_hw(const uint8_t* data, size_t size, uint32_t crc) {
+    return compute_sw(data, size, crc);
+}
+#endif
@@ -0,0 +1,353 @@
+#include "json_reader.hpp"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_HAVE_SSE2 1
+#endif
+
+namespace {
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void skip_space(const char*& p, const char* end) {
+    while (p < end && is_space(*p)) p++;
+}
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool is_number_char(char c) {
+    return is_digit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+// The first '"' or '\' at or after p, or end. String contents are the bulk
+// of a large body (file content), so they are scanned 16 bytes at a time.
+const char* find_quote_or_escape(const char* p, const char* end) {
+#ifdef JSON_HAVE_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i escape = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                  _mm_cmpeq_epi8(chunk, escape)));
+        if (mask != 0) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\') p++;
+    return p;
+}
+
+// p is at an opening quote. Leaves it past the closing one, with text set
+// to what lies between them.
+bool scan_string(const char*& p, const char* end, std::string_view* text, bool* escaped) {
+    const char* start = ++p;
+    *escaped = false;
+    
+    while (true) {
+        p = find_quote_or_escape(p, end);
+        if (p == end) return false;
+        if (*p == '"') break;
+        
+        // The escaped character cannot end the string; \u digits are
+        // checked when the string is decoded.
+        *escaped = true;
+        if (end - p < 2) return false;
+        p += 2;
+    }
+    
+    *text = std::string_view(start, p - start);
+    p++;
+    return true;
+}
+
+// p is at '{' or '['. Leaves it past the matching bracket. Strings are
+// skipped whole, so brackets inside them do not count.
+bool skip_container(const char*& p, const char* end) {
+    char open[JsonObject::MAX_DEPTH];
+    int depth = 0;
+    
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            std::string_view text;
+            bool escaped;
+            if (!scan_string(p, end, &text, &escaped)) return false;
+            continue;
+        }
+        
+        if (c == '{' || c == '[') {
+            if (depth == JsonObject::MAX_DEPTH) return false;
+            open[depth++] = c;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0 || open[depth - 1] != (c == '}' ? '{' : '[')) return false;
+            if (--depth == 0) {
+                p++;
+                return true;
+            }
+        }
+        p++;
+    }
+    return false;
+}
+
+bool scan_literal(const char*& p, const char* end, const char* literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(end - p) < length || memcmp(p, literal, length) != 0) return false;
+    p += length;
+    return true;
+}
+
+bool scan_value(const char*& p, const char* end, JsonValue* value) {
+    if (p == end) return false;
+    const char* start = p;
+    char c = *p;
+    
+    if (c == '"') {
+        value->type = JsonType::STRING;
+        return scan_string(p, end, &value->text, &value->escaped);
+    }
+    
+    if (c == '{' || c == '[') {
+        value->type = c == '{' ? JsonType::OBJECT : JsonType::ARRAY;
+        if (!skip_container(p, end)) return false;
+    } else if (c == '-' || is_digit(c)) {
+        value->type = JsonType::NUMBER;
+        while (p < end && is_number_char(*p)) p++;
+    } else if (scan_literal(p, end, "true") || scan_literal(p, end, "false")) {
+        value->type = JsonType::BOOLEAN;
+    } else if (scan_literal(p, end, "null")) {
+        value->type = JsonType::NULL_VALUE;
+    } else {
+        return false;
+    }
+    
+    value->text = std::string_view(start, p - start);
+    return true;
+}
+
+bool read_hex4(const char* p, const char* end, unsigned* code) {
+    if (end - p < 4) return false;
+    *code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        unsigned digit;
+        if (is_digit(c)) digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return false;
+        *code = *code << 4 | digit;
+    }
+    return true;
+}
+
+// Writes code as UTF-8 at w, which has room for 4 bytes; returns the end.
+char* put_utf8(char* w, unsigned code) {
+    if (code < 0x80) {
+        *w++ = (char)code;
+    } else if (code < 0x800) {
+        *w++ = (char)(0xC0 | code >> 6);
+        *w++ = (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *w++ = (char)(0xE0 | code >> 12);
+        *w++ = (char)(0x80 | (code >> 6 & 0x3F));
+        *w++ = (char)(0x80 | (code & 0x3F));
+    } else {
+        *w++ = (char)(0xF0 | code >> 18);
+        *w++ = (char)(0x80 | (code >> 12 & 0x3F));
+        *w++ = (char)(0x80 | (code >> 6 & 0x3F));
+        *w++ = (char)(0x80 | (code & 0x3F));
+    }
+    return w;
+}
+
+}  // namespace
+
+// Decoding never lengthens a string (a \u escape is six bytes for at most
+// three of UTF-8, a pair twelve for four), so it is written in place into
+// a buffer of the encoded size. A malformed \u escape is kept as written.
+std::string JsonValue::decode() const {
+    if (!escaped) return std::string(text);
+    
+    std::string out(text.size(), '\0');
+    char* w = &out[0];
+    const char* p = text.data();
+    const char* end = p + text.size();
+    
+    while (p < end) {
+#ifdef JSON_HAVE_SSE2
+        // Copies 16 bytes at a time up to the next escape. w trails p, so
+        // a 16-byte store stays inside out.
+        if (end - p >= 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+            _mm_storeu_si128((__m128i*)w, chunk);
+            int run = mask == 0 ? 16 : __builtin_ctz(mask);
+            p += run;
+            w += run;
+            if (run == 16) continue;
+        }
+#endif
+        char c = *p++;
+        if (c != '\\' || p == end) {
+            *w++ = c;
+            continue;
+        }
+        
+        c = *p++;
+        switch (c) {
+            case 'n': *w++ = '\n'; break;
+            case 't': *w++ = '\t'; break;
+            case 'r': *w++ = '\r'; break;
+            case 'b': *w++ = '\b'; break;
+            case 'f': *w++ = '\f'; break;
+            case 'u': {
+                unsigned code;
+                if (!read_hex4(p, end, &code)) {
+                    *w++ = '\\';
+                    *w++ = 'u';
+                    break;
+                }
+                p += 4;
+                
+                // Characters outside the BMP come as a surrogate pair.
+                unsigned low;
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                    read_hex4(p + 2, end, &low) && low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                w = put_utf8(w, code);
+                break;
+            }
+            default: *w++ = c; break;
+        }
+    }
+    
+    out.resize(w - out.data());
+    return out;
+}
+
+JsonObject::JsonObject(std::string_view text) : count(0), ok(false) {
+    ok = parse(text);
+}
+
+void JsonObject::add(const Field& member) {
+    if (count < INLINE_FIELDS) inline_fields[count] = member;
+    else overflow.push_back(member);
+    count++;
+}
+
+bool JsonObject::parse(std::string_view text) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    
+    skip_space(p, end);
+    if (p == end) return true;
+    if (*p != '{') return false;
+    p++;
+    
+    skip_space(p, end);
+    if (p < end && *p == '}') {
+        p++;
+        skip_space(p, end);
+        return p == end;
+    }
+    
+    while (true) {
+        skip_space(p, end);
+        if (p == end || *p != '"') return false;
+        
+        Field member;
+        if (!scan_string(p, end, &member.key, &member.key_escaped)) return false;
+        
+        skip_space(p, end);
+        if (p == end || *p != ':') return false;
+        p++;
+        
+        skip_space(p, end);
+        if (!scan_value(p, end, &member.value)) return false;
+        add(member);
+        
+        skip_space(p, end);
+        if (p == end) return false;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p != '}') return false;
+        
+        p++;
+        skip_space(p, end);
+        return p == end;
+    }
+}
+
+JsonValue JsonObject::get(std::string_view key) const {
+    for (size_t i = 0; i < count; i++) {
+        const Field& member = field(i);
+        if (member.key_escaped) {
+            JsonValue name;
+            name.type = JsonType::STRING;
+            name.text = member.key;
+            name.escaped = true;
+            if (name.decode() == key) return member.value;
+        } else if (member.key == key) {
+            return member.value;
+        }
+    }
+    return JsonValue();
+}
+
+std::string JsonObject::get_string(std::string_view key, const std::string& default_val) const {
+    JsonValue value = get(key);
+    if (value.type == JsonType::MISSING || value.type == JsonType::NULL_VALUE) return default_val;
+    return value.decode();
+}
+
+uint64_t JsonObject::get_uint(std::string_view key, uint64_t default_val) const {
+    JsonValue value = get(key);
+    if (value.type != JsonType::NUMBER && value.type != JsonType::STRING) return default_val;
+    if (value.text.empty() || !is_digit(value.text[0])) return default_val;
+    
+    uint64_t result = 0;
+    for (char c : value.text) {
+        if (!is_digit(c)) break;
+        uint64_t digit = c - '0';
+        if (result > (UINT64_MAX - digit) / 10) return default_val;
+        result = result * 10 + digit;
+    }
+    return result;
+}
+
+bool JsonObject::get_bool(std::string_view key, bool default_val) const {
+    JsonValue value = get(key);
+    if (value.type != JsonType::BOOLEAN) return default_val;
+    return value.text == "true";
+}
+
+std::vector<JsonObject> JsonObject::get_objects(std::string_view key) const {
+    std::vector<JsonObject> objects;
+    JsonValue array = get(key);
+    if (array.type != JsonType::ARRAY) return objects;
+    
+    // The array was delimited when this object was parsed, so its elements
+    // are well formed up to the closing bracket.
+    const char* p = array.text.data() + 1;
+    const char* end = array.text.data() + array.text.size() - 1;
+    while (true) {
+        skip_space(p, end);
+        JsonValue element;
+        if (!scan_value(p, end, &element)) break;
+        if (element.type == JsonType::OBJECT) objects.emplace_back(element.text);
+        
+        skip_space(p, end);
+        if (p == end || *p != ',') break;
+        p++;
+    }
+    return objects;
+}
@@ -0,0 +1,52 @@
+#include "latency_histogram.hpp"
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram() : max_us(0) {
+    for (auto& count : counts) count = 0;
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t latency_us) {
+    if (latency_us < 16) return latency_us;
+    int log = 63 - __builtin_clzll(latency_us);
+    size_t bucket = (log - 3) * 16 + ((latency_us >> (log - 4)) & 15);
+    return std::min(bucket, BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucket_limit(size_t bucket) {
+    if (bucket < 16) return bucket;
+    int log = bucket / 16 + 3;
+    return ((16 + bucket % 16 + 1) << (log - 4)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t latency_us) {
+    counts[bucket_of(latency_us)].fetch_add(1, std::memory_order_relaxed);
+    
+    uint64_t max = max_us;
+    while (latency_us > max && !max_us.compare_exchange_weak(max, latency_us)) {}
+}
+
+LatencySummary LatencyHistogram::summary() const {
+    LatencySummary result = {0, 0, 0, max_us};
+    
+    uint64_t snapshot[BUCKETS];
+    for (size_t i = 0; i < BUCKETS; i++) {
+        snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        result.count += snapshot[i];
+    }
+    
+    uint64_t seen = 0;
+    bool have_p50 = false;
+    for (size_t i = 0; i < BUCKETS && result.count > 0; i++) {
+        seen += snapshot[i];
+        // A bucket's upper bound, unless no sample was that large.
+        if (!have_p50 && seen * 2 >= result.count) {
+            result.p50_us = std::min(bucket_limit(i), result.max_us);
+            have_p50 = true;
+        }
+        if (seen * 100 >= result.count * 99) {
+            result.p99_us = std::min(bucket_limit(i), result.max_us);
+            break;
+        }
+    }
+    return result;
+}
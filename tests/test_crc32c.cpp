@@ -0,0 +1,66 @@
+// CRC32C against the RFC 3720 vectors and a bitwise reference.
+#include "crc32c.hpp"
+#include "test_util.hpp"
+#include <cstring>
+#include <vector>
+
+static uint32_t reference_crc(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static void known_vectors() {
+    uint8_t buffer[32];
+    
+    CHECK_EQ(CRC32C::compute("", 0), 0u);
+    CHECK_EQ(CRC32C::compute("123456789", 9), 0xE3069283u);
+    
+    memset(buffer, 0, sizeof(buffer));
+    CHECK_EQ(CRC32C::compute(buffer, sizeof(buffer)), 0x8A9136AAu);
+    
+    memset(buffer, 0xFF, sizeof(buffer));
+    CHECK_EQ(CRC32C::compute(buffer, sizeof(buffer)), 0x62A8AB43u);
+    
+    for (int i = 0; i < 32; i++) buffer[i] = i;
+    CHECK_EQ(CRC32C::compute(buffer, sizeof(buffer)), 0x46DD794Eu);
+    
+    for (int i = 0; i < 32; i++) buffer[i] = 31 - i;
+    CHECK_EQ(CRC32C::compute(buffer, sizeof(buffer)), 0x113FDB5Cu);
+}
+
+// Every length and alignment around the 8-byte steps of the hardware path.
+static void matches_reference() {
+    std::vector<uint8_t> data(4096 + 16);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 2654435761u >> 24);
+    
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t size = 0; size < 80; size++) {
+            CHECK_EQ(CRC32C::compute(&data[offset], size), reference_crc(&data[offset], size));
+        }
+        CHECK_EQ(CRC32C::compute(&data[offset], 4096), reference_crc(&data[offset], 4096));
+    }
+}
+
+static void continues() {
+    const char* text = "The quick brown fox jumps over the lazy dog";
+    size_t size = strlen(text);
+    uint32_t whole = CRC32C::compute(text, size);
+    CHECK_EQ(whole, 0x22620404u);
+    
+    for (size_t split = 0; split <= size; split++) {
+        uint32_t crc = CRC32C::compute(text, split);
+        CHECK_EQ(CRC32C::compute(text + split, size - split, crc), whole);
+    }
+}
+
+int main() {
+    known_vectors();
+    matches_reference();
+    continues();
+    printf("crc32c: %s\n", CRC32C::hardware_accelerated() ? "hardware" : "software");
+    return test_summary("test_crc32c");
+}
@@ -0,0 +1,85 @@
+// file_ops under concurrency: racing truncates of one file must retire its
+// content once, leaving a copy that shares the chain intact.
+#include "omni_storage.hpp"
+#include "file_ops.hpp"
+#include "user_manager.hpp"
+#include "logger.hpp"
+#include "test_util.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* WORK_DIR = "/tmp/ofs_test_file_ops";
+static const int TRUNCATE_THREADS = 8;
+
+static std::vector<uint8_t> pattern(size_t size, uint32_t seed) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) data[i] = (uint8_t)((i + seed) * 2654435761u >> 24);
+    return data;
+}
+
+// A copied directory shares its files' chains with the original. If both
+// truncates retired the original's chain, the shared count would drop twice
+// and the copy's blocks be freed under it, to be handed to the filler.
+static void racing_truncates() {
+    std::vector<uint8_t> content = pattern(20000, 7);
+
+    for (int round = 0; round < 100; round++) {
+        std::string dir = "/d" + std::to_string(round);
+        std::string copy = "/c" + std::to_string(round);
+        CHECK_EQ(dir_create(nullptr, dir), 0);
+        CHECK_EQ(file_create(nullptr, dir + "/f", content.data(), content.size()), 0);
+        uint32_t copied = 0;
+        CHECK_EQ(dir_copy_tree(nullptr, dir, copy, &copied), 0);
+
+        // All threads start together, so on any machine some of them
+        // look the file up while another is between lookup and attach.
+        std::atomic<int> ready(0);
+        std::atomic<int> failures(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < TRUNCATE_THREADS; i++) {
+            threads.emplace_back([&] {
+                ready++;
+                while (ready < TRUNCATE_THREADS) std::this_thread::yield();
+                if (file_truncate(nullptr, dir + "/f") != 0) failures++;
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        CHECK_EQ(failures.load(), 0);
+        
+        std::vector<uint8_t> filler = pattern(content.size(), round);
+        CHECK_EQ(file_create(nullptr, "/filler" + std::to_string(round), filler.data(), filler.size()), 0);
+
+        SharedBuffer read;
+        CHECK_EQ(file_read(nullptr, copy + "/f", &read), 0);
+        CHECK(read.size() == content.size() && memcmp(read.data(), content.data(), content.size()) == 0);
+        CHECK_EQ(file_read(nullptr, dir + "/f", &read), 0);
+        CHECK_EQ(read.size(), (size_t)0);
+    }
+
+    CHECK_EQ(file_truncate(nullptr, "/d0"), static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION));
+    CHECK_EQ(file_truncate(nullptr, "/missing"), static_cast<int>(OFSErrorCodes::ERROR_NOT_FOUND));
+}
+
+int main() {
+    std::string command = std::string("rm -rf ") + WORK_DIR + " && mkdir -p " + WORK_DIR;
+    if (system(command.c_str()) != 0) return 1;
+    Logger::init(std::string(WORK_DIR) + "/test.log");
+
+    OmniStorage storage;
+    CHECK(storage.create(std::string(WORK_DIR) + "/ops.omni", 64 << 20));
+    g_storage = &storage;
+    set_storage_instance(&storage);
+    load_users();
+
+    racing_truncates();
+
+    storage.close();
+    g_storage = nullptr;
+    command = std::string("rm -rf ") + WORK_DIR;
+    if (system(command.c_str()) != 0) return 1;
+    return test_summary("test_file_ops");
+}
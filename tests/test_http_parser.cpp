@@ -0,0 +1,162 @@
+// HttpParser: framing by Content-Length and chunked coding, pipelined
+// requests, input split at every byte, and the error statuses.
+#include "http_parser.hpp"
+#include "test_util.hpp"
+#include <algorithm>
+#include <string>
+
+// Feeds text in pieces of step bytes until the parser stops taking them.
+// Returns the number of bytes consumed.
+static size_t feed_in_steps(HttpParser& parser, const std::string& text, size_t step) {
+    size_t pos = 0;
+    while (pos < text.size() && !parser.done() && !parser.failed()) {
+        size_t piece = std::min(step, text.size() - pos);
+        pos += parser.feed(text.data() + pos, piece);
+    }
+    return pos;
+}
+
+static int status_of(const std::string& text, uint64_t max_body = 1024) {
+    HttpParser parser(max_body);
+    feed_in_steps(parser, text, text.size());
+    return parser.failed() ? parser.error_status() : 0;
+}
+
+static void request_line_and_headers() {
+    std::string text = "\r\nGET /file/list?path=/a HTTP/1.1\r\nHost: x\r\nX-Custom:   spaced value  \r\n\r\n";
+    HttpParser parser;
+    CHECK_EQ(parser.feed(text.data(), text.size()), text.size());
+    CHECK(parser.done());
+    
+    HttpRequest& request = parser.request();
+    CHECK_EQ(request.method, std::string("GET"));
+    CHECK_EQ(request.target, std::string("/file/list?path=/a"));
+    CHECK_EQ(request.version_minor, 1);
+    CHECK_EQ(request.header("host"), std::string("x"));
+    CHECK_EQ(request.header("x-custom"), std::string("spaced value"));
+    CHECK_EQ(request.header("missing"), std::string(""));
+    CHECK(request.keep_alive);
+    CHECK(request.body.empty());
+}
+
+static void persistence() {
+    const char* cases[][2] = {
+        {"GET / HTTP/1.1\r\n\r\n", "1"},
+        {"GET / HTTP/1.1\r\nConnection: close\r\n\r\n", "0"},
+        {"GET / HTTP/1.1\r\nConnection: Keep-Alive, Close\r\n\r\n", "0"},
+        {"GET / HTTP/1.0\r\n\r\n", "0"},
+    };
+    for (const auto& test : cases) {
+        HttpParser parser;
+        std::string text = test[0];
+        parser.feed(text.data(), text.size());
+        CHECK(parser.done());
+        CHECK_EQ(parser.request().keep_alive, test[1][0] == '1');
+    }
+}
+
+// The same request must parse identically however it is split.
+static void content_length_body() {
+    std::string body = "{\"path\":\"/a.txt\",\"content\":\"hello\"}";
+    std::string text = "POST /file/create HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) +
+                       "\r\n\r\n" + body;
+    
+    for (size_t step = 1; step <= text.size(); step++) {
+        HttpParser parser;
+        CHECK_EQ(feed_in_steps(parser, text, step), text.size());
+        CHECK(parser.done());
+        CHECK_EQ(parser.request().body, body);
+    }
+    
+    // Headers in, body still on the socket.
+    HttpParser parser;
+    std::string head = text.substr(0, text.size() - body.size() + 5);
+    parser.feed(head.data(), head.size());
+    CHECK(parser.headers_done());
+    CHECK(!parser.done());
+    CHECK_EQ(parser.body_pending(), (uint64_t)body.size() - 5);
+}
+
+static void chunked_body() {
+    std::string text = "POST /file/upload/chunk HTTP/1.1\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n"
+                       "5\r\nhello\r\n"
+                       "1;ext=1\r\n,\r\n"
+                       "A\r\n0123456789\r\n"
+                       "0\r\nX-Trailer: ignored\r\n\r\n";
+    
+    for (size_t step = 1; step <= text.size(); step++) {
+        HttpParser parser;
+        CHECK_EQ(feed_in_steps(parser, text, step), text.size());
+        CHECK(parser.done());
+        CHECK_EQ(parser.request().body, std::string("hello,0123456789"));
+        CHECK_EQ(parser.body_pending(), (uint64_t)0);
+    }
+}
+
+// Parsing stops at the end of each request; the caller resets and feeds
+// the rest.
+static void pipelined() {
+    std::string first = "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+    std::string second = "POST /b HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nde\r\n0\r\n\r\n";
+    std::string third = "GET /c HTTP/1.1\r\nConnection: close\r\n\r\n";
+    std::string text = first + second + third;
+    
+    for (size_t step : {(size_t)1, (size_t)7, text.size()}) {
+        HttpParser parser;
+        std::string targets;
+        std::string bodies;
+        size_t pos = 0;
+        
+        for (int i = 0; i < 3; i++) {
+            pos += feed_in_steps(parser, text.substr(pos), step);
+            CHECK(parser.done());
+            targets += parser.request().target;
+            bodies += parser.request().body;
+            if (i == 0) CHECK_EQ(pos, first.size());
+            if (i == 2) CHECK(!parser.request().keep_alive);
+            parser.reset();
+        }
+        CHECK_EQ(pos, text.size());
+        CHECK_EQ(targets, std::string("/a/b/c"));
+        CHECK_EQ(bodies, std::string("abcde"));
+    }
+}
+
+static void errors() {
+    CHECK_EQ(status_of("GET\r\n\r\n"), 400);
+    CHECK_EQ(status_of("GET / HTTP/2.0\r\n\r\n"), 400);
+    CHECK_EQ(status_of("GET / HTTP/1.1\r\nno colon\r\n\r\n"), 400);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nContent-Length: 12a\r\n\r\n"), 400);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n"), 400);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"), 501);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n"), 400);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n"), 400);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n401\r\n"), 413);
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "200\r\n" + std::string(512, 'a') + "\r\n"
+                       "201\r\n"), 413);
+    
+    // Content-Length is left to the handler, so it is not bounded here.
+    CHECK_EQ(status_of("POST / HTTP/1.1\r\nContent-Length: 4096\r\n\r\n"), 0);
+    
+    std::string big = "GET / HTTP/1.1\r\nX-Big: " + std::string(HttpParser::MAX_HEADER_BYTES, 'a') + "\r\n\r\n";
+    CHECK_EQ(status_of(big), 431);
+    
+    // A failed parser takes no more input.
+    HttpParser parser;
+    std::string text = "BROKEN\r\nGET / HTTP/1.1\r\n\r\n";
+    size_t used = parser.feed(text.data(), text.size());
+    CHECK(parser.failed());
+    CHECK_EQ(used, (size_t)8);
+}
+
+int main() {
+    request_line_and_headers();
+    persistence();
+    content_length_body();
+    chunked_body();
+    pipelined();
+    errors();
+    return test_summary("test_http_parser");
+}
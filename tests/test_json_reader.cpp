@@ -0,0 +1,183 @@
+// JsonObject: member lookup and typed getters, string escapes including
+// surrogate pairs, nested values, malformed input and the nesting limit.
+// Values are views into the parsed text, so each text outlives its object.
+#include "json_reader.hpp"
+#include "test_util.hpp"
+#include <string>
+#include <vector>
+
+static std::string nested(int depth, const std::string& inner) {
+    return std::string(depth, '[') + inner + std::string(depth, ']');
+}
+
+static void members() {
+    std::string text = " { \"name\" : \"a.txt\", \"size\": 42, \"big\": 18446744073709551615, "
+                       "\"as_text\": \"17\", \"neg\": -3, \"yes\": true, \"no\": false, \"none\": null, "
+                       "\"name\": \"second\" } ";
+    JsonObject body(text);
+    CHECK(body.valid());
+    CHECK_EQ(body.size(), (size_t)9);
+    
+    CHECK_EQ(body.get_string("name"), std::string("a.txt"));
+    CHECK_EQ(body.get_string("size"), std::string("42"));
+    CHECK_EQ(body.get_string("none", "dflt"), std::string("dflt"));
+    CHECK_EQ(body.get_string("absent", "dflt"), std::string("dflt"));
+    
+    CHECK_EQ(body.get_uint("size"), (uint64_t)42);
+    CHECK_EQ(body.get_uint("big"), UINT64_MAX);
+    CHECK_EQ(body.get_uint("as_text"), (uint64_t)17);
+    CHECK_EQ(body.get_uint("neg", 9), (uint64_t)9);
+    CHECK_EQ(body.get_uint("name", 9), (uint64_t)9);
+    CHECK_EQ(body.get_uint("yes", 9), (uint64_t)9);
+    
+    CHECK(body.get_bool("yes"));
+    CHECK(!body.get_bool("no", true));
+    CHECK(body.get_bool("size", true));
+    CHECK(!body.get_bool("absent"));
+    
+    CHECK(body.get("none").type == JsonType::NULL_VALUE);
+    CHECK(body.get("absent").type == JsonType::MISSING);
+    
+    CHECK(JsonObject("").valid());
+    CHECK_EQ(JsonObject("  ").size(), (size_t)0);
+    CHECK(JsonObject("{}").valid());
+}
+
+static void uint_overflow() {
+    CHECK_EQ(JsonObject("{\"n\": 18446744073709551616}").get_uint("n", 5), (uint64_t)5);
+    CHECK_EQ(JsonObject("{\"n\": 99999999999999999999}").get_uint("n", 5), (uint64_t)5);
+    CHECK_EQ(JsonObject("{\"n\": \"18446744073709551616\"}").get_uint("n", 5), (uint64_t)5);
+    CHECK_EQ(JsonObject("{\"n\": 00042}").get_uint("n"), (uint64_t)42);
+}
+
+static void escapes() {
+    JsonObject body("{\"s\": \"q\\\"b\\\\s\\/n\\nt\\tr\\rb\\bf\\f\", "
+                    "\"bmp\": \"\\u0041\\u00e9\\u20AC\", "
+                    "\"pair\": \"\\ud83d\\ude00\", "
+                    "\"lone\": \"\\ud83dx\", "
+                    "\"bad\": \"\\u12G4\", "
+                    "\"k\\u0065y\": 1}");
+    CHECK(body.valid());
+    CHECK_EQ(body.get_string("s"), std::string("q\"b\\s/n\nt\tr\rb\bf\f"));
+    CHECK_EQ(body.get_string("bmp"), std::string("A\xC3\xA9\xE2\x82\xAC"));
+    CHECK_EQ(body.get_string("pair"), std::string("\xF0\x9F\x98\x80"));
+    CHECK_EQ(body.get_string("lone"), std::string("\xED\xA0\xBDx"));
+    CHECK_EQ(body.get_string("bad"), std::string("\\u12G4"));
+    
+    // Keys are matched after decoding.
+    CHECK_EQ(body.get_uint("key"), (uint64_t)1);
+    
+    // The raw view keeps the escapes until decode().
+    JsonValue value = body.get("pair");
+    CHECK(value.escaped);
+    CHECK_EQ(std::string(value.text), std::string("\\ud83d\\ude00"));
+    CHECK(!JsonObject("{\"s\": \"plain\"}").get("s").escaped);
+}
+
+// Long strings are scanned and decoded 16 bytes at a time; an escape at
+// every offset of a block must come out the same.
+static void long_strings() {
+    for (size_t offset = 0; offset < 40; offset++) {
+        std::string prefix(offset, 'a');
+        std::string suffix(37 - offset % 7, 'z');
+        std::string text = "{\"s\": \"" + prefix + "\\\"\\n\\u00e9" + suffix + "\"}";
+        JsonObject body(text);
+        CHECK(body.valid());
+        CHECK_EQ(body.get_string("s"), prefix + "\"\n\xC3\xA9" + suffix);
+    }
+    
+    std::string content(100000, 'x');
+    content[50000] = '{';
+    content[70000] = ']';
+    std::string text = "{\"content\": \"" + content + "\", \"after\": 1}";
+    JsonObject body(text);
+    CHECK(body.valid());
+    CHECK_EQ(body.get_string("content").size(), content.size());
+    CHECK_EQ(body.get_uint("after"), (uint64_t)1);
+}
+
+static void nesting() {
+    JsonObject body("{\"operations\": [{\"op\": \"create\", \"path\": \"/a]}\"}, 7, \"x\", "
+                    "{\"op\": \"delete\", \"opts\": {\"deep\": [1, {\"n\": 2}]}}, []], "
+                    "\"object\": {\"inner\": \"}\"}, \"tail\": true}");
+    CHECK(body.valid());
+    CHECK(body.get_bool("tail"));
+    CHECK(body.get("object").type == JsonType::OBJECT);
+    CHECK(body.get("operations").type == JsonType::ARRAY);
+    
+    std::vector<JsonObject> operations = body.get_objects("operations");
+    CHECK_EQ(operations.size(), (size_t)2);
+    if (operations.size() == 2) {
+        CHECK_EQ(operations[0].get_string("path"), std::string("/a]}"));
+        CHECK_EQ(operations[1].get_string("op"), std::string("delete"));
+        CHECK(operations[1].get("opts").type == JsonType::OBJECT);
+    }
+    CHECK(body.get_objects("object").empty());
+    CHECK(body.get_objects("absent").empty());
+    
+    // More members than are held inline.
+    std::string text = "{";
+    for (int i = 0; i < 40; i++) {
+        text += (i ? ",\"f" : "\"f") + std::to_string(i) + "\":" + std::to_string(i);
+    }
+    text += "}";
+    JsonObject wide(text);
+    CHECK(wide.valid());
+    CHECK_EQ(wide.size(), (size_t)40);
+    CHECK_EQ(wide.get_uint("f0"), (uint64_t)0);
+    CHECK_EQ(wide.get_uint("f15"), (uint64_t)15);
+    CHECK_EQ(wide.get_uint("f16"), (uint64_t)16);
+    CHECK_EQ(wide.get_uint("f39"), (uint64_t)39);
+}
+
+static void depth_limit() {
+    CHECK(JsonObject("{\"a\": " + nested(JsonObject::MAX_DEPTH, "1") + "}").valid());
+    CHECK(!JsonObject("{\"a\": " + nested(JsonObject::MAX_DEPTH + 1, "1") + "}").valid());
+    CHECK(!JsonObject("{\"a\": " + nested(100000, "") + "}").valid());
+}
+
+static void malformed() {
+    const char* cases[] = {
+        "{",
+        "}",
+        "[]",
+        "{\"a\"}",
+        "{\"a\" 1}",
+        "{\"a\": }",
+        "{\"a\": 1,}",
+        "{\"a\": 1 \"b\": 2}",
+        "{\"a\": \"unterminated}",
+        "{\"a\": \"ends in escape\\",
+        "{\"a\": tru}",
+        "{\"a\": nul}",
+        "{\"a\": [1, 2}",
+        "{\"a\": {\"b\": [}]}",
+        "{\"a\": ]}",
+        "{'a': 1}",
+        "{a: 1}",
+        "{\"a\": 1} trailing",
+        "{\"a\": 1}{}",
+    };
+    for (const char* text : cases) {
+        JsonObject body(text);
+        if (body.valid()) fprintf(stderr, "accepted: %s\n", text);
+        CHECK(!body.valid());
+    }
+    
+    // Members before the error are kept.
+    JsonObject partial("{\"a\": 1, \"b\": \"two\", \"c\": ");
+    CHECK(!partial.valid());
+    CHECK_EQ(partial.size(), (size_t)2);
+    CHECK_EQ(partial.get_string("b"), std::string("two"));
+}
+
+int main() {
+    members();
+    uint_overflow();
+    escapes();
+    long_strings();
+    nesting();
+    depth_limit();
+    malformed();
+    return test_summary("test_json_reader");
+}
@@ -0,0 +1,159 @@
+// Container format round trip: create, write, reopen, grow, reopen, scrub;
+// and small grows of a container whose bitmap is larger than a block.
+#include "omni_storage.hpp"
+#include "logger.hpp"
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char* WORK_DIR = "/tmp/ofs_test_storage";
+
+static std::vector<uint8_t> pattern(size_t size, uint32_t seed) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) data[i] = (uint8_t)((i + seed) * 2654435761u >> 24);
+    return data;
+}
+
+static uint32_t add_file(OmniStorage& storage, const std::string& name, const std::vector<uint8_t>& data) {
+    uint32_t idx = storage.allocate_entry(0, 0, name, 0);
+    CHECK(idx != 0xFFFFFFFF);
+    CHECK(storage.write_file_data(idx, data.data(), data.size()));
+    return idx;
+}
+
+static void check_file(OmniStorage& storage, const std::string& name, const std::vector<uint8_t>& data) {
+    uint32_t idx = storage.find_child(0, name);
+    CHECK(idx != 0xFFFFFFFF);
+    
+    std::vector<uint8_t> read(data.size());
+    CHECK_EQ(storage.read_file_data(idx, read.data(), read.size()), data.size());
+    CHECK(read == data);
+}
+
+static void check_scrub(OmniStorage& storage) {
+    uint32_t used = 0;
+    for (uint32_t i = 1; i < storage.get_total_blocks(); i++) {
+        if (!storage.is_block_used(i)) continue;
+        used++;
+        CHECK(storage.verify_block(i));
+    }
+    CHECK(used > 0);
+    CHECK_EQ(storage.get_checksum_errors(), 0u);
+}
+
+static void round_trip(uint32_t stripes) {
+    std::string path = std::string(WORK_DIR) + "/rt" + std::to_string(stripes) + ".omni";
+    std::vector<uint8_t> first = pattern(300000, 1);
+    std::vector<uint8_t> second = pattern(12000000, 2);
+    
+    {
+        OmniStorage storage;
+        CHECK(storage.create(path, 16 << 20, stripes));
+        CHECK_EQ(storage.get_stripe_count(), stripes);
+        add_file(storage, "first.bin", first);
+        storage.close();
+    }
+    
+    uint32_t old_blocks;
+    {
+        OmniStorage storage;
+        CHECK(storage.open(path));
+        check_file(storage, "first.bin", first);
+        
+        // One process at a time: a second open is refused while this one
+        // holds the container.
+        OmniStorage other;
+        CHECK(!other.open(path));
+        CHECK(other.in_use());
+        
+        old_blocks = storage.get_total_blocks();
+        CHECK(!storage.grow(storage.get_total_size()));
+        CHECK(storage.grow(40 << 20));
+        CHECK(storage.get_total_blocks() > old_blocks);
+        CHECK_EQ(storage.get_total_size(), (uint64_t)40 << 20);
+        
+        // Larger than the free space before the grow, so it needs new blocks.
+        add_file(storage, "second.bin", second);
+        check_file(storage, "first.bin", first);
+        storage.close();
+    }
+    
+    {
+        OmniStorage storage;
+        CHECK(storage.open(path));
+        CHECK(storage.get_total_blocks() > old_blocks);
+        check_file(storage, "first.bin", first);
+        check_file(storage, "second.bin", second);
+        check_scrub(storage);
+        storage.close();
+    }
+}
+
+static OMNIHeader read_header(const std::string& path) {
+    OMNIHeader header;
+    memset(&header, 0, sizeof(header));
+    FILE* file = fopen(path.c_str(), "rb");
+    CHECK(file != nullptr);
+    if (file) {
+        CHECK_EQ(fread(&header, sizeof(header), 1, file), (size_t)1);
+        fclose(file);
+    }
+    return header;
+}
+
+// Once grown, a container keeps its bitmap after the block area, and the
+// next grow adds blocks on top of it. Past 4 GB the bitmap is larger than
+// a block, so a grow by one block must not write the new bitmap over the
+// old one, which stays live until the header moves. It goes after the old
+// one, or the grow is refused. The container is sparse, so this costs no disk.
+static void small_grows() {
+    std::string path = std::string(WORK_DIR) + "/small.omni";
+    std::vector<uint8_t> data = pattern(200000, 3);
+    
+    OmniStorage storage;
+    CHECK(storage.create(path, (uint64_t)4400 << 20));
+    add_file(storage, "data.bin", data);
+    CHECK(storage.grow((uint64_t)4500 << 20));
+    
+    OMNIHeader before = read_header(path);
+    CHECK(before.bitmap_offset > before.block_area_offset);
+    CHECK(before.total_blocks > BLOCK_SIZE);
+    CHECK(storage.get_free_space() > ((uint64_t)4 << 30));
+    
+    // One more block, with its bitmap right after the old one: the
+    // smallest size that fits, and one byte less.
+    uint64_t fit = before.bitmap_offset + 2 * (uint64_t)before.total_blocks + 1;
+    CHECK(!storage.grow(fit - 1));
+    CHECK_EQ(storage.get_total_size(), before.total_size);
+    CHECK(storage.grow(fit));
+    
+    OMNIHeader after = read_header(path);
+    CHECK_EQ(after.total_blocks, before.total_blocks + 1);
+    CHECK(after.bitmap_offset >= before.bitmap_offset + before.total_blocks);
+    CHECK(after.bitmap_offset >= after.block_area_offset + (uint64_t)after.total_blocks * BLOCK_SIZE);
+    CHECK(after.bitmap_offset + after.total_blocks <= after.total_size);
+    storage.close();
+    
+    OmniStorage reopened;
+    CHECK(reopened.open(path));
+    CHECK_EQ(reopened.get_total_blocks(), after.total_blocks);
+    check_file(reopened, "data.bin", data);
+    reopened.close();
+}
+
+int main() {
+    std::string command = std::string("rm -rf ") + WORK_DIR + " && mkdir -p " + WORK_DIR;
+    if (system(command.c_str()) != 0) return 1;
+    Logger::init(std::string(WORK_DIR) + "/test.log");
+    
+    round_trip(1);
+    round_trip(2);
+    small_grows();
+    
+    command = std::string("rm -rf ") + WORK_DIR;
+    if (system(command.c_str()) != 0) return 1;
+    return test_summary("test_storage");
+}
@@ -0,0 +1,49 @@
+#ifndef TEST_UTIL_HPP
+#define TEST_UTIL_HPP
+
+// Minimal checks for the unit test programs in tests/. A failed check is
+// reported and counted; the program carries on and test_summary() turns
+// the count into its exit status.
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+// Every test links the whole engine, which refers to the container the
+// program defines; tests that use one set it.
+class OmniStorage;
+OmniStorage* g_storage = nullptr;
+
+static int test_checks = 0;
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+    test_checks++; \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+    test_checks++; \
+    auto test_actual_ = (actual); \
+    auto test_expected_ = (expected); \
+    if (!(test_actual_ == test_expected_)) { \
+        std::ostringstream test_out_; \
+        test_out_ << test_actual_ << " != " << test_expected_; \
+        fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %s\n", __FILE__, __LINE__, \
+                #actual, #expected, test_out_.str().c_str()); \
+        test_failures++; \
+    } \
+} while (0)
+
+inline int test_summary(const char* name) {
+    if (test_failures > 0) {
+        printf("%s: %d of %d checks failed\n", name, test_failures, test_checks);
+        return 1;
+    }
+    printf("%s: %d checks passed\n", name, test_checks);
+    return 0;
+}
+
+#endif
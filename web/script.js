@@ -2,8 +2,13 @@ let currentUser = null;
 let currentPath = "/";
 let currentSessionId = null;
 let allFiles = [];
+let nextCursor = "";
+let watchSource = null;
+let watchedPath = null;
+let reloadTimer = null;
 
 const API_BASE = "http://localhost:8080";
+const PAGE_SIZE = 200;
 
 document.addEventListener('DOMContentLoaded', () => {
     setupEventListeners();
@@ -200,6 +205,7 @@ function clearAuth() {
     currentSessionId = null;
     currentPath = "/";
     allFiles = [];
+    stopWatching();
     
     localStorage.removeItem('currentUser');
     localStorage.removeItem('sessionId');
@@ -262,9 +268,38 @@ function updateBreadcrumb() {
     document.getElementById('currentPath').textContent = currentPath;
 }
 
-async function loadFiles() {
+// Reloads the listing when the server reports a change in the current
+// directory, instead of polling it.
+function watchDirectory() {
+    if (watchSource && watchedPath === currentPath) return;
+    stopWatching();
+
+    const params = `session_id=${encodeURIComponent(currentSessionId)}&path=${encodeURIComponent(currentPath)}`;
+    watchSource = new EventSource(`${API_BASE}/watch/events?${params}`);
+    watchedPath = currentPath;
+
+    const reload = () => {
+        clearTimeout(reloadTimer);
+        reloadTimer = setTimeout(() => loadFiles(), 200);
+    };
+    watchSource.addEventListener('change', reload);
+    watchSource.addEventListener('overflow', reload);
+}
+
+function stopWatching() {
+    if (watchSource) watchSource.close();
+    watchSource = null;
+    watchedPath = null;
+    clearTimeout(reloadTimer);
+}
+
+async function loadFiles(append = false) {
     const fileList = document.getElementById('fileList');
-    fileList.innerHTML = '<div class="loading">Loading files...</div>';
+    if (!append) {
+        fileList.innerHTML = '<div class="loading">Loading files...</div>';
+        allFiles = [];
+        nextCursor = "";
+    }
 
     if (!currentSessionId) {
         fileList.innerHTML = '<div class="empty-state">Session expired. Please login again.</div>';
@@ -277,16 +312,20 @@ async function loadFiles() {
             headers: { 'Content-Type': 'application/json' },
             body: JSON.stringify({ 
                 path: currentPath,
-                session_id: currentSessionId
+                session_id: currentSessionId,
+                limit: PAGE_SIZE,
+                cursor: nextCursor
             })
         });
 
         const data = await response.json();
 
         if (data.success && data.files) {
-            allFiles = data.files;
-            displayFiles(data.files);
-            document.getElementById('fileCount').textContent = data.files.length;
+            watchDirectory();
+            allFiles = allFiles.concat(data.files);
+            nextCursor = data.next_cursor || "";
+            displayFiles(allFiles);
+            document.getElementById('fileCount').textContent = allFiles.length + (nextCursor ? '+' : '');
         } else if (!data.success && data.message === 'Invalid session') {
             clearAuth();
             showLoginScreen();
@@ -325,6 +364,14 @@ function displayFiles(files) {
 
         fileList.appendChild(fileItem);
     });
+
+    if (nextCursor && files === allFiles) {
+        const more = document.createElement('button');
+        more.className = 'btn-secondary load-more';
+        more.textContent = 'Load more';
+        more.onclick = () => loadFiles(true);
+        fileList.appendChild(more);
+    }
 }
 
 function filterFiles(query) {